@@ -10,9 +10,9 @@ if (isset($_GET['k']))
 #		unlink($outFile);
 	}
 if (isset($_GET['m']))
-	if (file_exists($_GET['m'].".off+"))
+	if (file_exists($_GET['m'].".offz"))
 	{
 		header("Content-type: application/octet-steam");
-		header("Content-disposition: attachment; filename=model.off+");
-		readfile($_GET['m'].".off+");
+		header("Content-disposition: attachment; filename=model.offz");
+		readfile($_GET['m'].".offz");
 	}
@@ -1,9 +1,3 @@
-<?php
-/*
-sudo Xvfb :1 -screen 0 1024x768x24 </dev/null &
-export DISPLAY=":1"
-*/
-?>
 <h1>L+System</h1>
 <h2>Generating Stochastic Fast L-System Trees</h2>
 <?php
@@ -18,10 +12,9 @@ if (isset($_POST['description']))
 	$lFile=$base.".l++";
 	file_put_contents($lFile,$_POST['description']);
 	$imgFile=$base.".jpg";
-	$outFile=$base.".off+";
-	shell_exec("ulimit -t {$timeLimit};".__DIR__."/src/meshpro '{$lFile}' '{$outFile}'");
-	putenv("DISPLAY=:1");
-	$str=("ulimit -t {$timeLimit};". __DIR__."/src/meshview '{$outFile}' -exit_immediately -output_image '{$imgFile}' 2>&1");
+	$outFile=$base.".offz";
+	chdir(__DIR__);
+	$str=("ulimit -t {$timeLimit};".__DIR__."/src/meshpro '{$lFile}' '{$outFile}' -output_image '{$imgFile}' 2>&1");
 	$r=shell_exec($str);
 	#echo $str;
 	$totalTime=microtime(true)-$start;
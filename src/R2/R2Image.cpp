@@ -616,7 +616,7 @@ ReadBMP(const char *filename)
   /* ignore bmfh.bfSize */
   /* ignore bmfh.bfReserved1 */
   /* ignore bmfh.bfReserved2 */
-  assert(bmfh.bfOffBits == BMP_BF_OFF_BITS);
+  assert(bmfh.bfOffBits >= BMP_BF_OFF_BITS);  /* later info headers are longer */
   
   /* Read info header */
   BITMAPINFOHEADER bmih;
@@ -633,7 +633,7 @@ ReadBMP(const char *filename)
   bmih.biClrImportant = DWordReadLE(fp);
   
   // Check info header 
-  assert(bmih.biSize == BMP_BI_SIZE);
+  assert(bmih.biSize >= BMP_BI_SIZE);  /* BITMAPV4HEADER and BITMAPV5HEADER extend it */
   assert(bmih.biWidth > 0);
   assert(bmih.biHeight > 0);
   assert(bmih.biPlanes == 1);
@@ -641,6 +641,7 @@ ReadBMP(const char *filename)
   assert(bmih.biCompression == BI_RGB);   /* RGB */
   int lineLength = bmih.biWidth * 3;  /* RGB */
   if ((lineLength % 4) != 0) lineLength = (lineLength / 4 + 1) * 4;
+  if (bmih.biSizeImage == 0) bmih.biSizeImage = lineLength * bmih.biHeight;  /* allowed for BI_RGB */
   assert(bmih.biSizeImage == (unsigned int) lineLength * (unsigned int) bmih.biHeight);
 
   // Assign width, height, and number of pixels
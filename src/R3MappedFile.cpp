@@ -0,0 +1,123 @@
+// Source file for files mapped into memory
+
+
+
+// Include files
+
+#include "R3MappedFile.h"
+#include <cstdio>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <windows.h>
+#endif
+
+
+
+////////////////////////////////////////////////////////////
+// MAPPED FILE MEMBER FUNCTIONS
+////////////////////////////////////////////////////////////
+
+R3MappedFile::
+R3MappedFile(void)
+: data(NULL),
+size(0)
+#ifdef _WIN32
+, file_handle(NULL),
+mapping_handle(NULL)
+#endif
+{
+}
+
+
+
+R3MappedFile::
+~R3MappedFile(void)
+{
+  // Unmap file
+  Close();
+}
+
+
+
+int R3MappedFile::
+Open(const char *filename)
+{
+  // Close previous file
+  Close();
+
+  // Map file into memory (an empty file has no data)
+#ifdef _WIN32
+  HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    fprintf(stderr, "Unable to open file %s\n", filename);
+    return 0;
+  }
+  file_handle = file;
+  LARGE_INTEGER file_size;
+  GetFileSizeEx(file, &file_size);
+  if (file_size.QuadPart == 0) return 1;
+  mapping_handle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  data = (mapping_handle) ? (const unsigned char *) MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0) : NULL;
+  if (!data) {
+    fprintf(stderr, "Unable to map file %s\n", filename);
+    Close();
+    return 0;
+  }
+  size = (size_t) file_size.QuadPart;
+#else
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Unable to open file %s\n", filename);
+    return 0;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    fprintf(stderr, "Unable to read file %s\n", filename);
+    close(fd);
+    return 0;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return 1;
+  }
+  void *view = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (view == MAP_FAILED) {
+    fprintf(stderr, "Unable to map file %s\n", filename);
+    return 0;
+  }
+  data = (const unsigned char *) view;
+  size = (size_t) st.st_size;
+
+  // The file is read front to back
+  madvise(view, size, MADV_SEQUENTIAL);
+#endif
+
+  // Return success
+  return 1;
+}
+
+
+
+void R3MappedFile::
+Close(void)
+{
+  // Unmap file
+#ifdef _WIN32
+  if (data) UnmapViewOfFile(data);
+  if (mapping_handle) CloseHandle(mapping_handle);
+  if (file_handle) CloseHandle(file_handle);
+  mapping_handle = NULL;
+  file_handle = NULL;
+#else
+  if (data) munmap((void *) data, size);
+#endif
+
+  // Reset data
+  data = NULL;
+  size = 0;
+}
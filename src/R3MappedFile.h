@@ -0,0 +1,39 @@
+#ifndef R3MAPPEDFILE_H
+#define R3MAPPEDFILE_H
+// Include file for files mapped into memory
+
+
+
+////////////////////////////////////////////////////////////
+// DEPENDENCY INCLUDE FILES
+////////////////////////////////////////////////////////////
+
+#include <cstddef>
+
+
+
+////////////////////////////////////////////////////////////
+// MAPPED FILE DECLARATION
+////////////////////////////////////////////////////////////
+
+struct R3MappedFile {
+  // Constructors
+  R3MappedFile(void);
+  ~R3MappedFile(void);
+
+  // File functions (the data stays valid until the file is closed)
+  int Open(const char *filename);
+  void Close(void);
+
+  // Data
+  const unsigned char *data;
+  size_t size;
+#ifdef _WIN32
+  void *file_handle;
+  void *mapping_handle;
+#endif
+};
+
+
+
+#endif
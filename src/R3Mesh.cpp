@@ -6,6 +6,13 @@
 
 #include "R3Mesh.h"
 #include "lplus.h"
+#include "R3MappedFile.h"
+#include "R3MeshStream.h"
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <string>
+#include <thread>
 
 void R3Mesh::
 Twist(double angle)
@@ -23,113 +30,157 @@ R3Shape R3Mesh::Leaf(const R3Vector direction)
   float z;
   z=direction.Dot(R3Vector(0,1,0))/4.0; //bend towards earth
   
-  if (z==0) z=(rand()%20 -10 ) /100.0; //some random bend if non
-
-  vector<R3MeshVertex *> face;
-  face.push_back(CreateVertex(R3Point(0,.01,0)  ,R2Point(.5,.01) )); 
-  face.push_back(CreateVertex(R3Point(.2,.1,0)  ,R2Point(.7,.1) ));
-  face.push_back(CreateVertex(R3Point(.25,.3,0) ,R2Point(.75,.3) ));
-  face.push_back(CreateVertex(R3Point(.2,.6,z/2) ,R2Point(.7,.6) ));
+  if (z==0) z=(random.Next()%20 -10 ) /100.0; //some random bend if non
+
+  // The leaf bends along its midrib: flat up to y=.3, then z/2 at y=.6
+  // and z at the tip, so normals tilt by the slope of the midrib there
+  float base=0,middle=(z/2)/.3,tip=(z/2)/(.4-z);
+  R3Vector flat(0,0,1);
+  R3Vector lower(0,-(base+middle)/2,1); lower.Normalize();
+  R3Vector upper(0,-(middle+tip)/2,1); upper.Normalize();
+  R3Vector end(0,-tip,1); end.Normalize();
+
+  int first=NVertices();
+  CreateVertex(R3Point(0,.01,0)  ,flat,R2Point(.5,.01) ); 
+  CreateVertex(R3Point(.2,.1,0)  ,flat,R2Point(.7,.1) );
+  CreateVertex(R3Point(.25,.3,0) ,lower,R2Point(.75,.3) );
+  CreateVertex(R3Point(.2,.6,z/2) ,upper,R2Point(.7,.6) );
   
 
-  face.push_back(CreateVertex(R3Point(0,1-z,z) ,R2Point(.5,1) ));
-  face.push_back(CreateVertex(R3Point(-.2,.6,z/2) ,R2Point(.3,.6) ));
-  face.push_back(CreateVertex(R3Point(-.25,.3,0) ,R2Point(.25,.3) ));
-  face.push_back(CreateVertex(R3Point(-.2,.1,0) ,R2Point(.3,.1) ));
-  CreateFace(face)->isLeaf=true;
-  return face;
+  CreateVertex(R3Point(0,1-z,z) ,end,R2Point(.5,1) );
+  CreateVertex(R3Point(-.2,.6,z/2) ,upper,R2Point(.3,.6) );
+  CreateVertex(R3Point(-.25,.3,0) ,lower,R2Point(.25,.3) );
+  CreateVertex(R3Point(-.2,.1,0) ,flat,R2Point(.3,.1) );
+  for (int i=first;i<first+8;i++) vertices[i]->tangent=R3Vector(1,0,0); //along texture u
+  CreatePolygon(vertices.data()+first,8,true);
+  return R3Shape(first,8);
 
 }
+const vector<R2Point>& R3Mesh::Ring(int slices)
+{
+  // Return (cos,sin) around the unit circle, computed once per slice count
+  // (values are single precision, like the float angles they come from)
+  vector<R2Point>& ring=rings[slices];
+  if (ring.empty())
+  {
+    ring.reserve(slices);
+    for(int i=0; i<slices; i++) 
+    {
+      float theta = ((float)i)* (2.0*M_PI/slices);
+      ring.push_back(R2Point(cos(theta),sin(theta)));
+    }
+  }
+  return ring;
+}
 R3Shape R3Mesh::Circle(float radius,int slices)
 {
-  vector<R3MeshVertex *> face_vertices;
+  const vector<R2Point>& ring=Ring(slices);
+  int first=NVertices();
   for(int i=0; i<slices; i++) 
   {
-    R3MeshVertex*t;
-    float theta = ((float)i)* (2.0*M_PI/slices);
-    t=CreateVertex(R3Point(radius*cos(theta), 0, radius*sin(theta))); //vertices at edges of circle
-    face_vertices.push_back(t);
+    R3MeshVertex *t=CreateVertex(R3Point(radius*(float)ring[i].X(), 0, radius*(float)ring[i].Y()),R3Vector(0,-1,0),R2zero_point); //vertices at edges of circle
+    t->tangent=R3Vector(-ring[i].Y(),0,ring[i].X());
   }
-  CreateFace(face_vertices);
-  return face_vertices;
+  CreatePolygon(vertices.data()+first,slices);
+  return R3Shape(first,slices);
 
 }
 R3Shape R3Mesh::Cylinder(float topBottomRatio,int slices)
 {
-  static bool cached=false;
-  cached=false;
-  static vector<R3Point> cache;
-  int cacheIndex=0;
+  const vector<R2Point>& ring=Ring(slices);
 
   float length=1,radius=1;
   float topRadius=topBottomRatio;
-  R3Shape vertices;
-  R3Shape bottom_circle;
-  R3Shape top_circle;
-  R3Shape side;
+  int first=NVertices();
   for(int i=0; i<slices; i++) 
   {
-    R3MeshVertex*t1,*t2;
-    R3Point p;
-    float theta = ((float)i)* (2.0*M_PI/slices);
-
-    if (!cached) cache.push_back( p=R3Point(topRadius*cos(theta), length, topRadius*sin(theta)) );
-    else p=cache[cacheIndex++];
-    t1=CreateVertex(p,R2Point(i*2/(float)slices,1)) ; //vertices at edges of circle
-    top_circle.push_back(t1);
-    vertices.push_back(t1);
-
-    if (!cached) cache.push_back( p=R3Point(radius*cos(theta), 0, radius*sin(theta)) );
-    else p=cache[cacheIndex++];
-    t2=CreateVertex(p,R2Point(i*2/(float)slices,0)); //vertices at edges of circle
-    bottom_circle.push_back(t2);
-    vertices.push_back(t2);
-  }
-  int size=vertices.size();
+    // The side is a cone, so the normal leans up by the taper along the
+    // whole edge, and the bark tangent follows the ring (texture u)
+    R3Vector normal(ring[i].X(),(radius-topRadius)/length,ring[i].Y());
+    normal.Normalize();
+    R3Vector tangent(-ring[i].Y(),0,ring[i].X());
+
+    // Top and bottom vertices alternate, at the edges of the circles
+    R3MeshVertex *t1,*t2;
+    t1=CreateVertex(R3Point(topRadius*(float)ring[i].X(), length, topRadius*(float)ring[i].Y()),normal,R2Point(i*2/(float)slices,1));
+    t2=CreateVertex(R3Point(radius*(float)ring[i].X(), 0, radius*(float)ring[i].Y()),normal,R2Point(i*2/(float)slices,0));
+    t1->tangent=tangent;
+    t2->tangent=tangent;
+  }
+  R3MeshVertex **shape=vertices.data()+first;
+  int size=2*slices;
+  // Faces are counter-clockwise seen from outside, matching the normals
   for (int i=0;i<size;i+=2)
   {
+    R3MeshVertex *side[3];
+    side[0]=shape[i];
+    side[1]=shape[(i+2)%size];
+    side[2]=shape[i+1];
+    CreatePolygon(side,3);
+
+    side[0]=shape[i+1];
+    side[1]=shape[(i+2)%size];
+    side[2]=shape[(i+3)%size];
+    CreatePolygon(side,3);
+  }
 
-    side.push_back(vertices[i]);
-    side.push_back(vertices[i+1]);
-    side.push_back(vertices[(i+2)%size]);
-    CreateFace(side);
-    side.clear();
+  // Caps come last, top cap at the very end, so that a hidden top cap can
+  // be dropped by removing the last face (or the last slices-2 triangles)
+  if (!triangulate)
+  {
+    // Polygon caps share the side vertices, which keeps a cylinder at two
+    // vertices per slice (the caps are then shaded with the side normals)
+    face_scratch.clear();
+    for (int i=1;i<size;i+=2) face_scratch.push_back(shape[i]);
+    CreatePolygon(face_scratch.data(),slices);
+    face_scratch.clear();
+    for (int i=size-2;i>=0;i-=2) face_scratch.push_back(shape[i]);
+    CreatePolygon(face_scratch.data(),slices);
+    return R3Shape(first,size);
+  }
 
-    side.push_back(vertices[i+1]);
-    side.push_back(vertices[(i+3)%size]);
-    side.push_back(vertices[(i+2)%size]);
-    CreateFace(side);
-    side.clear();
+  // Triangles are shaded smoothly from the vertex normals, so caps have
+  // vertices of their own, with flat normals, after the side vertices
+  // (creating them may move the vertex list, so find it again), and
+  // dropping the top cap drops its last slices vertices too
+  for (int i=1;i<size;i+=2)
+  {
+    R3MeshVertex *side=vertices[first+i];
+    CreateVertex(side->position,R3Vector(0,-1,0),side->texcoords)->tangent=side->tangent;
+  }
+  for (int i=0;i<size;i+=2)
+  {
+    R3MeshVertex *side=vertices[first+i];
+    CreateVertex(side->position,R3Vector(0,1,0),side->texcoords)->tangent=side->tangent;
   }
-  CreateFace(top_circle);
-  CreateFace(bottom_circle);
-  if (!cached)
-    cached=true;
-  return vertices;
+  shape=vertices.data()+first;
+  CreatePolygon(shape+size,slices);
+  face_scratch.clear();
+  for (int i=size+2*slices-1;i>=size+slices;i--) face_scratch.push_back(shape[i]);
+  CreatePolygon(face_scratch.data(),slices);
+  return R3Shape(first,size+2*slices);
 }
 void R3Mesh::AddCoords()
 {
   float width=.05;
-  R3Shape shape;
-  shape.push_back(CreateVertex(R3Point(3,0,0)));
-  shape.push_back(CreateVertex(R3Point(0,width,0)));
-  shape.push_back(CreateVertex(R3Point(0,-width,0)));
-  CreateFace(shape);
-  shape.clear();
-  shape.push_back(CreateVertex(R3Point(0,2,0)));
-  shape.push_back(CreateVertex(R3Point(-width,0,0)));
-  shape.push_back(CreateVertex(R3Point(width,0,0)));
-  CreateFace(shape);
-  shape.clear();
-  shape.push_back(CreateVertex(R3Point(0,0,1)));
-  shape.push_back(CreateVertex(R3Point(0,-width,0)));
-  shape.push_back(CreateVertex(R3Point(0,width,0)));
-  CreateFace(shape);
+  R3MeshVertex *shape[3];
+  shape[0]=CreateVertex(R3Point(3,0,0));
+  shape[1]=CreateVertex(R3Point(0,width,0));
+  shape[2]=CreateVertex(R3Point(0,-width,0));
+  CreatePolygon(shape,3);
+  shape[0]=CreateVertex(R3Point(0,2,0));
+  shape[1]=CreateVertex(R3Point(-width,0,0));
+  shape[2]=CreateVertex(R3Point(width,0,0));
+  CreatePolygon(shape,3);
+  shape[0]=CreateVertex(R3Point(0,0,1));
+  shape[1]=CreateVertex(R3Point(0,-width,0));
+  shape[2]=CreateVertex(R3Point(0,width,0));
+  CreatePolygon(shape,3);
 
 
 }
-void R3Mesh::
-Tree(const char * descriptor_filename,const int iterations)
+int R3Mesh::
+Tree(const char * descriptor_filename,const int iterations,LSystemCache *cache)
 {
   /** turtle system test *
     TurtleSystem t(this);
@@ -152,9 +203,12 @@ Tree(const char * descriptor_filename,const int iterations)
   // return;
 
   LPlusSystem l(this);
-  string lsystem=l.generateFromFile(descriptor_filename,iterations);
+  string lsystem=l.generateFromFile(descriptor_filename,iterations,cache);
+  if (lsystem.empty()) return 0;
   l.draw(lsystem); 
+  if (packing) Pack();
   Update();
+  return 1;
 
 }
 ////////////////////////////////////////////////////////////
@@ -163,7 +217,14 @@ Tree(const char * descriptor_filename,const int iterations)
 
 R3Mesh::
 R3Mesh(void)
-: bbox(R3null_box)
+: bbox(R3null_box),
+triangulate(false),
+vertex_block_count(0),
+face_block_count(0),
+face_vertex_block_count(0),
+packing(false),
+stream(NULL),
+verbose(true)
 {
 }
 
@@ -171,7 +232,14 @@ R3Mesh(void)
 
 R3Mesh::
 R3Mesh(const R3Mesh& mesh)
-: bbox(R3null_box)
+: bbox(R3null_box),
+triangulate(false),
+vertex_block_count(0),
+face_block_count(0),
+face_vertex_block_count(0),
+packing(false),
+stream(NULL),
+verbose(true)
 {
   // Create vertices
   for (int i = 0; i < mesh.NVertices(); i++) {
@@ -188,8 +256,76 @@ R3Mesh(const R3Mesh& mesh)
       R3MeshVertex *nv = Vertex(ov->id);
       face_vertices.push_back(nv);
     }
-    CreateFace(face_vertices);
+    CreateFace(face_vertices)->isLeaf = f->isLeaf;
   }
+
+  // Copy triangles
+  triangles = mesh.triangles;
+  triangle_leaf = mesh.triangle_leaf;
+  triangulate = mesh.triangulate;
+
+  // Copy packed data
+  packed_vertices = mesh.packed_vertices;
+  packed_blocks = mesh.packed_blocks;
+  packed_triangles = mesh.packed_triangles;
+  packed_triangle_leaf = mesh.packed_triangle_leaf;
+  packing = mesh.packing;
+  bbox = mesh.bbox;
+
+  // Copy generation state
+  random = mesh.random;
+  verbose = mesh.verbose;
+}
+
+
+
+R3Mesh::
+R3Mesh(R3Mesh&& mesh)
+: vertices(std::move(mesh.vertices)),
+faces(std::move(mesh.faces)),
+bbox(mesh.bbox),
+triangles(std::move(mesh.triangles)),
+triangle_leaf(std::move(mesh.triangle_leaf)),
+triangulate(mesh.triangulate),
+vertex_blocks(std::move(mesh.vertex_blocks)),
+face_blocks(std::move(mesh.face_blocks)),
+free_vertices(std::move(mesh.free_vertices)),
+free_faces(std::move(mesh.free_faces)),
+vertex_block_count(mesh.vertex_block_count),
+face_block_count(mesh.face_block_count),
+face_vertex_blocks(std::move(mesh.face_vertex_blocks)),
+free_face_vertices(std::move(mesh.free_face_vertices)),
+face_vertex_block_count(mesh.face_vertex_block_count),
+rings(std::move(mesh.rings)),
+packed_vertices(std::move(mesh.packed_vertices)),
+packed_blocks(std::move(mesh.packed_blocks)),
+packed_triangles(std::move(mesh.packed_triangles)),
+packed_triangle_leaf(std::move(mesh.packed_triangle_leaf)),
+packing(mesh.packing),
+stream(mesh.stream),
+random(mesh.random),
+verbose(mesh.verbose)
+{
+  // Leave the other mesh empty
+  mesh.stream = NULL;
+  mesh.packed_vertices.clear();
+  mesh.packed_blocks.clear();
+  mesh.packed_triangles.clear();
+  mesh.packed_triangle_leaf.clear();
+  mesh.vertices.clear();
+  mesh.faces.clear();
+  mesh.triangles.clear();
+  mesh.triangle_leaf.clear();
+  mesh.vertex_blocks.clear();
+  mesh.face_blocks.clear();
+  mesh.free_vertices.clear();
+  mesh.free_faces.clear();
+  mesh.vertex_block_count = 0;
+  mesh.face_block_count = 0;
+  mesh.face_vertex_blocks.clear();
+  mesh.free_face_vertices.clear();
+  mesh.face_vertex_block_count = 0;
+  mesh.bbox = R3null_box;
 }
 
 
@@ -197,16 +333,18 @@ R3Mesh(const R3Mesh& mesh)
 R3Mesh::
 ~R3Mesh(void)
 {
-  // Delete faces
-  for (int i = 0; i < NFaces(); i++) {
-    R3MeshFace *f = Face(i);
-    delete f;
-  }
+  // Abandon an unfinished stream
+  delete stream;
 
-  // Delete vertices
-  for (int i = 0; i < NVertices(); i++) {
-    R3MeshVertex *v = Vertex(i);
-    delete v;
+  // Delete face and vertex storage (all elements live in these blocks)
+  for (unsigned int i = 0; i < face_blocks.size(); i++) {
+    delete [] face_blocks[i];
+  }
+  for (unsigned int i = 0; i < vertex_blocks.size(); i++) {
+    delete [] vertex_blocks[i];
+  }
+  for (unsigned int i = 0; i < face_vertex_blocks.size(); i++) {
+    delete [] face_vertex_blocks[i];
   }
 }
 
@@ -238,13 +376,14 @@ Radius(void) const
 // MESH PROCESSING FUNCTIONS
 ////////////////////////////////////////////////////////////
 
-void R3Mesh::TranslateShape(vector<R3MeshVertex *> shape,double dx,double dy,double dz)
+void R3Mesh::TranslateShape(const R3Shape& shape,double dx,double dy,double dz)
 {
   R3Vector translation(dx, dy, dz);
 
   // Update vertices
-  for (unsigned int i = 0; i < shape.size(); i++) {
-    R3MeshVertex *vertex = shape[i];
+  R3MeshVertex **shape_vertices = vertices.data() + shape.first;
+  for (int i = 0; i < shape.count; i++) {
+    R3MeshVertex *vertex = shape_vertices[i];
     vertex->position.Translate(translation);
   }
 
@@ -253,7 +392,7 @@ void R3Mesh::TranslateShape(vector<R3MeshVertex *> shape,double dx,double dy,dou
 void R3Mesh::
 Translate(double dx, double dy, double dz)
 {
-  TranslateShape(vertices,dx,dy,dz);
+  TranslateShape(R3Shape(0,NVertices()),dx,dy,dz);
   Update();
 }
 
@@ -261,7 +400,7 @@ Translate(double dx, double dy, double dz)
 
 
 void R3Mesh::
-ScaleShape(vector<R3MeshVertex *> shape,double sx, double sy, double sz)
+ScaleShape(const R3Shape& shape,double sx, double sy, double sz)
 {
   // Scale the mesh by increasing the distance 
   // from every vertex to the origin by a factor 
@@ -270,27 +409,39 @@ ScaleShape(vector<R3MeshVertex *> shape,double sx, double sy, double sz)
   // This is implemented for you as an example 
 
   // Update vertices
-  for (unsigned int i = 0; i < shape.size(); i++) {
-    R3MeshVertex *vertex = shape[i];
+  // Normals scale by the inverse (here the cofactors, which avoid dividing 
+  // by zero), tangents like positions, and both are renormalized
+  R3Vector normal_scale(sy*sz, sx*sz, sx*sy);
+  R3Vector tangent_scale(sx, sy, sz);
+  R3MeshVertex **shape_vertices = vertices.data() + shape.first;
+  for (int i = 0; i < shape.count; i++) {
+    R3MeshVertex *vertex = shape_vertices[i];
     vertex->position[0] *= sx;
     vertex->position[1] *= sy;
     vertex->position[2] *= sz;
+    vertex->normal *= normal_scale;
+    vertex->normal.Normalize();
+    vertex->tangent *= tangent_scale;
+    vertex->tangent.Normalize();
   }
 
   // Update mesh data structures
 }
 void R3Mesh::Scale(double sx,double sy,double sz)
 {
-  ScaleShape(vertices,sx,sy,sz);
+  ScaleShape(R3Shape(0,NVertices()),sx,sy,sz);
   Update();
 }
 
 void R3Mesh::
-RotateShape(vector<R3MeshVertex *> shape,double angle, const R3Vector& axis)
+RotateShape(const R3Shape& shape,double angle, const R3Vector& axis)
 {
-  for (unsigned int i = 0; i < shape.size(); i++) {
-    R3MeshVertex *vertex = shape[i];
+  R3MeshVertex **shape_vertices = vertices.data() + shape.first;
+  for (int i = 0; i < shape.count; i++) {
+    R3MeshVertex *vertex = shape_vertices[i];
     vertex->position.Rotate(axis, angle);
+    vertex->normal.Rotate(axis, angle);
+    vertex->tangent.Rotate(axis, angle);
   }
 
   // Update mesh data structures
@@ -298,7 +449,7 @@ RotateShape(vector<R3MeshVertex *> shape,double angle, const R3Vector& axis)
 }
 
 void R3Mesh::
-RotateShape(vector<R3MeshVertex *> shape,double angle, const R3Line& axis)
+RotateShape(const R3Shape& shape,double angle, const R3Line& axis)
 {
   // Rotate the mesh counter-clockwise by an angle 
   // (in radians) around a line axis
@@ -306,16 +457,19 @@ RotateShape(vector<R3MeshVertex *> shape,double angle, const R3Line& axis)
   // This is implemented for you as an example 
 
   // Update vertices
-  for (unsigned int i = 0; i < shape.size(); i++) {
-    R3MeshVertex *vertex = shape[i];
+  R3MeshVertex **shape_vertices = vertices.data() + shape.first;
+  for (int i = 0; i < shape.count; i++) {
+    R3MeshVertex *vertex = shape_vertices[i];
     vertex->position.Rotate(axis, angle);
+    vertex->normal.Rotate(axis.Vector(), angle);
+    vertex->tangent.Rotate(axis.Vector(), angle);
   }
 
   // Update mesh data structures
 }
 void R3Mesh::Rotate(double angle, const R3Line& axis)
 {
-  RotateShape(vertices,angle,axis);
+  RotateShape(R3Shape(0,NVertices()),angle,axis);
   Update();
 }
 
@@ -330,9 +484,9 @@ R3MeshVertex *R3Mesh::CreateVertex(const R3Point& position, const R2Point& texco
 
 R3MeshVertex *R3Mesh::CreateVertex(const R3Point& position, const R3Vector& normal, const R2Point& texcoords)
 {
-  R2Point tx=texcoords;
   // Create vertex
-  R3MeshVertex *vertex = new R3MeshVertex(position, normal, tx);
+  R3MeshVertex *vertex = AllocateVertex();
+  *vertex = R3MeshVertex(position, normal, texcoords);
 
   // Update bounding box
   bbox.Union(position);
@@ -350,10 +504,15 @@ R3MeshVertex *R3Mesh::CreateVertex(const R3Point& position, const R3Vector& norm
 
 
 R3MeshFace *R3Mesh::
-CreateFace(const vector<R3MeshVertex *>& vertices)
+CreateFace(R3MeshVertex * const *vertices, int nvertices)
 {
-  // Create face
-  R3MeshFace *face = new R3MeshFace(vertices);
+  // Create face, reusing the vertex list storage of a recycled face
+  R3MeshFace *face = AllocateFace();
+  AllocateFaceVertices(face, nvertices);
+  std::copy(vertices, vertices + nvertices, face->vertices.data());
+  face->isLeaf = false;
+  face->deleted = false;
+  face->UpdatePlane();
 
   // Set face  ID
   face->id = faces.size();
@@ -368,20 +527,89 @@ CreateFace(const vector<R3MeshVertex *>& vertices)
 
 
 void R3Mesh::
-DeleteVertex(R3MeshVertex *vertex)
+CreateTriangles(R3MeshVertex * const *vertices, int nvertices, bool isLeaf)
 {
-  // Remove vertex from list
-  for (unsigned int i = 0; i < vertices.size(); i++) {
-    if (vertices[i] == vertex) {
-      vertices[i] = vertices.back();
-      vertices[i]->id = i;
-      vertices.pop_back();
-      break;
+  // Add a (convex) polygon to the triangle buffer as a fan of triangles
+  for (int i = 2; i < nvertices; i++) {
+    triangles.push_back(vertices[0]->id);
+    triangles.push_back(vertices[i-1]->id);
+    triangles.push_back(vertices[i]->id);
+    triangle_leaf.push_back(isLeaf);
+  }
+}
+
+
+
+void R3Mesh::
+CreatePolygon(R3MeshVertex * const *vertices, int nvertices, bool isLeaf)
+{
+  // Create a face, or triangles if the mesh is being triangulated
+  if (triangulate) CreateTriangles(vertices, nvertices, isLeaf);
+  else CreateFace(vertices, nvertices)->isLeaf = isLeaf;
+}
+
+
+
+void R3Mesh::
+CreateFaces(const unsigned int *indices, const unsigned int *offsets, const unsigned char *leaf,
+  int nfaces, int first_vertex)
+{
+  // Check whether every face is a triangle
+  bool all_triangles = (offsets[nfaces] == 3U * nfaces);
+  for (int i = 0; all_triangles && (i < nfaces); i++) {
+    if (offsets[i+1] - offsets[i] != 3) all_triangles = false;
+  }
+
+  // Copy all-triangle meshes straight into the triangle buffer
+  if (all_triangles && (first_vertex == 0) && faces.empty()) {
+    triangles.insert(triangles.end(), indices, indices + offsets[nfaces]);
+    triangle_leaf.insert(triangle_leaf.end(), leaf, leaf + nfaces);
+    return;
+  }
+
+  // Create faces with vertex ids relative to first_vertex
+  faces.reserve(faces.size() + nfaces);
+  for (int i = 0; i < nfaces; i++) {
+    face_scratch.clear();
+    for (unsigned int j = offsets[i]; j < offsets[i+1]; j++) {
+      face_scratch.push_back(Vertex(first_vertex + indices[j]));
     }
+    CreateFace(face_scratch)->isLeaf = leaf[i];
   }
+}
+
+
+
+R3MeshFace *R3Mesh::
+CreateFace(const vector<R3MeshVertex *>& vertices)
+{
+  // Create face with a copy of the vertex list
+  return CreateFace(vertices.data(), vertices.size());
+}
+
+
+
+void R3Mesh::
+DeleteVertex(R3MeshVertex *vertex)
+{
+  // Triangles refer to vertices by id, so while there are any the vertex
+  // is only marked, and the next Compact removes it with its triangles and
+  // renumbers the rest in one pass
+  int i = vertex->id;
+  assert((i >= 0) && (i < NVertices()) && (vertices[i] == vertex));
+  if (!triangles.empty()) {
+    MarkDeleted(vertex);
+    return;
+  }
+
+  // Remove vertex from list by moving the last vertex into its slot
+  // (the id is the vertex's index in the list, so no search is needed)
+  vertices[i] = vertices.back();
+  vertices[i]->id = i;
+  vertices.pop_back();
 
   // Delete vertex
-  delete vertex;
+  FreeVertex(vertex);
 }
 
 
@@ -389,18 +617,632 @@ DeleteVertex(R3MeshVertex *vertex)
 void R3Mesh::
 DeleteFace(R3MeshFace *face)
 {
-  // Remove face from list
+  // Remove face from list by moving the last face into its slot
+  int i = face->id;
+  assert((i >= 0) && (i < NFaces()) && (faces[i] == face));
+  faces[i] = faces.back();
+  faces[i]->id = i;
+  faces.pop_back();
+
+  // Delete face
+  FreeFace(face);
+}
+
+
+
+void R3Mesh::
+MarkDeleted(R3MeshVertex *vertex)
+{
+  // Flag vertex for removal by the next Compact
+  vertex->deleted = true;
+}
+
+
+
+void R3Mesh::
+MarkDeleted(R3MeshFace *face)
+{
+  // Flag face for removal by the next Compact
+  face->deleted = true;
+}
+
+
+
+void R3Mesh::
+Compact(void)
+{
+  // Remove all marked faces, and all faces using a marked vertex,
+  // keeping the survivors in order and renumbering their ids
+  unsigned int nfaces = 0;
   for (unsigned int i = 0; i < faces.size(); i++) {
-    if (faces[i] == face) {
-      faces[i] = faces.back();
-      faces[i]->id = i;
-      faces.pop_back();
-      break;
+    R3MeshFace *face = faces[i];
+    bool keep = !face->deleted;
+    for (unsigned int j = 0; keep && (j < face->vertices.size()); j++) {
+      if (face->vertices[j]->deleted) keep = false;
     }
+    if (!keep) { FreeFace(face); continue; }
+    face->id = nfaces;
+    faces[nfaces++] = face;
+  }
+  faces.resize(nfaces);
+
+  // Remove all triangles using a marked vertex
+  unsigned int ntriangles = 0;
+  for (int i = 0; i < NTriangles(); i++) {
+    const unsigned int *t = Triangle(i);
+    if (vertices[t[0]]->deleted || vertices[t[1]]->deleted || vertices[t[2]]->deleted) continue;
+    triangles[3*ntriangles+0] = t[0];
+    triangles[3*ntriangles+1] = t[1];
+    triangles[3*ntriangles+2] = t[2];
+    triangle_leaf[ntriangles++] = triangle_leaf[i];
   }
+  triangles.resize(3*ntriangles);
+  triangle_leaf.resize(ntriangles);
 
-  // Delete face
-  delete face;
+  // Renumber the surviving vertices, and remap the triangles (which hold 
+  // vertex ids) while the list is still in the old order -- faces hold
+  // vertex pointers, so renumbering ids is all it takes to remap them
+  unsigned int nvertices = 0;
+  for (unsigned int i = 0; i < vertices.size(); i++) {
+    if (!vertices[i]->deleted) vertices[i]->id = nvertices++;
+  }
+  for (unsigned int i = 0; i < triangles.size(); i++) {
+    triangles[i] = vertices[triangles[i]]->id;
+  }
+
+  // Remove all marked vertices
+  for (unsigned int i = 0; i < vertices.size(); i++) {
+    R3MeshVertex *vertex = vertices[i];
+    if (vertex->deleted) FreeVertex(vertex);
+    else vertices[vertex->id] = vertex;
+  }
+  vertices.resize(nvertices);
+}
+
+
+
+void R3Mesh::
+Triangulate(void)
+{
+  // Move every face into the triangle buffer as a fan
+  triangles.reserve(triangles.size() + 3 * NFaces());
+  triangle_leaf.reserve(triangle_leaf.size() + NFaces());
+  for (int i = 0; i < NFaces(); i++) {
+    R3MeshFace *face = Face(i);
+    CreateTriangles(face->vertices.data(), face->vertices.size(), face->isLeaf);
+    FreeFace(face);
+  }
+  faces.clear();
+}
+
+
+
+////////////////////////////////////////////////////////////
+// MESH PACKING FUNCTIONS
+////////////////////////////////////////////////////////////
+
+static unsigned short
+PackValue(double value, float min, float step)
+{
+  // Return the nearest 16-bit grid point
+  if (step <= 0) return 0;
+  double q = floor((value - min) / step + 0.5);
+  return (q < 0) ? 0 : (q > 65535) ? 65535 : (unsigned short) q;
+}
+
+
+
+static void
+PackNormal(const R3Vector& normal, unsigned short *q)
+{
+  // Mark zero normals
+  if (normal.IsZero()) {
+    q[0] = q[1] = R3_MESH_PACKED_ZERO_NORMAL;
+    return;
+  }
+
+  // Project the normal onto an octahedron, and unfold it into a square
+  double x = normal.X(), y = normal.Y(), z = normal.Z();
+  double sum = fabs(x) + fabs(y) + fabs(z);
+  x /= sum; y /= sum; z /= sum;
+  if (z < 0) {
+    double fx = (1 - fabs(y)) * ((x < 0) ? -1 : 1);
+    double fy = (1 - fabs(x)) * ((y < 0) ? -1 : 1);
+    x = fx; y = fy;
+  }
+
+  // Quantize square coordinates (the corner that marks zero normals is
+  // also -z, like the opposite corner)
+  q[0] = PackValue(x, -1, 2.0f / 65535);
+  q[1] = PackValue(y, -1, 2.0f / 65535);
+  if ((q[0] == R3_MESH_PACKED_ZERO_NORMAL) && (q[1] == R3_MESH_PACKED_ZERO_NORMAL)) q[0] = q[1] = 0;
+}
+
+
+
+void R3Mesh::
+Pack(void)
+{
+  // Move faces into the triangle buffer
+  if (NFaces() > 0) Triangulate();
+
+  // Pack vertices in blocks, each quantized against its own bounds
+  int offset = NPackedVertices();
+  for (int start = 0; start < NVertices(); start += R3_MESH_PACKED_BLOCK_SIZE) {
+    int end = std::min(NVertices(), start + R3_MESH_PACKED_BLOCK_SIZE);
+
+    // Find bounds of block
+    float position_max[3], texcoord_max[2];
+    R3MeshPackedBlock block;
+    block.first = offset + start;
+    for (int i = start; i < end; i++) {
+      R3MeshVertex *vertex = vertices[i];
+      for (int c = 0; c < 3; c++) {
+        float value = vertex->position[c];
+        if ((i == start) || (value < block.position_min[c])) block.position_min[c] = value;
+        if ((i == start) || (value > position_max[c])) position_max[c] = value;
+      }
+      for (int c = 0; c < 2; c++) {
+        float value = vertex->texcoords[c];
+        if ((i == start) || (value < block.texcoord_min[c])) block.texcoord_min[c] = value;
+        if ((i == start) || (value > texcoord_max[c])) texcoord_max[c] = value;
+      }
+    }
+    for (int c = 0; c < 3; c++) block.position_step[c] = (position_max[c] - block.position_min[c]) / 65535;
+    for (int c = 0; c < 2; c++) block.texcoord_step[c] = (texcoord_max[c] - block.texcoord_min[c]) / 65535;
+    packed_blocks.push_back(block);
+
+    // Quantize vertices
+    for (int i = start; i < end; i++) {
+      R3MeshVertex *vertex = vertices[i];
+      R3MeshPackedVertex packed;
+      for (int c = 0; c < 3; c++) packed.position[c] = PackValue(vertex->position[c], block.position_min[c], block.position_step[c]);
+      for (int c = 0; c < 2; c++) packed.texcoords[c] = PackValue(vertex->texcoords[c], block.texcoord_min[c], block.texcoord_step[c]);
+      PackNormal(vertex->normal, packed.normal);
+      packed_vertices.push_back(packed);
+    }
+  }
+
+  // Move triangles, numbering their vertices after those packed before
+  for (unsigned int i = 0; i < triangles.size(); i++) {
+    packed_triangles.push_back(offset + triangles[i]);
+  }
+  packed_triangle_leaf.insert(packed_triangle_leaf.end(), triangle_leaf.begin(), triangle_leaf.end());
+
+  // Remove vertices and triangles (the storage is kept for the next elements)
+  for (int i = 0; i < NVertices(); i++) FreeVertex(vertices[i]);
+  vertices.clear();
+  triangles.clear();
+  triangle_leaf.clear();
+}
+
+
+
+void R3Mesh::
+Unpack(void)
+{
+  // Check for packed data
+  if (packed_vertices.empty() && packed_triangles.empty()) return;
+
+  // Create packed vertices in front of the vertices in the mesh
+  int npacked = NPackedVertices();
+  vector<R3MeshVertex *> mesh_vertices;
+  mesh_vertices.swap(vertices);
+  vertices.reserve(npacked + mesh_vertices.size());
+  for (unsigned int b = 0; b < packed_blocks.size(); b++) {
+    const R3MeshPackedBlock& block = packed_blocks[b];
+    int end = (b + 1 < packed_blocks.size()) ? packed_blocks[b+1].first : npacked;
+    for (int i = block.first; i < end; i++) {
+      const R3MeshPackedVertex& packed = packed_vertices[i];
+      CreateVertex(block.Position(packed), block.Normal(packed), block.TexCoords(packed));
+    }
+  }
+  for (unsigned int i = 0; i < mesh_vertices.size(); i++) {
+    mesh_vertices[i]->id = vertices.size();
+    vertices.push_back(mesh_vertices[i]);
+  }
+
+  // Put packed triangles in front of the triangles in the mesh
+  for (unsigned int i = 0; i < triangles.size(); i++) triangles[i] += npacked;
+  triangles.insert(triangles.begin(), packed_triangles.begin(), packed_triangles.end());
+  triangle_leaf.insert(triangle_leaf.begin(), packed_triangle_leaf.begin(), packed_triangle_leaf.end());
+
+  // Release packed data
+  vector<R3MeshPackedVertex>().swap(packed_vertices);
+  vector<R3MeshPackedBlock>().swap(packed_blocks);
+  vector<unsigned int>().swap(packed_triangles);
+  vector<unsigned char>().swap(packed_triangle_leaf);
+}
+
+
+
+const R3MeshPackedBlock& R3Mesh::
+PackedBlock(int k) const
+{
+  // Return the block containing the kth packed vertex (the last block starting at or before it)
+  auto after = std::upper_bound(packed_blocks.begin(), packed_blocks.end(), k,
+    [](int k, const R3MeshPackedBlock& block) { return k < block.first; });
+  return *(after - 1);
+}
+
+
+
+R3Point R3Mesh::
+WrittenPosition(int k) const
+{
+  // Return position of kth written vertex
+  int npacked = NPackedVertices();
+  if (k >= npacked) return vertices[k - npacked]->position;
+  return PackedBlock(k).Position(packed_vertices[k]);
+}
+
+
+
+R3Vector R3Mesh::
+WrittenNormal(int k) const
+{
+  // Return normal of kth written vertex
+  int npacked = NPackedVertices();
+  if (k >= npacked) return vertices[k - npacked]->normal;
+  return PackedBlock(k).Normal(packed_vertices[k]);
+}
+
+
+
+R3Vector R3Mesh::
+WrittenTangent(int k) const
+{
+  // Return tangent of kth written vertex (packed vertices have none)
+  int npacked = NPackedVertices();
+  if (k >= npacked) return vertices[k - npacked]->tangent;
+  return R3zero_vector;
+}
+
+
+
+R2Point R3Mesh::
+WrittenTexCoords(int k) const
+{
+  // Return texture coordinates of kth written vertex
+  int npacked = NPackedVertices();
+  if (k >= npacked) return vertices[k - npacked]->texcoords;
+  return PackedBlock(k).TexCoords(packed_vertices[k]);
+}
+
+
+
+int R3Mesh::
+NWrittenFaceVertices(int k) const
+{
+  // Return number of vertices of kth written face
+  k -= NPackedTriangles();
+  if ((k >= 0) && (k < NFaces())) return faces[k]->vertices.size();
+  return 3;
+}
+
+
+
+unsigned int R3Mesh::
+WrittenFaceVertex(int k, int j) const
+{
+  // Return written vertex id of jth vertex of kth written face
+  if (k < NPackedTriangles()) return packed_triangles[3*k+j];
+  k -= NPackedTriangles();
+  if (k < NFaces()) return NPackedVertices() + faces[k]->vertices[j]->id;
+  return NPackedVertices() + triangles[3*(k-NFaces())+j];
+}
+
+
+
+bool R3Mesh::
+IsLeafWrittenFace(int k) const
+{
+  // Return whether kth written face belongs to a leaf
+  if (k < NPackedTriangles()) return packed_triangle_leaf[k];
+  k -= NPackedTriangles();
+  if (k < NFaces()) return faces[k]->isLeaf;
+  return triangle_leaf[k-NFaces()];
+}
+
+
+
+////////////////////////////////////////////////////////////
+// MESH OPTIMIZATION FUNCTIONS
+////////////////////////////////////////////////////////////
+
+static float 
+VertexCacheScore(int cache_position, int remaining, int cache_size)
+{
+  // Score a vertex as in Forsyth's "Linear-Speed Vertex Cache Optimisation":
+  // recently used vertices score high (the last triangle's three a bit less,
+  // to avoid strips), and vertices with few triangles left get a boost
+  if (remaining == 0) return -1;
+  float score = 0;
+  if (cache_position >= 0) {
+    if (cache_position < 3) score = 0.75f;
+    else score = powf(1.0f - (float) (cache_position - 3) / (cache_size - 3), 1.5f);
+  }
+  return score + 2.0f / sqrtf((float) remaining);
+}
+
+
+
+static void 
+OptimizeVertexCache(unsigned int *indices, int ntriangles, int nvertices, int cache_size)
+{
+  // Build lists of the triangles using each vertex
+  vector<int> remaining(nvertices, 0);
+  for (int i = 0; i < 3*ntriangles; i++) remaining[indices[i]]++;
+  vector<int> offsets(nvertices + 1, 0);
+  for (int v = 0; v < nvertices; v++) offsets[v+1] = offsets[v] + remaining[v];
+  vector<int> adjacency(3*ntriangles);
+  vector<int> fill(offsets.begin(), offsets.end() - 1);
+  for (int i = 0; i < 3*ntriangles; i++) adjacency[fill[indices[i]]++] = i / 3;
+
+  // Compute initial scores
+  vector<int> cache_position(nvertices, -1);
+  vector<float> vertex_score(nvertices);
+  for (int v = 0; v < nvertices; v++) vertex_score[v] = VertexCacheScore(-1, remaining[v], cache_size);
+  vector<float> triangle_score(ntriangles);
+  for (int t = 0; t < ntriangles; t++) {
+    const unsigned int *tv = &indices[3*t];
+    triangle_score[t] = vertex_score[tv[0]] + vertex_score[tv[1]] + vertex_score[tv[2]];
+  }
+
+  // Emit triangles greedily, always the best one using a cached vertex
+  vector<char> emitted(ntriangles, 0);
+  vector<unsigned int> output(3*ntriangles);
+  vector<int> cache, next_cache;
+  cache.reserve(cache_size + 3);
+  next_cache.reserve(cache_size + 3);
+  int best = -1;
+  int scan = 0;
+  for (int n = 0; n < ntriangles; n++) {
+    // Start somewhere new if no cached vertex has triangles left
+    if (best < 0) {
+      while (emitted[scan]) scan++;
+      best = scan;
+    }
+
+    // Emit triangle, removing it from its vertices' lists
+    const unsigned int *tv = &indices[3*best];
+    for (int j = 0; j < 3; j++) {
+      int v = tv[j];
+      output[3*n+j] = v;
+      int *list = &adjacency[offsets[v]];
+      int count = remaining[v]--;
+      for (int k = 0; k < count; k++) {
+        if (list[k] == best) { list[k] = list[count-1]; break; }
+      }
+    }
+    emitted[best] = 1;
+
+    // Move its vertices to the front of the cache
+    next_cache.clear();
+    for (int j = 0; j < 3; j++) next_cache.push_back(tv[j]);
+    for (unsigned int k = 0; k < cache.size(); k++) {
+      int v = cache[k];
+      if ((v != (int) tv[0]) && (v != (int) tv[1]) && (v != (int) tv[2])) next_cache.push_back(v);
+    }
+
+    // Rescore the vertices in (or just evicted from) the cache, pass the
+    // changes on to their remaining triangles, and pick the best of those
+    float best_score = -1;
+    best = -1;
+    for (unsigned int k = 0; k < next_cache.size(); k++) {
+      int v = next_cache[k];
+      cache_position[v] = ((int) k < cache_size) ? (int) k : -1;
+      float score = VertexCacheScore(cache_position[v], remaining[v], cache_size);
+      float delta = score - vertex_score[v];
+      vertex_score[v] = score;
+      const int *list = &adjacency[offsets[v]];
+      for (int i = 0; i < remaining[v]; i++) {
+        int t = list[i];
+        triangle_score[t] += delta;
+        if (triangle_score[t] > best_score) { best_score = triangle_score[t]; best = t; }
+      }
+    }
+    if ((int) next_cache.size() > cache_size) next_cache.resize(cache_size);
+    cache.swap(next_cache);
+  }
+
+  // Copy result
+  copy(output.begin(), output.end(), indices);
+}
+
+
+
+void R3Mesh::
+Optimize(int cache_size)
+{
+  // Work on triangles
+  if (NFaces() > 0) Triangulate();
+  int ntriangles = NTriangles();
+  if (ntriangles == 0) return;
+
+  // Put bark triangles first and leaf triangles after them, so that each
+  // material is drawn as one range
+  vector<unsigned int> grouped;
+  grouped.reserve(triangles.size());
+  int nbark = 0;
+  for (int leaf = 0; leaf < 2; leaf++) {
+    for (int i = 0; i < ntriangles; i++) {
+      if (triangle_leaf[i] != leaf) continue;
+      grouped.insert(grouped.end(), triangles.data() + 3*i, triangles.data() + 3*i + 3);
+      if (!leaf) nbark++;
+    }
+  }
+  triangles.swap(grouped);
+  for (int i = 0; i < ntriangles; i++) triangle_leaf[i] = (i >= nbark);
+
+  // Reorder each material range for the vertex cache
+  OptimizeVertexCache(triangles.data(), nbark, NVertices(), cache_size);
+  OptimizeVertexCache(triangles.data() + 3*nbark, ntriangles - nbark, NVertices(), cache_size);
+
+  // Renumber vertices in order of first use, so they are fetched in order
+  vector<int> remap(NVertices(), -1);
+  vector<R3MeshVertex *> ordered;
+  ordered.reserve(NVertices());
+  for (unsigned int i = 0; i < triangles.size(); i++) {
+    int v = triangles[i];
+    if (remap[v] < 0) { remap[v] = ordered.size(); ordered.push_back(vertices[v]); }
+    triangles[i] = remap[v];
+  }
+  for (int v = 0; v < NVertices(); v++) {
+    if (remap[v] < 0) ordered.push_back(vertices[v]);
+  }
+  vertices.swap(ordered);
+  for (int v = 0; v < NVertices(); v++) vertices[v]->id = v;
+}
+
+
+
+double R3Mesh::
+ACMR(int cache_size) const
+{
+  // Return the average cache miss ratio (vertices transformed per triangle)
+  // of the triangle buffer, simulating a FIFO post-transform cache
+  if (NTriangles() == 0) return 0;
+  vector<int> inserted(NVertices(), INT_MIN);
+  int misses = 0;
+  for (unsigned int i = 0; i < triangles.size(); i++) {
+    int v = triangles[i];
+    if ((inserted[v] != INT_MIN) && (misses - inserted[v] < cache_size)) continue;
+    inserted[v] = misses++;
+  }
+  return (double) misses / NTriangles();
+}
+
+
+
+////////////////////////////////////////////////////////////
+// MESH ELEMENT STORAGE FUNCTIONS
+////////////////////////////////////////////////////////////
+
+static const int R3mesh_block_size = 4096;
+static const int R3mesh_face_vertex_block_size = 65536;
+static const int R3mesh_face_vertex_class_size = 4;
+
+
+
+R3MeshVertex *R3Mesh::
+AllocateVertex(void)
+{
+  // Reuse a deleted vertex if there is one
+  if (!free_vertices.empty()) {
+    R3MeshVertex *vertex = free_vertices.back();
+    free_vertices.pop_back();
+    return vertex;
+  }
+
+  // Otherwise take the next one from the current block
+  if (vertex_blocks.empty() || (vertex_block_count == R3mesh_block_size)) {
+    vertex_blocks.push_back(new R3MeshVertex [ R3mesh_block_size ]);
+    vertex_block_count = 0;
+  }
+  return &(vertex_blocks.back()[vertex_block_count++]);
+}
+
+
+
+R3MeshFace *R3Mesh::
+AllocateFace(void)
+{
+  // Reuse a deleted face if there is one
+  if (!free_faces.empty()) {
+    R3MeshFace *face = free_faces.back();
+    free_faces.pop_back();
+    return face;
+  }
+
+  // Otherwise take the next one from the current block
+  if (face_blocks.empty() || (face_block_count == R3mesh_block_size)) {
+    face_blocks.push_back(new R3MeshFace [ R3mesh_block_size ]);
+    face_block_count = 0;
+  }
+  return &(face_blocks.back()[face_block_count++]);
+}
+
+
+
+void R3Mesh::
+AllocateFaceVertices(R3MeshFace *face, int nvertices)
+{
+  // Keep the face's vertex list storage if it is large enough
+  R3MeshFaceVertices& list = face->vertices;
+  list.count = nvertices;
+  if (nvertices <= list.capacity) return;
+
+  // Return the old storage to the free list of its size class
+  int size_class = 0;
+  while ((R3mesh_face_vertex_class_size << size_class) < list.capacity) size_class++;
+  if (list.capacity > 0) free_face_vertices[size_class].push_back(list.elements);
+
+  // Reuse storage of the smallest size class that fits
+  size_class = 0;
+  while ((R3mesh_face_vertex_class_size << size_class) < nvertices) size_class++;
+  if (free_face_vertices.size() <= (unsigned int) size_class) free_face_vertices.resize(size_class + 1);
+  list.capacity = R3mesh_face_vertex_class_size << size_class;
+  if (!free_face_vertices[size_class].empty()) {
+    list.elements = free_face_vertices[size_class].back();
+    free_face_vertices[size_class].pop_back();
+    return;
+  }
+
+  // Otherwise take it from the current block (lists larger than a block get
+  // a block of their own)
+  if (list.capacity > R3mesh_face_vertex_block_size) {
+    if (face_vertex_blocks.empty()) face_vertex_block_count = R3mesh_face_vertex_block_size;
+    face_vertex_blocks.insert(face_vertex_blocks.begin(), new R3MeshVertex * [ list.capacity ]);
+    list.elements = face_vertex_blocks.front();
+    return;
+  }
+  if (face_vertex_blocks.empty() || (face_vertex_block_count + list.capacity > R3mesh_face_vertex_block_size)) {
+    face_vertex_blocks.push_back(new R3MeshVertex * [ R3mesh_face_vertex_block_size ]);
+    face_vertex_block_count = 0;
+  }
+  list.elements = face_vertex_blocks.back() + face_vertex_block_count;
+  face_vertex_block_count += list.capacity;
+}
+
+
+
+void R3Mesh::
+FreeVertex(R3MeshVertex *vertex)
+{
+  // Keep vertex for reuse
+  free_vertices.push_back(vertex);
+}
+
+
+
+void R3Mesh::
+FreeFace(R3MeshFace *face)
+{
+  // Keep face for reuse (its vertex list storage is kept too)
+  face->vertices.clear();
+  free_faces.push_back(face);
+}
+
+
+
+void R3Mesh::
+Clear(void)
+{
+  // Recycle all elements, last first, so they are reused in their old order
+  for (int i = NFaces() - 1; i >= 0; i--) FreeFace(faces[i]);
+  for (int i = NVertices() - 1; i >= 0; i--) FreeVertex(vertices[i]);
+
+  // Empty element lists, keeping their capacity
+  vertices.clear();
+  faces.clear();
+  triangles.clear();
+  triangle_leaf.clear();
+  packed_vertices.clear();
+  packed_blocks.clear();
+  packed_triangles.clear();
+  packed_triangle_leaf.clear();
+  bbox = R3null_box;
 }
 
 
@@ -430,6 +1272,14 @@ UpdateBBox(void)
     R3MeshVertex *vertex = vertices[i];
     bbox.Union(vertex->position);
   }
+
+  // Include the bounds of packed blocks
+  for (unsigned int i = 0; i < packed_blocks.size(); i++) {
+    const R3MeshPackedBlock& block = packed_blocks[i];
+    R3MeshPackedVertex corner = { { 65535, 65535, 65535 }, { 0, 0 }, { 0, 0 } };
+    bbox.Union(R3Point(block.position_min[0], block.position_min[1], block.position_min[2]));
+    bbox.Union(block.Position(corner));
+  }
 }
 
 
@@ -446,6 +1296,23 @@ UpdateVertexNormals(void)
 
 
 
+bool R3Mesh::
+HasVertexNormals(void) const
+{
+  // Check whether any vertex has a normal (e.g., from generation or file)
+  for (unsigned int i = 0; i < vertices.size(); i++) {
+    if (!vertices[i]->normal.IsZero()) return true;
+  }
+  for (unsigned int i = 0; i < packed_vertices.size(); i++) {
+    const unsigned short *normal = packed_vertices[i].normal;
+    if ((normal[0] != R3_MESH_PACKED_ZERO_NORMAL) || (normal[1] != R3_MESH_PACKED_ZERO_NORMAL)) return true;
+  }
+  return false;
+}
+
+
+
+
 void R3Mesh::
 UpdateVertexCurvatures(void)
 {
@@ -487,6 +1354,12 @@ Read(const char *filename)
   int status = 0;
   if (!strncmp(extension, ".ray", 4)) 
     status = ReadRay(filename);
+  else if (!strncmp(extension, ".offb", 5)) 
+    status = ReadBinary(filename);
+  else if (!strncmp(extension, ".offz", 5)) 
+    status = ReadCompressed(filename);
+  else if (!strncmp(extension, ".ply", 4)) 
+    status = ReadPly(filename);
   else if (!strncmp(extension, ".off+", 5)) 
     status = ReadOff(filename,true);
   else if (!strncmp(extension, ".off", 4)) 
@@ -513,83 +1386,552 @@ Read(const char *filename)
 
 
 
-int R3Mesh::
-Write(const char *filename)
+int R3Mesh::
+Write(const char *filename)
+{
+  // Parse input filename extension
+  const char *extension;
+  if (!(extension = strrchr(filename, '.'))) {
+    printf("Filename %s has no extension (e.g., .ply)", filename);
+    return 0;
+  }
+
+  // Write file of appropriate type
+  if (!strncmp(extension, ".ray", 4)) 
+    return WriteRay(filename);
+  else if (!strncmp(extension, ".offb", 5)) 
+    return WriteBinary(filename);
+  else if (!strncmp(extension, ".offz", 5)) 
+    return WriteCompressed(filename);
+  else if (!strncmp(extension, ".glb", 4)) 
+    return WriteGLB(filename);
+  else if (!strncmp(extension, ".ply", 4)) 
+    return WritePly(filename);
+  else if (!strncmp(extension, ".off+", 5)) 
+    return WriteOffPlus(filename);
+  else if (!strncmp(extension, ".off", 4)) 
+    return WriteOff(filename);
+  else {
+    fprintf(stderr, "Unable to write file %s (unrecognized extension: %s)", filename, extension);
+    return 0;
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////
+// IMAGE FILE INPUT/OUTPUT
+////////////////////////////////////////////////////////////
+
+int R3Mesh::
+ReadImage(const char *filename)
+{
+  // Create a mesh by reading an image file, 
+  // constructing vertices at (x,y,luminance), 
+  // and connecting adjacent pixels into faces. 
+  // That is, the image is interpretted as a height field, 
+  // where the luminance of each pixel provides its z-coordinate.
+
+  // Read image
+  R2Image *image = new R2Image();
+  if (!image->Read(filename)) return 0;
+
+  // Create vertices and store in arrays
+  R3MeshVertex ***vertices = new R3MeshVertex **[image->Width() ];
+  for (int i = 0; i < image->Width(); i++) {
+    vertices[i] = new R3MeshVertex *[image->Height() ];
+    for (int j = 0; j < image->Height(); j++) {
+      double luminance = image->Pixel(i, j).Luminance();
+      double z = luminance * image->Width();
+      R3Point position((double) i, (double) j, z);
+      R2Point texcoords((double) i, (double) j);
+      vertices[i][j] = CreateVertex(position, R3zero_vector, texcoords);
+    }
+  }
+
+  // Create faces
+  vector<R3MeshVertex *> face_vertices;
+  for (int i = 1; i < image->Width(); i++) {
+    for (int j = 1; j < image->Height(); j++) {
+      face_vertices.clear();
+      face_vertices.push_back(vertices[i-1][j-1]);
+      face_vertices.push_back(vertices[i][j-1]);
+      face_vertices.push_back(vertices[i][j]);
+      face_vertices.push_back(vertices[i-1][j]);
+      CreateFace(face_vertices);
+    }
+  }
+
+  // Delete vertex arrays
+  for (int i = 0; i < image->Width(); i++) delete [] vertices[i];
+    delete [] vertices;
+
+  // Delete image
+  delete image;
+
+  // Return success
+  return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////
+// TEXT FILE UTILITY FUNCTIONS
+////////////////////////////////////////////////////////////
+
+// Number of vertices or faces formatted together by one thread
+static const int R3mesh_text_chunk_size = 32768;
+
+// Number of faces read between calls to read_progress
+static const int R3mesh_progress_chunk_size = 65536;
+
+// Longest text of one number (with room for the separator after it)
+static const size_t R3mesh_text_number_size = 32;
+
+
+
+static char *
+ReserveText(std::vector<char>& buffer, char *p, size_t n)
+{
+  // Make sure there is room for n more characters after p
+  size_t used = p - buffer.data();
+  if (used + n > buffer.size()) buffer.resize(2 * (used + n));
+  return buffer.data() + used;
+}
+
+
+
+static inline char *
+FormatNumber(char *p, double value)
+{
+  // Same text as printf("%g"), without parsing a format string
+  return std::to_chars(p, p + R3mesh_text_number_size, value, std::chars_format::general, 6).ptr;
+}
+
+
+
+static inline char *
+FormatInteger(char *p, unsigned int value)
+{
+  // Same text as printf("%u")
+  return std::to_chars(p, p + R3mesh_text_number_size, value).ptr;
+}
+
+
+
+// Non-blank, non-comment line of a text file
+struct R3MeshTextLine {
+  const char *begin;
+  const char *end;
+  int number;
+};
+
+// Powers of ten that are exact doubles
+static const double R3mesh_powers_of_ten[23] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+
+static int
+NumberOfThreads(size_t n)
+{
+  // Return how many threads to split n lines or bytes between
+  size_t nchunks = n / R3mesh_text_chunk_size + 1;
+  size_t nprocessors = std::max(1U, std::thread::hardware_concurrency());
+  return (int) std::min(nchunks, nprocessors);
+}
+
+
+
+template <class Function> static void
+RunInParallel(int nthreads, size_t n, Function function)
+{
+  // Call function(thread, start, end) for nthreads equal ranges of 0..n-1
+  std::vector<std::thread> threads;
+  for (int t = 1; t < nthreads; t++) {
+    threads.push_back(std::thread(function, t, n * t / nthreads, n * (t+1) / nthreads));
+  }
+  function(0, (size_t) 0, n / nthreads);
+  for (unsigned int t = 0; t < threads.size(); t++) threads[t].join();
+}
+
+
+
+static inline bool
+IsSpace(char c)
+{
+  // Return whether c is white space (without a locale lookup)
+  return (c == ' ') || ((c >= '\t') && (c <= '\r'));
+}
+
+
+
+static void
+FindTextLines(const char *text, size_t size, std::vector<R3MeshTextLine>& lines)
+{
+  // Split the text between threads, each finding the lines that start in its part
+  int nthreads = NumberOfThreads(size);
+  std::vector<std::vector<R3MeshTextLine> > thread_lines(nthreads);
+  std::vector<int> thread_line_counts(nthreads, 0);
+  RunInParallel(nthreads, size, [&](int t, size_t start, size_t end) {
+    // Start at the first line beginning in this part
+    const char *text_end = text + size;
+    const char *p = text + start;
+    if (start > 0) {
+      const char *newline = (const char *) memchr(p - 1, '\n', text_end - (p - 1));
+      p = (newline) ? newline + 1 : text_end;
+    }
+
+    // Keep lines that are not blank or comments
+    int count = 0;
+    while (p < text + end) {
+      const char *line_end = (const char *) memchr(p, '\n', text_end - p);
+      if (!line_end) line_end = text_end;
+      count++;
+      while ((p < line_end) && IsSpace(*p)) p++;
+      if ((p < line_end) && (*p != '#')) {
+        R3MeshTextLine line = { p, line_end, count };
+        thread_lines[t].push_back(line);
+      }
+      p = (line_end < text_end) ? line_end + 1 : text_end;
+    }
+    thread_line_counts[t] = count;
+  });
+
+  // Concatenate lines, numbering them from the start of the file
+  int line_count = 0;
+  for (int t = 0; t < nthreads; t++) {
+    for (unsigned int i = 0; i < thread_lines[t].size(); i++) {
+      thread_lines[t][i].number += line_count;
+      lines.push_back(thread_lines[t][i]);
+    }
+    line_count += thread_line_counts[t];
+  }
+}
+
+
+
+static const char *
+ParseNumber(const char *p, const char *end, double *value)
+{
+  // Skip white space
+  while ((p < end) && IsSpace(*p)) p++;
+  const char *start = p;
+
+  // Read sign
+  bool negative = false;
+  if ((p < end) && ((*p == '-') || (*p == '+'))) negative = (*p++ == '-');
+
+  // Read up to 19 significant digits and the decimal point
+  unsigned long long mantissa = 0;
+  int ndigits = 0, nsignificant = 0, exponent = 0;
+  bool exact = true;
+  for (bool fraction = false; p < end; p++) {
+    if ((*p == '.') && !fraction) { fraction = true; continue; }
+    unsigned int digit = (unsigned int) (*p - '0');
+    if (digit > 9) break;
+    ndigits++;
+    if ((mantissa == 0) && (digit == 0)) { if (fraction) exponent--; continue; }
+    if (nsignificant == 19) { exact = false; continue; }
+    mantissa = 10 * mantissa + digit;
+    nsignificant++;
+    if (fraction) exponent--;
+  }
+
+  // Read exponent
+  if ((ndigits > 0) && (p < end) && ((*p == 'e') || (*p == 'E'))) {
+    const char *q = p + 1;
+    bool negative_exponent = false;
+    if ((q < end) && ((*q == '-') || (*q == '+'))) negative_exponent = (*q++ == '-');
+    if ((q < end) && ((unsigned int) (*q - '0') <= 9)) {
+      int e = 0;
+      for (; (q < end) && ((unsigned int) (*q - '0') <= 9); q++) {
+        if (e < 100000) e = 10 * e + (*q - '0');
+      }
+      exponent += (negative_exponent) ? -e : e;
+      p = q;
+    }
+  }
+
+  // Compute value, which is exact when the mantissa and power of ten are
+  if (exact && (ndigits > 0) && (mantissa <= (1ULL << 53)) && (exponent >= -22) && (exponent <= 22)) {
+    double v = (double) mantissa;
+    if (exponent < 0) v /= R3mesh_powers_of_ten[-exponent];
+    else v *= R3mesh_powers_of_ten[exponent];
+    *value = (negative) ? -v : v;
+    return p;
+  }
+
+  // Otherwise (long numbers, nan, inf) let strtod do it
+  char buffer[128];
+  size_t length = std::min((size_t) (end - start), sizeof(buffer) - 1);
+  memcpy(buffer, start, length);
+  buffer[length] = '\0';
+  char *buffer_end;
+  *value = strtod(buffer, &buffer_end);
+  if (buffer_end == buffer) return NULL;
+  return start + (buffer_end - buffer);
+}
+
+
+
+static const char *
+ParseInteger(const char *p, const char *end, int *value)
+{
+  // Skip white space
+  while ((p < end) && IsSpace(*p)) p++;
+
+  // Read sign and digits
+  bool negative = false;
+  if ((p < end) && ((*p == '-') || (*p == '+'))) negative = (*p++ == '-');
+  const char *digits = p;
+  long long v = 0;
+  for (; (p < end) && ((unsigned int) (*p - '0') <= 9); p++) {
+    if (v <= INT_MAX) v = 10 * v + (*p - '0');
+  }
+  if ((p == digits) || (v > INT_MAX)) return NULL;
+  *value = (negative) ? (int) -v : (int) v;
+  return p;
+}
+
+
+
+// Text file formats
+enum { R3mesh_off_text, R3mesh_off_plus_text, R3mesh_ray_text };
+
+
+
+static char *
+FormatVertex(std::vector<char>& buffer, char *p, const R3Point& position, const R3Vector& n, const R2Point& t,
+  int format, bool normals)
+{
+  // Format one vertex line
+  p = ReserveText(buffer, p, 8 * R3mesh_text_number_size + 16);
+  if (format == R3mesh_ray_text) {
+    memcpy(p, "#vertex ", 8); p += 8;
+    p = FormatNumber(p, position.X()); *p++ = ' ';
+    p = FormatNumber(p, position.Y()); *p++ = ' ';
+    p = FormatNumber(p, position.Z()); *p++ = ' '; *p++ = ' ';
+    p = FormatNumber(p, n.X()); *p++ = ' ';
+    p = FormatNumber(p, n.Y()); *p++ = ' ';
+    p = FormatNumber(p, n.Z()); *p++ = ' '; *p++ = ' ';
+    p = FormatNumber(p, t.X()); *p++ = ' ';
+    p = FormatNumber(p, t.Y());
+  }
+  else {
+    p = FormatNumber(p, position.X()); *p++ = ' ';
+    p = FormatNumber(p, position.Y()); *p++ = ' ';
+    p = FormatNumber(p, position.Z());
+    if (format == R3mesh_off_plus_text) {
+      // Normals follow the texture coordinates, if there are any
+      *p++ = ' '; p = FormatNumber(p, t.X());
+      *p++ = ' '; p = FormatNumber(p, t.Y());
+      if (normals) {
+        *p++ = ' '; p = FormatNumber(p, n.X());
+        *p++ = ' '; p = FormatNumber(p, n.Y());
+        *p++ = ' '; p = FormatNumber(p, n.Z());
+      }
+    }
+  }
+  *p++ = '\n';
+  return p;
+}
+
+
+
+static char *
+FormatVertices(R3Mesh *mesh, std::vector<char>& buffer, char *p, int start, int end, int format, bool normals)
+{
+  // Format vertex lines (which also numbers the vertices by their position in the list)
+  for (int i = start; i < end; i++) {
+    R3MeshVertex *vertex = mesh->Vertex(i);
+    p = FormatVertex(buffer, p, vertex->position, vertex->normal, vertex->texcoords, format, normals);
+    vertex->id = i;
+  }
+  return p;
+}
+
+
+
+static char *
+FormatPackedVertices(R3Mesh *mesh, std::vector<char>& buffer, char *p, int start, int end, int format, bool normals)
 {
-  // Parse input filename extension
-  const char *extension;
-  if (!(extension = strrchr(filename, '.'))) {
-    printf("Filename %s has no extension (e.g., .ply)", filename);
-    return 0;
+  // Format vertex lines of packed vertices, decoding them block by block
+  int i = start;
+  while (i < end) {
+    const R3MeshPackedBlock& block = mesh->PackedBlock(i);
+    int block_end = (&block == &mesh->packed_blocks.back()) ? end : std::min(end, (&block)[1].first);
+    for ( ; i < block_end; i++) {
+      const R3MeshPackedVertex& vertex = mesh->PackedVertex(i);
+      p = FormatVertex(buffer, p, block.Position(vertex), block.Normal(vertex), block.TexCoords(vertex), format, normals);
+    }
   }
+  return p;
+}
 
-  // Write file of appropriate type
-  if (!strncmp(extension, ".ray", 4)) 
-    return WriteRay(filename);
-  else if (!strncmp(extension, ".off+", 5)) 
-    return WriteOffPlus(filename);
-  else if (!strncmp(extension, ".off", 4)) 
-    return WriteOff(filename);
-  else {
-    fprintf(stderr, "Unable to write file %s (unrecognized extension: %s)", filename, extension);
-    return 0;
+
+
+static char *
+FormatPolygon(std::vector<char>& buffer, char *p, int nvertices, int format)
+{
+  // Format the start of a face line, up to its vertex ids
+  p = ReserveText(buffer, p, (nvertices + 2) * R3mesh_text_number_size + 32);
+  if (format == R3mesh_ray_text) {
+    memcpy(p, "#shape_polygon 0 ", 17); p += 17;
+    p = FormatInteger(p, nvertices);
+    *p++ = ' ';
   }
+  else p = FormatInteger(p, nvertices);
+  return p;
 }
 
 
 
-////////////////////////////////////////////////////////////
-// IMAGE FILE INPUT/OUTPUT
-////////////////////////////////////////////////////////////
+static char *
+FormatVertexId(char *p, unsigned int id, int format)
+{
+  // Format one vertex id of a face line (ray files have a space after each)
+  if (format != R3mesh_ray_text) *p++ = ' ';
+  p = FormatInteger(p, id);
+  if (format == R3mesh_ray_text) *p++ = ' ';
+  return p;
+}
 
-int R3Mesh::
-ReadImage(const char *filename)
+
+
+static char *
+FormatFaces(R3Mesh *mesh, std::vector<char>& buffer, char *p, int start, int end, int format, unsigned int vertex_offset)
 {
-  // Create a mesh by reading an image file, 
-  // constructing vertices at (x,y,luminance), 
-  // and connecting adjacent pixels into faces. 
-  // That is, the image is interpretted as a height field, 
-  // where the luminance of each pixel provides its z-coordinate.
+  // Format face lines (vertex ids are counted from vertex_offset)
+  for (int i = start; i < end; i++) {
+    R3MeshFace *face = mesh->Face(i);
+    int nvertices = face->vertices.size();
+    p = FormatPolygon(buffer, p, nvertices, format);
+    for (int j = 0; j < nvertices; j++) {
+      p = FormatVertexId(p, vertex_offset + face->vertices[j]->id, format);
+    }
+    if (format == R3mesh_off_plus_text) {
+      *p++ = ' ';
+      *p++ = (face->isLeaf) ? '1' : '0';
+    }
+    *p++ = '\n';
+  }
+  return p;
+}
 
-  // Read image
-  R2Image *image = new R2Image();
-  if (!image->Read(filename)) return 0;
 
-  // Create vertices and store in arrays
-  R3MeshVertex ***vertices = new R3MeshVertex **[image->Width() ];
-  for (int i = 0; i < image->Width(); i++) {
-    vertices[i] = new R3MeshVertex *[image->Height() ];
-    for (int j = 0; j < image->Height(); j++) {
-      double luminance = image->Pixel(i, j).Luminance();
-      double z = luminance * image->Width();
-      R3Point position((double) i, (double) j, z);
-      R2Point texcoords((double) i, (double) j);
-      vertices[i][j] = CreateVertex(position, R3zero_vector, texcoords);
+
+static char *
+FormatTriangles(const unsigned int *triangles, const unsigned char *triangle_leaf,
+  std::vector<char>& buffer, char *p, int start, int end, int format, unsigned int vertex_offset)
+{
+  // Format a face line for each triangle of a triangle buffer
+  for (int i = start; i < end; i++) {
+    const unsigned int *t = &triangles[3*i];
+    p = FormatPolygon(buffer, p, 3, format);
+    for (int j = 0; j < 3; j++) {
+      p = FormatVertexId(p, vertex_offset + t[j], format);
+    }
+    if (format == R3mesh_off_plus_text) {
+      *p++ = ' ';
+      *p++ = (triangle_leaf[i]) ? '1' : '0';
     }
+    *p++ = '\n';
   }
+  return p;
+}
 
-  // Create faces
-  vector<R3MeshVertex *> face_vertices;
-  for (int i = 1; i < image->Width(); i++) {
-    for (int j = 1; j < image->Height(); j++) {
-      face_vertices.clear();
-      face_vertices.push_back(vertices[i-1][j-1]);
-      face_vertices.push_back(vertices[i][j-1]);
-      face_vertices.push_back(vertices[i][j]);
-      face_vertices.push_back(vertices[i-1][j]);
-      CreateFace(face_vertices);
+
+
+template <class Formatter> static void
+WriteText(FILE *fp, int n, Formatter format)
+{
+  // Format chunks of n lines on all processors, and write them in order
+  int nthreads = std::max(1, (int) std::thread::hardware_concurrency());
+  std::vector<std::vector<char> > buffers(nthreads);
+  std::vector<size_t> sizes(nthreads);
+  for (int start = 0; start < n; start += nthreads * R3mesh_text_chunk_size) {
+    // Format one chunk per thread (the first one on this thread)
+    std::vector<std::thread> threads;
+    int nchunks = 0;
+    for (int t = 0; t < nthreads; t++) {
+      int chunk_start = start + t * R3mesh_text_chunk_size;
+      if (chunk_start >= n) break;
+      int chunk_end = std::min(n, chunk_start + R3mesh_text_chunk_size);
+      auto work = [&, t, chunk_start, chunk_end]() { sizes[t] = format(buffers[t], chunk_start, chunk_end); };
+      if (t > 0) threads.push_back(std::thread(work));
+      nchunks++;
+    }
+    int first_end = std::min(n, start + R3mesh_text_chunk_size);
+    sizes[0] = format(buffers[0], start, first_end);
+    for (unsigned int t = 0; t < threads.size(); t++) threads[t].join();
+
+    // Write chunks in order with one large write each
+    for (int t = 0; t < nchunks; t++) {
+      fwrite(buffers[t].data(), 1, sizes[t], fp);
     }
   }
+}
 
-  // Delete vertex arrays
-  for (int i = 0; i < image->Width(); i++) delete [] vertices[i];
-    delete [] vertices;
 
-  // Delete image
-  delete image;
 
-  // Return success
-  return 1;
+static int
+WriteTextFile(R3Mesh *mesh, const char *filename, int format)
+{
+  // Open file
+  FILE *fp = fopen(filename, "w");
+  if (!fp) {
+    fprintf(stderr, "Unable to open file %s\n", filename);
+    return 0;
+  }
+
+  // Write header
+  int npacked = mesh->NPackedVertices();
+  int nfaces = mesh->NPackedTriangles() + mesh->NFaces() + mesh->NTriangles();
+  if (format != R3mesh_ray_text) {
+    fprintf(fp, "OFF\n");
+    fprintf(fp, "%d %d %d\n", npacked + mesh->NVertices(), nfaces, 0);
+  }
+
+  // Write packed vertices, then vertices
+  bool normals = mesh->HasVertexNormals();
+  WriteText(fp, npacked, [=](std::vector<char>& buffer, int start, int end) {
+    return (size_t) (FormatPackedVertices(mesh, buffer, buffer.data(), start, end, format, normals) - buffer.data());
+  });
+  WriteText(fp, mesh->NVertices(), [=](std::vector<char>& buffer, int start, int end) {
+    return (size_t) (FormatVertices(mesh, buffer, buffer.data(), start, end, format, normals) - buffer.data());
+  });
+
+  // Write packed triangles
+  const unsigned int *packed_triangles = mesh->packed_triangles.data();
+  const unsigned char *packed_leaf = mesh->packed_triangle_leaf.data();
+  WriteText(fp, mesh->NPackedTriangles(), [=](std::vector<char>& buffer, int start, int end) {
+    return (size_t) (FormatTriangles(packed_triangles, packed_leaf, buffer, buffer.data(), start, end, format, 0) - buffer.data());
+  });
+
+  // Write faces (numbering vertices after the packed ones)
+  WriteText(fp, mesh->NFaces(), [=](std::vector<char>& buffer, int start, int end) {
+    return (size_t) (FormatFaces(mesh, buffer, buffer.data(), start, end, format, npacked) - buffer.data());
+  });
+
+  // Write triangles
+  const unsigned int *triangles = mesh->triangles.data();
+  const unsigned char *leaf = mesh->triangle_leaf.data();
+  WriteText(fp, mesh->NTriangles(), [=](std::vector<char>& buffer, int start, int end) {
+    return (size_t) (FormatTriangles(triangles, leaf, buffer, buffer.data(), start, end, format, npacked) - buffer.data());
+  });
+
+  // Close file
+  bool error = ferror(fp);
+  if (fclose(fp) || error) {
+    fprintf(stderr, "Unable to write file %s\n", filename);
+    return 0;
+  }
+
+  // Return number of faces written
+  return nfaces;
 }
 
 
@@ -601,137 +1943,169 @@ ReadImage(const char *filename)
 int R3Mesh::
 ReadOff(const char *filename,int plus)
 {
-  // Open file
-  FILE *fp;
-  if (!(fp = fopen(filename, "r"))) {
-    fprintf(stderr, "Unable to open file %s\n", filename);
-    return 0;
-  }
+  // Map file into memory
+  R3MappedFile file;
+  if (!file.Open(filename)) return 0;
+
+  // Find lines that are not blank or comments
+  vector<R3MeshTextLine> lines;
+  FindTextLines((const char *) file.data, file.size, lines);
 
-  // Read file
+  // Read header
   int nverts = 0;
   int nfaces = 0;
   int nedges = 0;
-  int line_count = 0;
-  int vertex_count = 0;
-  int face_count = 0;
-  char buffer[1024];
-  char header[64];
-  while (fgets(buffer, 1023, fp)) {
-    // Increment line counter
-    line_count++;
-
-    // Skip white space
-    char *bufferp = buffer;
-    while (isspace(*bufferp)) bufferp++;
-
-    // Skip blank lines and comments
-    if (*bufferp == '#') continue;
-    if (*bufferp == '\0') continue;
-
-    // Check section
-    if (nverts == 0) {
-      // Read header keyword
-      if (strstr(bufferp, "OFF")) {
-        // Check if counts are on first line
-        int tmp;
-        if (sscanf(bufferp, "%s%d%d%d", header, &tmp, &nfaces, &nedges) == 4) {
-          nverts = tmp;
-        }
-      }
-      else {
-        // Read counts from second line
-        if ((sscanf(bufferp, "%d%d%d", &nverts, &nfaces, &nedges) != 3) || (nverts == 0)) {
-          fprintf(stderr, "Syntax error reading header on line %d in file %s\n", line_count, filename);
-          fclose(fp);
-          return 0;
-        }
+  unsigned int line_index = 0;
+  while ((nverts == 0) && (line_index < lines.size())) {
+    const R3MeshTextLine& line = lines[line_index++];
+    std::string buffer(line.begin, line.end);
+    if (strstr(buffer.c_str(), "OFF")) {
+      // Check if counts are on first line
+      char header[64];
+      int tmp;
+      if (sscanf(buffer.c_str(), "%63s%d%d%d", header, &tmp, &nfaces, &nedges) == 4) {
+        nverts = tmp;
       }
     }
-    else if (vertex_count < nverts) {
-      // Read vertex coordinates
-      double x, y, z;
-      if (sscanf(bufferp, "%lf%lf%lf", &x, &y, &z) != 3) {
-        fprintf(stderr, "Syntax error with vertex coordinates on line %d in file %s\n", line_count, filename);
-        fclose(fp);
+    else {
+      // Read counts from second line
+      if ((sscanf(buffer.c_str(), "%d%d%d", &nverts, &nfaces, &nedges) != 3) || (nverts <= 0) || (nfaces < 0)) {
+        fprintf(stderr, "Syntax error reading header on line %d in file %s\n", line.number, filename);
         return 0;
       }
-      //<ABIUSX
-      R2Point point=R2zero_point; 
-      if (plus)
-      {
-        float px,py;
-        sscanf(bufferp,"%lf %lf %lf %f %f",&x, &y, &z, &px,&py);
-        point=R2Point(px,py);
-      } //ABIUSX>
+    }
+  }
 
-      // Create vertex
-      CreateVertex(R3Point(x, y, z), R3zero_vector, point);
+  // Find vertex and face lines
+  int vertex_count = std::min(nverts, (int) (lines.size() - line_index));
+  int face_count = std::min(nfaces, (int) (lines.size() - line_index - vertex_count));
+  const R3MeshTextLine *vertex_lines = lines.data() + line_index;
+  const R3MeshTextLine *face_lines = vertex_lines + vertex_count;
+  if (line_index + vertex_count + face_count < lines.size()) {
+    fprintf(stderr, "Found extra text starting at line %d in file %s\n", face_lines[face_count].number, filename);
+  }
+
+  // Create vertices and faces, to be filled in from their lines
+  int first_vertex = NVertices();
+  int first_face = NFaces();
+  vertices.reserve(first_vertex + vertex_count);
+  faces.reserve(first_face + face_count);
+  for (int i = 0; i < vertex_count; i++) vertices.push_back(AllocateVertex());
+  for (int i = 0; i < face_count; i++) faces.push_back(AllocateFace());
+
+  // Read vertex lines on all processors
+  int nthreads = NumberOfThreads(vertex_count);
+  vector<R3Box> boxes(nthreads, R3null_box);
+  vector<int> error_lines(nthreads, 0);
+  RunInParallel(nthreads, vertex_count, [&](int t, size_t start, size_t end) {
+    for (size_t i = start; i < end; i++) {
+      // Read coordinates, then texture coordinates and normal for Off+
+      const R3MeshTextLine& line = vertex_lines[i];
+      double values[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+      int nvalues = 0;
+      const char *p = line.begin;
+      while ((nvalues < ((plus) ? 8 : 3)) && (p = ParseNumber(p, line.end, &values[nvalues]))) nvalues++;
+      if (nvalues < 3) {
+        error_lines[t] = line.number;
+        return;
+      }
 
-      // Increment counter
-      vertex_count++;
+      // Fill in vertex
+      R2Point point = (plus) ? R2Point((float) values[3], (float) values[4]) : R2zero_point;
+      R3Vector normal = (nvalues == 8) ? R3Vector(values[5], values[6], values[7]) : R3zero_vector;
+      R3MeshVertex *vertex = vertices[first_vertex + i];
+      *vertex = R3MeshVertex(R3Point(values[0], values[1], values[2]), normal, point);
+      vertex->id = first_vertex + i;
+      boxes[t].Union(vertex->position);
     }
-    else if (face_count < nfaces) {
-      // Read number of vertices in face 
+  });
+
+  // Update bounding box, and report that vertices are read
+  R3Box previous_bbox = bbox;
+  bool vertices_read = (*std::max_element(error_lines.begin(), error_lines.end()) == 0);
+  if (vertices_read) {
+    for (unsigned int t = 0; t < boxes.size(); t++) bbox.Union(boxes[t]);
+    if (read_progress) read_progress(first_face, first_face, face_count);
+  }
+
+  // Read face lines on all processors (Off+ faces end with the leaf flag),
+  // a chunk at a time when progress is reported
+  int chunk_size = (read_progress) ? R3mesh_progress_chunk_size : std::max(face_count, 1);
+  for (int chunk_start = 0; vertices_read && (chunk_start < face_count); chunk_start += chunk_size) {
+    int chunk_end = std::min(face_count, chunk_start + chunk_size);
+
+    // Allocate vertex lists from the counts that start the face lines
+    // (the pooled storage is not shared between threads)
+    for (int i = chunk_start; i < chunk_end; i++) {
       int face_nverts = 0;
-      bufferp = strtok(bufferp, " \t");
-      if (bufferp) face_nverts = atoi(bufferp);
-      else {
-        fprintf(stderr, "Syntax error with face on line %d in file %s\n", line_count, filename);
-        fclose(fp);
-        return 0;
-      }
+      if (!ParseInteger(face_lines[i].begin, face_lines[i].end, &face_nverts)) face_nverts = 0;
+      AllocateFaceVertices(faces[first_face + i], std::max(face_nverts, 0));
+    }
 
-      // Read vertex indices for face
-      vector<R3MeshVertex *> face_vertices;
-      for (int i = 0; i < face_nverts; i++) {
-        R3MeshVertex *v = NULL;
-        bufferp = strtok(NULL, " \t");
-        if (bufferp) v = Vertex(atoi(bufferp));
-        else {
-          fprintf(stderr, "Syntax error with face on line %d in file %s\n", line_count, filename);
-          fclose(fp);
-          return 0;
+    // Parse the face lines of the chunk on all processors
+    nthreads = NumberOfThreads(chunk_end - chunk_start);
+    error_lines.assign(nthreads, 0);
+    RunInParallel(nthreads, chunk_end - chunk_start, [&](int t, size_t start, size_t end) {
+      for (size_t i = chunk_start + start; i < chunk_start + end; i++) {
+        // Read number of vertices in face
+        const R3MeshTextLine& line = face_lines[i];
+        R3MeshFace *face = faces[first_face + i];
+        int face_nverts = 0;
+        const char *p = ParseInteger(line.begin, line.end, &face_nverts);
+        if (!p || (face_nverts < 0)) {
+          error_lines[t] = -line.number;
+          return;
         }
 
-        // Add vertex to vector
-        face_vertices.push_back(v);
-      }
+        // Read vertex indices for face
+        for (int j = 0; j < face_nverts; j++) {
+          int vertex_id = -1;
+          p = ParseInteger(p, line.end, &vertex_id);
+          if (!p || (vertex_id < 0) || (vertex_id >= vertex_count)) {
+            error_lines[t] = -line.number;
+            return;
+          }
+          face->vertices[j] = vertices[first_vertex + vertex_id];
+        }
 
-      // Create face
-      //<ABIUSX
-      if (plus)
-      {
-        bufferp=strtok(NULL, " \t");
-        CreateFace(face_vertices)->isLeaf=atoi(bufferp);
+        // Fill in face
+        int leaf = 0;
+        if (plus) ParseInteger(p, line.end, &leaf);
+        face->isLeaf = leaf;
+        face->deleted = false;
+        face->id = first_face + i;
+        face->UpdatePlane();
       }
-      //>ABIUSX
+    });
 
-      // Increment counter
-      face_count++;
-    }
-    else {
-      // Should never get here
-      fprintf(stderr, "Found extra text starting at line %d in file %s\n", line_count, filename);
-      break;
-    }
+    // Report faces read
+    if (*std::min_element(error_lines.begin(), error_lines.end()) < 0) break;
+    if (read_progress) read_progress(first_face + chunk_start, first_face + chunk_end, face_count);
+  }
+
+  // Check for syntax errors, removing the partly read elements
+  for (int t = 0; t < nthreads; t++) {
+    if (error_lines[t] == 0) continue;
+    if (error_lines[t] > 0) fprintf(stderr, "Syntax error with vertex coordinates on line %d in file %s\n", error_lines[t], filename);
+    else fprintf(stderr, "Syntax error with face on line %d in file %s\n", -error_lines[t], filename);
+    for (int i = first_vertex; i < NVertices(); i++) FreeVertex(vertices[i]);
+    for (int i = first_face; i < NFaces(); i++) FreeFace(faces[i]);
+    vertices.resize(first_vertex);
+    faces.resize(first_face);
+    bbox = previous_bbox;
+    return 0;
   }
 
   // Check whether read all vertices
-  if ((vertex_count != nverts) || (NVertices() < nverts)) {
-    fprintf(stderr, "Expected %d vertices, but read %d vertex lines and created %d vertices in file %s\n", 
-      nverts, vertex_count, NVertices(), filename);
+  if (vertex_count != nverts) {
+    fprintf(stderr, "Expected %d vertices, but read %d vertex lines in file %s\n", nverts, vertex_count, filename);
   }
 
   // Check whether read all faces
-  if ((face_count != nfaces) || (NFaces() < nfaces)) {
-    fprintf(stderr, "Expected %d faces, but read %d face lines and created %d faces in file %s\n", 
-      nfaces, face_count, NFaces(), filename);
+  if (face_count != nfaces) {
+    fprintf(stderr, "Expected %d faces, but read %d face lines in file %s\n", nfaces, face_count, filename);
   }
 
-  // Close file
-  fclose(fp);
-
   // Return number of faces read
   return NFaces();
 }
@@ -741,82 +2115,115 @@ ReadOff(const char *filename,int plus)
 int R3Mesh::
 WriteOff(const char *filename)
 {
-  // Open file
-  FILE *fp = fopen(filename, "w");
-  if (!fp) {
-    fprintf(stderr, "Unable to open file %s\n", filename);
+  // Write Off file
+  return WriteTextFile(this, filename, R3mesh_off_text);
+}
+
+
+
+int R3Mesh::
+WriteOffPlus(const char *filename)
+{
+  // Write Off file with texture coordinates, leaf flags and normals
+  return WriteTextFile(this, filename, R3mesh_off_plus_text);
+}
+
+
+
+////////////////////////////////////////////////////////////
+// STREAMING OUTPUT
+////////////////////////////////////////////////////////////
+
+int R3Mesh::
+BeginStream(const char *filename, bool normals)
+{
+  // Parse input filename extension
+  const char *extension;
+  if (!(extension = strrchr(filename, '.'))) {
+    printf("Filename %s has no extension (e.g., .off)\n", filename);
     return 0;
   }
 
-  // Write header
-  fprintf(fp, "OFF\n");
-  fprintf(fp, "%d %d %d\n", NVertices(), NFaces(), 0);
-
-  // Write vertices
-  for (int i = 0; i < NVertices(); i++) {
-    R3MeshVertex *vertex = Vertex(i);
-    const R3Point& p = vertex->position;
-    fprintf(fp, "%g %g %g\n", p.X(), p.Y(), p.Z());
-    vertex->id = i;
+  // Pick text format (binary files need all counts before any data)
+  int format;
+  if (!strncmp(extension, ".ray", 4)) format = R3mesh_ray_text;
+  else if (!strncmp(extension, ".offb", 5)) format = -1;
+  else if (!strncmp(extension, ".offz", 5)) format = -1;
+  else if (!strncmp(extension, ".off+", 5)) format = R3mesh_off_plus_text;
+  else if (!strncmp(extension, ".off", 4)) format = R3mesh_off_text;
+  else format = -1;
+  if (format < 0) {
+    fprintf(stderr, "Unable to stream to file %s (only .off, .off+ and .ray can be streamed)\n", filename);
+    return 0;
   }
 
-  // Write Faces
-  for (int i = 0; i < NFaces(); i++) {
-    R3MeshFace *face = Face(i);
-    fprintf(fp, "%d", (int) face->vertices.size());
-    for (unsigned int j = 0; j < face->vertices.size(); j++) {
-      fprintf(fp, " %d", face->vertices[j]->id);
-    }
-    fprintf(fp, "\n");
+  // Open stream
+  delete stream;
+  stream = new R3MeshStream(format, normals);
+  if (!stream->Open(filename)) {
+    delete stream;
+    stream = NULL;
+    return 0;
   }
 
-  // Close file
-  fclose(fp);
+  // Return success
+  return 1;
+}
 
-  // Return number of faces
-  return NFaces();
+
+
+void R3Mesh::
+FlushStream(void)
+{
+  // Check stream
+  if (!stream) return;
+
+  // Format vertices, then faces and triangles, numbering vertices after those already written
+  int format = stream->format;
+  char *p = FormatVertices(this, stream->vertex_text, stream->vertex_text.data(), 0, NVertices(), format, stream->normals);
+  stream->Write(R3_MESH_STREAM_VERTICES, stream->vertex_text, p - stream->vertex_text.data());
+  p = FormatFaces(this, stream->face_text, stream->face_text.data(), 0, NFaces(), format, stream->nvertices);
+  p = FormatTriangles(triangles.data(), triangle_leaf.data(), stream->face_text, p, 0, NTriangles(), format, stream->nvertices);
+  stream->Write(R3_MESH_STREAM_FACES, stream->face_text, p - stream->face_text.data());
+  stream->nvertices += NVertices();
+  stream->nfaces += NFaces() + NTriangles();
+
+  // Remove everything (the storage is kept for the next elements)
+  for (int i = 0; i < NFaces(); i++) FreeFace(faces[i]);
+  for (int i = 0; i < NVertices(); i++) FreeVertex(vertices[i]);
+  faces.clear();
+  vertices.clear();
+  triangles.clear();
+  triangle_leaf.clear();
 }
 
+
+
 int R3Mesh::
-WriteOffPlus(const char *filename)
+EndStream(void)
 {
-  // Open file
-  FILE *fp = fopen(filename, "w");
-  if (!fp) {
-    fprintf(stderr, "Unable to open file %s\n", filename);
-    return 0;
-  }
+  // Check stream
+  if (!stream) return 0;
 
-  // Write header
-  fprintf(fp, "OFF\n");
-  fprintf(fp, "%d %d %d\n", NVertices(), NFaces(), 0);
-
-  // Write vertices
-  for (int i = 0; i < NVertices(); i++) {
-    R3MeshVertex *vertex = Vertex(i);
-    const R3Point& p = vertex->position;
-    fprintf(fp, "%g %g %g %g %g\n", p.X(), p.Y(), p.Z(),vertex->texcoords.X(),vertex->texcoords.Y());
-    vertex->id = i;
-  }
+  // Write remaining elements
+  FlushStream();
 
-  // Write Faces
-  for (int i = 0; i < NFaces(); i++) {
-    R3MeshFace *face = Face(i);
-    fprintf(fp, "%d", (int) face->vertices.size());
-    for (unsigned int j = 0; j < face->vertices.size(); j++) {
-      fprintf(fp, " %d", face->vertices[j]->id);
-    }
-    fprintf(fp," %d",face->isLeaf);
-    fprintf(fp, "\n");
+  // Put header and all elements in the file
+  char header[64] = "";
+  if (stream->format != R3mesh_ray_text) {
+    sprintf(header, "OFF\n%d %d %d\n", stream->nvertices, stream->nfaces, 0);
   }
+  int nfaces = stream->nfaces;
+  int status = stream->Close(header);
+  delete stream;
+  stream = NULL;
 
-  // Close file
-  fclose(fp);
-
-  // Return number of faces
-  return NFaces();
+  // Return number of faces written
+  return (status) ? nfaces : 0;
 }
 
+
+
 ////////////////////////////////////////////////////////////
 // RAY FILE INPUT/OUTPUT
 ////////////////////////////////////////////////////////////
@@ -824,59 +2231,63 @@ WriteOffPlus(const char *filename)
 int R3Mesh::
 ReadRay(const char *filename)
 {
-  // Open file
-  FILE *fp;
-  if (!(fp = fopen(filename, "r"))) {
-    fprintf(stderr, "Unable to open file %s", filename);
-    return 0;
-  }
+  // Map file into memory
+  R3MappedFile file;
+  if (!file.Open(filename)) return 0;
+  const char *p = (const char *) file.data;
+  const char *end = p + file.size;
 
   // Read body
-  char cmd[128];
   int polygon_count = 0;
   int command_number = 1;
-  while (fscanf(fp, "%s", cmd) == 1) {
-    if (!strcmp(cmd, "#vertex")) {
+  while (true) {
+    // Read command
+    while ((p < end) && IsSpace(*p)) p++;
+    if (p == end) break;
+    const char *cmd = p;
+    while ((p < end) && !IsSpace(*p)) p++;
+    size_t cmd_length = p - cmd;
+
+    if ((cmd_length == 7) && !strncmp(cmd, "#vertex", 7)) {
       // Read data
-      double px, py, pz;
-      double nx, ny, nz;
-      double ts, tt;
-      if (fscanf(fp, "%lf%lf%lf%lf%lf%lf%lf%lf", &px, &py, &pz, &nx, &ny, &nz, &ts, &tt) != 8) {
-        fprintf(stderr, "Unable to read vertex at command %d in file %s", command_number, filename);
-        return 0;
+      double values[8];
+      for (int i = 0; i < 8; i++) {
+        if (!(p = ParseNumber(p, end, &values[i]))) {
+          fprintf(stderr, "Unable to read vertex at command %d in file %s\n", command_number, filename);
+          return 0;
+        }
       }
 
       // Create vertex
-      R3Point point(px, py, pz);
-      R3Vector normal(nx, ny, nz);
-      R2Point texcoords(ts, tt);
+      R3Point point(values[0], values[1], values[2]);
+      R3Vector normal(values[3], values[4], values[5]);
+      R2Point texcoords(values[6], values[7]);
       CreateVertex(point, normal, texcoords);
     }
-    else if (!strcmp(cmd, "#shape_polygon")) {
+    else if ((cmd_length == 14) && !strncmp(cmd, "#shape_polygon", 14)) {
       // Read data
       int m, nverts;
-      if (fscanf(fp, "%d%d", &m, &nverts) != 2) {
-        fprintf(stderr, "Unable to read polygon at command %d in file %s", command_number, filename);
+      if (!(p = ParseInteger(p, end, &m)) || !(p = ParseInteger(p, end, &nverts))) {
+        fprintf(stderr, "Unable to read polygon at command %d in file %s\n", command_number, filename);
         return 0;
       }
 
       // Get vertices
-      vector<R3MeshVertex *> face_vertices;
+      face_scratch.clear();
       for (int i = 0; i < nverts; i++) {
         // Read vertex id
         int vertex_id;
-        if (fscanf(fp, "%d", &vertex_id) != 1) {
-          fprintf(stderr, "Unable to read polygon at command %d in file %s", command_number, filename);
+        if (!(p = ParseInteger(p, end, &vertex_id)) || (vertex_id < 0) || (vertex_id >= NVertices())) {
+          fprintf(stderr, "Unable to read polygon at command %d in file %s\n", command_number, filename);
           return 0;
         }
 
         // Get vertex
-        R3MeshVertex *v = Vertex(vertex_id);
-        face_vertices.push_back(v);
+        face_scratch.push_back(Vertex(vertex_id));
       }
 
       // Create face
-      CreateFace(face_vertices);
+      CreateFace(face_scratch);
 
       // Increment polygon counter
       polygon_count++;
@@ -886,9 +2297,6 @@ ReadRay(const char *filename)
     command_number++;
   }
 
-  // Close file
-  fclose(fp);
-
   // Return number of faces created
   return polygon_count;
 }
@@ -898,41 +2306,8 @@ ReadRay(const char *filename)
 int R3Mesh::
 WriteRay(const char *filename)
 {
-  // Open file
-  FILE *fp;
-  if (!(fp = fopen(filename, "w"))) {
-    fprintf(stderr, "Unable to open file %s", filename);
-    return 0;
-  }
-
-  // Write vertices
-  for (int i = 0; i < NVertices(); i++) {
-    R3MeshVertex *vertex = Vertex(i);
-    const R3Point& p = vertex->position;
-    const R3Vector& n = vertex->normal;
-    const R2Point& t = vertex->texcoords;
-    fprintf(fp, "#vertex %g %g %g  %g %g %g  %g %g\n", p.X(), p.Y(), p.Z(), 
-      n.X(), n.Y(), n.Z(), t.X(), t.Y());
-    vertex->id = i;
-  }
-
-  // Write faces
-  for (int i = 0; i < NFaces(); i++) {
-    R3MeshFace *face = Face(i);
-    int nvertices = face->vertices.size();
-    fprintf(fp, "#shape_polygon 0 %d ", nvertices);
-    for (int j = 0; j < nvertices; j++) {
-      R3MeshVertex *v = face->vertices[j];
-      fprintf(fp, "%d ", v->id);
-    }
-    fprintf(fp, "\n");
-  }
-
-  // Close file
-  fclose(fp);
-
-  // Return number of faces written
-  return NFaces();
+  // Write ray file
+  return WriteTextFile(this, filename, R3mesh_ray_text);
 }
 
 
@@ -945,9 +2320,11 @@ R3MeshVertex::
 R3MeshVertex(void)
 : position(0, 0, 0),
 normal(0, 0, 0),
+tangent(0, 0, 0),
 texcoords(0, 0),
 curvature(0),
-id(0)
+id(0),
+deleted(false)
 {
 }
 
@@ -957,9 +2334,11 @@ R3MeshVertex::
 R3MeshVertex(const R3MeshVertex& vertex)
 : position(vertex.position),
 normal(vertex.normal),
+tangent(vertex.tangent),
 texcoords(vertex.texcoords),
 curvature(vertex.curvature),
-id(0)
+id(0),
+deleted(false)
 {
 }
 
@@ -970,9 +2349,11 @@ R3MeshVertex::
 R3MeshVertex(const R3Point& position, const R3Vector& normal, const R2Point& texcoords)
 : position(position),                    
 normal(normal),
+tangent(0, 0, 0),
 texcoords(texcoords),
 curvature(0),
-id(0)
+id(0),
+deleted(false)
 {
 }
 
@@ -1039,7 +2420,8 @@ R3MeshFace(void)
 : vertices(),
 plane(0, 0, 0, 0),
 id(0),
-isLeaf(0)
+isLeaf(0),
+deleted(false)
 {
 }
 
@@ -1050,20 +2432,9 @@ R3MeshFace(const R3MeshFace& face)
 : vertices(face.vertices),
 plane(face.plane),
 id(0),
-isLeaf(0)
-{
-}
-
-
-
-R3MeshFace::
-R3MeshFace(const vector<R3MeshVertex *>& vertices)
-: vertices(vertices),
-plane(0, 0, 0, 0),
-id(0),
-isLeaf(0)
+isLeaf(0),
+deleted(false)
 {
-  UpdatePlane();
 }
 
 
@@ -1147,3 +2518,51 @@ UpdatePlane(void)
 
 
 
+
+
+
+////////////////////////////////////////////////////////////
+// MESH RANDOM NUMBER GENERATOR MEMBER FUNCTIONS
+////////////////////////////////////////////////////////////
+
+R3MeshRandom::
+R3MeshRandom(unsigned int seed)
+{
+  // Start sequence
+  Seed(seed);
+}
+
+
+
+void R3MeshRandom::
+Seed(unsigned int seed)
+{
+  // Fill the state the way srand() does (seed 0 behaves like seed 1)
+  int word = (seed) ? (int) seed : 1;
+  state[0] = word;
+  for (int i = 1; i < 31; i++) {
+    int hi = word / 127773;
+    int lo = word % 127773;
+    word = 16807 * lo - 2836 * hi;
+    if (word < 0) word += 2147483647;
+    state[i] = word;
+  }
+
+  // Discard the first numbers, which depend too much on the seed
+  front = 3;
+  rear = 0;
+  for (int i = 0; i < 310; i++) Next();
+}
+
+
+
+int R3MeshRandom::
+Next(void)
+{
+  // Return next number in [0, RAND_MAX] (additive feedback, x[i-31] + x[i-3])
+  state[front] += state[rear];
+  int result = state[front] >> 1;
+  front = (front + 1) % 31;
+  rear = (rear + 1) % 31;
+  return result;
+}
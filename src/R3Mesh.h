@@ -11,11 +11,14 @@
 //#include <array>
 #include <vector>
 #include <map>
+#include <functional>
 #include <stack>
 #include <iostream>
 #include "R2/R2.h"
 #include "R3/R3.h"
 using namespace std;
+struct R3MeshStream;
+struct LSystemCache;
 
 
 
@@ -39,9 +42,11 @@ struct R3MeshVertex {
   // Data
   R3Point position;
   R3Vector normal;
+  R3Vector tangent;
   R2Point texcoords;
   double curvature;
   int id; 
+  bool deleted;
 };
 
 
@@ -50,11 +55,34 @@ struct R3MeshVertex {
 // MESH FACE DECLARATION
 ////////////////////////////////////////////////////////////
 
-struct R3MeshFace {
+// The vertex list of a face lives in storage pooled by its mesh (see
+// R3Mesh::AllocateFaceVertices), so it is only resized through the mesh
+struct R3MeshFaceVertices {
   // Constructors
+  R3MeshFaceVertices(void) : elements(NULL), count(0), capacity(0) {}
+
+  // Access functions
+  unsigned int size(void) const { return count; }
+  bool empty(void) const { return count == 0; }
+  R3MeshVertex *& operator[](int k) const { return elements[k]; }
+  R3MeshVertex *back(void) const { return elements[count-1]; }
+  R3MeshVertex **data(void) const { return elements; }
+  R3MeshVertex **begin(void) const { return elements; }
+  R3MeshVertex **end(void) const { return elements + count; }
+  void clear(void) { count = 0; }
+
+  // Data
+  R3MeshVertex **elements;
+  int count;
+  int capacity;
+};
+
+struct R3MeshFace {
+  // Constructors (a copy refers to the same pooled vertex list, so faces
+  // are not assignable)
   R3MeshFace(void);
   R3MeshFace(const R3MeshFace& face);
-  R3MeshFace(const vector <R3MeshVertex *>& vertices);
+  R3MeshFace& operator=(const R3MeshFace& face) = delete;
 
   // Property functions
   double AverageEdgeLength(void) const;
@@ -64,14 +92,74 @@ struct R3MeshFace {
   void UpdatePlane(void);
 
   // Data
-  vector<R3MeshVertex *> vertices;
+  R3MeshFaceVertices vertices;
   R3Plane plane;
   int id;
   bool isLeaf;
+  bool deleted;
 };
 ///ABIUSX
 typedef pair<R3MeshVertex*,R3MeshVertex*> R3MeshEdge;
-typedef vector<R3MeshVertex*> R3Shape;
+
+// A shape is a contiguous range of vertices in a mesh, as returned by the
+// shape creation functions.  It is only valid until vertices are deleted.
+struct R3Shape {
+  R3Shape(void) : first(0), count(0) {}
+  R3Shape(int first, int count) : first(first), count(count) {}
+  int first;
+  int count;
+};
+
+// A packed vertex has its attributes quantized to 16 bits against the bounds
+// of its packed block (normals as octahedral coordinates, with both at 65535
+// for a zero normal).  Packed blocks are made by R3Mesh::Pack.
+struct R3MeshPackedVertex {
+  unsigned short position[3];
+  unsigned short normal[2];
+  unsigned short texcoords[2];
+};
+
+struct R3MeshPackedBlock {
+  // Decoding functions
+  R3Point Position(const R3MeshPackedVertex& vertex) const;
+  R3Vector Normal(const R3MeshPackedVertex& vertex) const;
+  R2Point TexCoords(const R3MeshPackedVertex& vertex) const;
+
+  // Data
+  int first;
+  float position_min[3];
+  float position_step[3];
+  float texcoord_min[2];
+  float texcoord_step[2];
+};
+
+#define R3_MESH_PACKED_BLOCK_SIZE 4096
+#define R3_MESH_PACKED_ZERO_NORMAL 65535
+
+
+
+////////////////////////////////////////////////////////////
+// MESH RANDOM NUMBER GENERATOR DECLARATION
+////////////////////////////////////////////////////////////
+
+// Gives the same numbers as rand() in the GNU C library, but each mesh
+// has its own state, so trees can be generated on several threads
+struct R3MeshRandom {
+  // Constructors
+  R3MeshRandom(unsigned int seed=1);
+
+  // Random number functions
+  void Seed(unsigned int seed);
+  int Next(void);
+
+  // Data
+  unsigned int state[31];
+  int front;
+  int rear;
+};
+
+
+
 ////////////////////////////////////////////////////////////
 // MESH CLASS DECLARATION
 ////////////////////////////////////////////////////////////
@@ -80,6 +168,7 @@ struct R3Mesh {
   // Constructors
   R3Mesh(void);
   R3Mesh(const R3Mesh& mesh);
+  R3Mesh(R3Mesh&& mesh);
   ~R3Mesh(void);
 
   // Properties
@@ -91,15 +180,18 @@ struct R3Mesh {
   R3MeshVertex *Vertex(int k) const;
   int NFaces(void) const;
   R3MeshFace *Face(int k) const;
+  int NTriangles(void) const;
+  const unsigned int *Triangle(int k) const;
+  bool IsLeafTriangle(int k) const;
 
   // Transformations
   void Translate(double dx, double dy, double dz);
-  void TranslateShape(R3Shape shape,double dx, double dy, double dz);
+  void TranslateShape(const R3Shape& shape,double dx, double dy, double dz);
   void Scale(double sx, double sy, double sz);
-  void ScaleShape(R3Shape shape,double sx, double sy, double sz);
+  void ScaleShape(const R3Shape& shape,double sx, double sy, double sz);
   void Rotate(double angle, const R3Line& axis);
-  void RotateShape(R3Shape shape,double angle, const R3Line& axis);
-  void RotateShape(vector<R3MeshVertex *> shape,double angle, const R3Vector& axis);
+  void RotateShape(const R3Shape& shape,double angle, const R3Line& axis);
+  void RotateShape(const R3Shape& shape,double angle, const R3Vector& axis);
 
   // Warps (1st Project)
   void Twist(double angle);
@@ -115,15 +207,81 @@ struct R3Mesh {
   int WriteRay(const char *filename);
   int WriteOff(const char *filename);
   int WriteOffPlus(const char *filename);
+  int ReadBinary(const char *filename);
+  int WriteBinary(const char *filename);
+  int ReadCompressed(const char *filename);
+  int WriteCompressed(const char *filename);
+  int ReadPly(const char *filename);
+  int WritePly(const char *filename);
+  int WriteGLB(const char *filename, bool instance_leaves=false);
+
+  // Streaming output (elements are written to the file and removed
+  // from the mesh at every flush, so memory use stays constant; whether
+  // Off+ vertices have normals is decided once, for the whole file)
+  int BeginStream(const char *filename, bool normals=true);
+  void FlushStream(void);
+  int EndStream(void);
+
   // Low-level creation functions
   R3MeshVertex *CreateVertex(const R3Point& position, 
     const R3Vector& normal=R3zero_vector, const R2Point& texcoords=R2zero_point);
   R3MeshVertex *CreateVertex(const R3Point& position, const R2Point& texcoords);
   R3MeshFace *CreateFace(const vector <R3MeshVertex *>& vertices);
+  R3MeshFace *CreateFace(R3MeshVertex * const *vertices, int nvertices);
+  void CreateTriangles(R3MeshVertex * const *vertices, int nvertices, bool isLeaf=false);
+  void CreatePolygon(R3MeshVertex * const *vertices, int nvertices, bool isLeaf=false);
+  void CreateFaces(const unsigned int *indices, const unsigned int *offsets, const unsigned char *leaf,
+    int nfaces, int first_vertex);
   void DeleteVertex(R3MeshVertex *vertex);
   void DeleteFace(R3MeshFace *face);
 
-  void Tree(const char *descriptor_filename,const int iterations=0);
+  // Remove all elements, keeping their storage for the next mesh
+  void Clear(void);
+
+  // Batch deletion (mark elements, then remove them all in one pass; when
+  // the mesh has triangles, DeleteVertex only marks the vertex, since the
+  // triangles refer to vertices by id)
+  void MarkDeleted(R3MeshVertex *vertex);
+  void MarkDeleted(R3MeshFace *face);
+  void Compact(void);
+
+  // Triangulation (moves all faces into the triangle buffer)
+  void Triangulate(void);
+
+  // Packing (moves all vertices into packed blocks and all faces into packed
+  // triangles, so very large meshes fit in memory; packed vertices are
+  // numbered before the vertices created afterwards)
+  void Pack(void);
+  void Unpack(void);
+  int NPackedVertices(void) const;
+  const R3MeshPackedVertex& PackedVertex(int k) const;
+  const R3MeshPackedBlock& PackedBlock(int k) const;
+  int NPackedTriangles(void) const;
+  const unsigned int *PackedTriangle(int k) const;
+  bool IsLeafPackedTriangle(int k) const;
+
+  // Written element access (every vertex and face in the order the writers
+  // list them, without unpacking: packed vertices, decoded when asked for,
+  // then vertices; packed triangles, then faces, then triangles)
+  int NWrittenVertices(void) const;
+  R3Point WrittenPosition(int k) const;
+  R3Vector WrittenNormal(int k) const;
+  R3Vector WrittenTangent(int k) const;
+  R2Point WrittenTexCoords(int k) const;
+  int NWrittenFaces(void) const;
+  int NWrittenFaceVertices(int k) const;
+  unsigned int WrittenFaceVertex(int k, int j) const;
+  bool IsLeafWrittenFace(int k) const;
+
+  // Optimization for rendering (groups triangles by material, reorders them
+  // for the post-transform vertex cache, and vertices for fetch locality)
+  void Optimize(int cache_size=32);
+  double ACMR(int cache_size=32) const;
+
+  // Generation (cache keeps the derived string between calls, so a grammar
+  // whose numbers changed is only interpreted again; returns 0 if the
+  // grammar cannot be read)
+  int Tree(const char *descriptor_filename,const int iterations=0,LSystemCache *cache=NULL);
   void AddCoords(); 
 
   R3Shape Cylinder(float topBottomRatio=1.0,int slices=100);
@@ -136,11 +294,63 @@ struct R3Mesh {
   void UpdateFacePlanes(void);
   void UpdateVertexNormals(void);
   void UpdateVertexCurvatures(void);
+  bool HasVertexNormals(void) const;
+
+  // Element storage (vertices, faces and face vertex lists are carved out
+  // of large blocks, and deleted ones are recycled, so creation rarely hits
+  // the heap)
+  R3MeshVertex *AllocateVertex(void);
+  R3MeshFace *AllocateFace(void);
+  void AllocateFaceVertices(R3MeshFace *face, int nvertices);
+  void FreeVertex(R3MeshVertex *vertex);
+  void FreeFace(R3MeshFace *face);
+  const vector<R2Point>& Ring(int slices);
 
   // Data
   vector<R3MeshVertex *> vertices;
   vector<R3MeshFace *> faces;
   R3Box bbox;
+
+  // Triangle data (when triangulate is set, shapes are created as
+  // triangles in this flat index buffer instead of as faces)
+  vector<unsigned int> triangles;
+  vector<unsigned char> triangle_leaf;
+  bool triangulate;
+
+  // Storage data
+  vector<R3MeshVertex *> vertex_blocks;
+  vector<R3MeshFace *> face_blocks;
+  vector<R3MeshVertex *> free_vertices;
+  vector<R3MeshFace *> free_faces;
+  int vertex_block_count;
+  int face_block_count;
+  vector<R3MeshVertex **> face_vertex_blocks;
+  vector<vector<R3MeshVertex **> > free_face_vertices;
+  int face_vertex_block_count;
+  map<int, vector<R2Point> > rings;
+  vector<R3MeshVertex *> face_scratch;
+
+  // Packed data (when packing is set, shapes are packed a block at a time
+  // as they are drawn)
+  vector<R3MeshPackedVertex> packed_vertices;
+  vector<R3MeshPackedBlock> packed_blocks;
+  vector<unsigned int> packed_triangles;
+  vector<unsigned char> packed_triangle_leaf;
+  bool packing;
+
+  // Streaming output data
+  R3MeshStream *stream;
+
+  // Read progress (when set, Off files are read a chunk of faces at a
+  // time, and this is called once the vertices and bounding box are read
+  // and after every chunk, with the faces read since the last call and
+  // the number of faces in the file)
+  std::function<void(int start_face, int end_face, int nfaces)> read_progress;
+
+  // Generation data (random choices of rules and leaf bends, and whether
+  // to print progress)
+  R3MeshRandom random;
+  bool verbose;
 };
 
 
@@ -185,5 +395,144 @@ Face(int k) const
 
 
 
+inline int R3Mesh::
+NTriangles(void) const
+{
+  // Return number of triangles in the triangle buffer
+  return triangle_leaf.size();
+}
+
+
+
+inline const unsigned int *R3Mesh::
+Triangle(int k) const
+{
+  // Return the three vertex ids of the kth triangle
+  return &triangles[3*k];
+}
+
+
+
+inline bool R3Mesh::
+IsLeafTriangle(int k) const
+{
+  // Return whether the kth triangle belongs to a leaf
+  return triangle_leaf[k];
+}
+
+
+
+inline int R3Mesh::
+NPackedVertices(void) const
+{
+  // Return number of packed vertices
+  return packed_vertices.size();
+}
+
+
+
+inline const R3MeshPackedVertex& R3Mesh::
+PackedVertex(int k) const
+{
+  // Return kth packed vertex (decoded with the block containing it)
+  return packed_vertices[k];
+}
+
+
+
+inline int R3Mesh::
+NPackedTriangles(void) const
+{
+  // Return number of packed triangles
+  return packed_triangle_leaf.size();
+}
+
+
+
+inline const unsigned int *R3Mesh::
+PackedTriangle(int k) const
+{
+  // Return the three packed vertex ids of the kth packed triangle
+  return &packed_triangles[3*k];
+}
+
+
+
+inline bool R3Mesh::
+IsLeafPackedTriangle(int k) const
+{
+  // Return whether the kth packed triangle belongs to a leaf
+  return packed_triangle_leaf[k];
+}
+
+
+
+inline int R3Mesh::
+NWrittenVertices(void) const
+{
+  // Return number of packed and unpacked vertices
+  return packed_vertices.size() + vertices.size();
+}
+
+
+
+inline int R3Mesh::
+NWrittenFaces(void) const
+{
+  // Return number of packed triangles, faces, and triangles
+  return packed_triangle_leaf.size() + faces.size() + triangle_leaf.size();
+}
+
+
+
+////////////////////////////////////////////////////////////
+// PACKED BLOCK INLINE FUNCTIONS
+////////////////////////////////////////////////////////////
+
+inline R3Point R3MeshPackedBlock::
+Position(const R3MeshPackedVertex& vertex) const
+{
+  // Return position of a vertex of the block
+  return R3Point(position_min[0] + vertex.position[0] * position_step[0],
+    position_min[1] + vertex.position[1] * position_step[1],
+    position_min[2] + vertex.position[2] * position_step[2]);
+}
+
+
+
+inline R3Vector R3MeshPackedBlock::
+Normal(const R3MeshPackedVertex& vertex) const
+{
+  // Check for zero normal
+  if ((vertex.normal[0] == R3_MESH_PACKED_ZERO_NORMAL) && (vertex.normal[1] == R3_MESH_PACKED_ZERO_NORMAL)) {
+    return R3zero_vector;
+  }
+
+  // Fold the octahedral coordinates back onto the octahedron, and normalize
+  double x = vertex.normal[0] * (2.0 / 65535) - 1;
+  double y = vertex.normal[1] * (2.0 / 65535) - 1;
+  double z = 1 - fabs(x) - fabs(y);
+  if (z < 0) {
+    double fx = (1 - fabs(y)) * ((x < 0) ? -1 : 1);
+    double fy = (1 - fabs(x)) * ((y < 0) ? -1 : 1);
+    x = fx; y = fy;
+  }
+  R3Vector normal(x, y, z);
+  normal.Normalize();
+  return normal;
+}
+
+
+
+inline R2Point R3MeshPackedBlock::
+TexCoords(const R3MeshPackedVertex& vertex) const
+{
+  // Return texture coordinates of a vertex of the block
+  return R2Point(texcoord_min[0] + vertex.texcoords[0] * texcoord_step[0],
+    texcoord_min[1] + vertex.texcoords[1] * texcoord_step[1]);
+}
+
+
+
 
 #endif
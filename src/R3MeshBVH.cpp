@@ -0,0 +1,745 @@
+// Source file for bounding volume hierarchies over mesh faces
+
+
+
+// Include files
+
+#include "R3MeshBVH.h"
+#include <algorithm>
+#include <cmath>
+
+
+
+////////////////////////////////////////////////////////////
+// BOUNDS FUNCTIONS
+////////////////////////////////////////////////////////////
+
+static void
+EmptyBounds(float bounds[2][3])
+{
+  // Make bounds that contain nothing
+  for (int dim = 0; dim < 3; dim++) {
+    bounds[0][dim] = FLT_MAX;
+    bounds[1][dim] = -FLT_MAX;
+  }
+}
+
+
+
+static void
+UnionBounds(float bounds[2][3], const float other[2][3])
+{
+  // Grow bounds to contain other bounds
+  for (int dim = 0; dim < 3; dim++) {
+    if (other[0][dim] < bounds[0][dim]) bounds[0][dim] = other[0][dim];
+    if (other[1][dim] > bounds[1][dim]) bounds[1][dim] = other[1][dim];
+  }
+}
+
+
+
+static void
+UnionBounds(float bounds[2][3], const R3Point& point)
+{
+  // Grow bounds to contain point, rounding outwards to single precision
+  for (int dim = 0; dim < 3; dim++) {
+    float low = (float) point[dim];
+    float high = low;
+    if (low > point[dim]) low = nextafterf(low, -FLT_MAX);
+    if (high < point[dim]) high = nextafterf(high, FLT_MAX);
+    if (low < bounds[0][dim]) bounds[0][dim] = low;
+    if (high > bounds[1][dim]) bounds[1][dim] = high;
+  }
+}
+
+
+
+static float
+BoundsArea(const float bounds[2][3])
+{
+  // Return surface area of bounds (zero if empty)
+  float dx = bounds[1][0] - bounds[0][0];
+  float dy = bounds[1][1] - bounds[0][1];
+  float dz = bounds[1][2] - bounds[0][2];
+  if ((dx < 0) || (dy < 0) || (dz < 0)) return 0;
+  return 2 * (dx * dy + dy * dz + dz * dx);
+}
+
+
+
+static double
+BoundsDistanceSquared(const float bounds[2][3], const R3Point& point)
+{
+  // Return squared distance from point to bounds (zero inside)
+  double d = 0;
+  for (int dim = 0; dim < 3; dim++) {
+    double below = bounds[0][dim] - point[dim];
+    double above = point[dim] - bounds[1][dim];
+    if (below > 0) d += below * below;
+    else if (above > 0) d += above * above;
+  }
+  return d;
+}
+
+
+
+////////////////////////////////////////////////////////////
+// MESH BVH CONSTRUCTORS
+////////////////////////////////////////////////////////////
+
+R3MeshBVH::
+R3MeshBVH(R3Mesh *mesh, R3ThreadPool *pool)
+: mesh(NULL)
+{
+  // Build hierarchy
+  if (mesh) Build(mesh, pool);
+}
+
+
+
+R3Box R3MeshBVH::
+BBox(void) const
+{
+  // Return bounds of the root
+  if (nodes.empty()) return R3null_box;
+  const float (*b)[3] = nodes[0].bounds;
+  return R3Box(b[0][0], b[0][1], b[0][2], b[1][0], b[1][1], b[1][2]);
+}
+
+
+
+////////////////////////////////////////////////////////////
+// MESH BVH CONSTRUCTION
+////////////////////////////////////////////////////////////
+
+// Bounds and centroid of an item, while building (items are moved
+// around together with their bounds, so each level reads them in order)
+struct R3MeshBVHBuildItem {
+  float bounds[2][3];
+  float centroid[3];
+  int item;
+};
+
+// A node still to be built, with the range of items in it
+struct R3MeshBVHBuildRange {
+  int node;
+  int first;
+  int count;
+  int depth;
+};
+
+
+
+static int
+SplitNode(R3MeshBVHNode& node, const R3MeshBVHBuildRange& range, vector<R3MeshBVHBuildItem>& build_items)
+{
+  // Bound the items and their centroids
+  R3MeshBVHBuildItem *first = &build_items[range.first];
+  int count = range.count;
+  float centroid_bounds[2][3];
+  EmptyBounds(node.bounds);
+  EmptyBounds(centroid_bounds);
+  for (int i = 0; i < count; i++) {
+    const R3MeshBVHBuildItem& item = first[i];
+    UnionBounds(node.bounds, item.bounds);
+    for (int dim = 0; dim < 3; dim++) {
+      if (item.centroid[dim] < centroid_bounds[0][dim]) centroid_bounds[0][dim] = item.centroid[dim];
+      if (item.centroid[dim] > centroid_bounds[1][dim]) centroid_bounds[1][dim] = item.centroid[dim];
+    }
+  }
+
+  // Make a leaf of few items, or at the maximum depth
+  node.first = range.first;
+  node.count = count;
+  if ((count <= R3_MESH_BVH_LEAF_SIZE) || (range.depth >= R3_MESH_BVH_MAX_DEPTH)) return 0;
+
+  // Put the centroids in bins along each axis
+  const int B = R3_MESH_BVH_BINS;
+  int bin_counts[3][B] = { { 0 } };
+  float bin_bounds[3][B][2][3];
+  float scale[3];
+  for (int dim = 0; dim < 3; dim++) {
+    float extent = centroid_bounds[1][dim] - centroid_bounds[0][dim];
+    scale[dim] = (extent > 0) ? B * (1 - 1E-6F) / extent : 0;
+    for (int b = 0; b < B; b++) EmptyBounds(bin_bounds[dim][b]);
+  }
+  for (int i = 0; i < count; i++) {
+    const R3MeshBVHBuildItem& item = first[i];
+    for (int dim = 0; dim < 3; dim++) {
+      int b = std::min(B - 1, (int) ((item.centroid[dim] - centroid_bounds[0][dim]) * scale[dim]));
+      bin_counts[dim][b]++;
+      UnionBounds(bin_bounds[dim][b], item.bounds);
+    }
+  }
+
+  // Find the cheapest split between bins, by the surface area heuristic
+  // (visiting a node costs as much as intersecting one triangle)
+  float best_cost = FLT_MAX;
+  int best_axis = -1, best_split = 0;
+  for (int dim = 0; dim < 3; dim++) {
+    if (scale[dim] == 0) continue;
+    float right_area[B];
+    int right_count[B];
+    float bounds[2][3];
+    EmptyBounds(bounds);
+    for (int b = B - 1, n = 0; b > 0; b--) {
+      UnionBounds(bounds, bin_bounds[dim][b]);
+      n += bin_counts[dim][b];
+      right_area[b] = BoundsArea(bounds);
+      right_count[b] = n;
+    }
+    EmptyBounds(bounds);
+    for (int b = 1, n = 0; b < B; b++) {
+      UnionBounds(bounds, bin_bounds[dim][b - 1]);
+      n += bin_counts[dim][b - 1];
+      if ((n == 0) || (right_count[b] == 0)) continue;
+      float cost = n * BoundsArea(bounds) + right_count[b] * right_area[b];
+      if (cost < best_cost) { best_cost = cost; best_axis = dim; best_split = b; }
+    }
+  }
+
+  // Split items whose centroids are all at one point in the middle
+  if (best_axis < 0) return (count > R3_MESH_BVH_MAX_LEAF_SIZE) ? count / 2 : 0;
+
+  // Make a leaf if splitting costs more, unless the leaf would be too big
+  float area = BoundsArea(node.bounds);
+  if ((count <= R3_MESH_BVH_MAX_LEAF_SIZE) && (count * area <= area + best_cost)) return 0;
+
+  // Move the items of the bins left of the split to the front
+  int axis = best_axis;
+  float low = centroid_bounds[0][axis];
+  R3MeshBVHBuildItem *middle = std::partition(first, first + count, [&](const R3MeshBVHBuildItem& item) {
+    return std::min(B - 1, (int) ((item.centroid[axis] - low) * scale[axis])) < best_split;
+  });
+
+  // Return number of items in the first child
+  return middle - first;
+}
+
+
+
+void R3MeshBVH::
+Build(R3Mesh *mesh, R3ThreadPool *pool)
+{
+  // Remember mesh
+  this->mesh = mesh;
+  items.clear();
+  nodes.clear();
+
+  // Make an item for every triangle of every element
+  for (int i = 0; i < mesh->NFaces(); i++) {
+    int nvertices = mesh->Face(i)->vertices.size();
+    for (int j = 0; j < nvertices - 2; j++) {
+      R3MeshBVHItem item = { i, j };
+      items.push_back(item);
+    }
+  }
+  for (int i = 0; i < mesh->NTriangles() + mesh->NPackedTriangles(); i++) {
+    R3MeshBVHItem item = { mesh->NFaces() + i, 0 };
+    items.push_back(item);
+  }
+  if (items.empty()) return;
+
+  // Use the given pool, or a pool with a thread per core
+  R3ThreadPool local_pool((pool) ? 1 : 0);
+  R3ThreadPool& threads = (pool) ? *pool : local_pool;
+
+  // Find item bounds and centroids
+  int nitems = items.size();
+  vector<R3MeshBVHBuildItem> build_items(nitems);
+  threads.RunChunks(nitems, 4096, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      R3Point p[3];
+      ItemPoints(items[i], p);
+      R3MeshBVHBuildItem& item = build_items[i];
+      EmptyBounds(item.bounds);
+      for (int j = 0; j < 3; j++) UnionBounds(item.bounds, p[j]);
+      for (int dim = 0; dim < 3; dim++) item.centroid[dim] = 0.5F * (item.bounds[0][dim] + item.bounds[1][dim]);
+      item.item = i;
+    }
+  });
+
+  // Build the nodes one level at a time, splitting the nodes of a level
+  // on all threads, then making their children in order (so the tree
+  // does not depend on the number of threads)
+  vector<R3MeshBVHBuildRange> level(1), next_level;
+  R3MeshBVHBuildRange root = { 0, 0, nitems, 0 };
+  level[0] = root;
+  nodes.resize(1);
+  vector<int> splits;
+  while (!level.empty()) {
+    // Split nodes
+    splits.assign(level.size(), 0);
+    threads.Run(level.size(), [&](int k, int thread) {
+      splits[k] = SplitNode(nodes[level[k].node], level[k], build_items);
+    });
+
+    // Make children of split nodes
+    next_level.clear();
+    for (unsigned int k = 0; k < level.size(); k++) {
+      if (splits[k] == 0) continue;
+      const R3MeshBVHBuildRange& range = level[k];
+      int child = nodes.size();
+      nodes[range.node].first = child;
+      nodes[range.node].count = 0;
+      nodes.resize(child + 2);
+      R3MeshBVHBuildRange left = { child, range.first, splits[k], range.depth + 1 };
+      R3MeshBVHBuildRange right = { child + 1, range.first + splits[k], range.count - splits[k], range.depth + 1 };
+      next_level.push_back(left);
+      next_level.push_back(right);
+    }
+    level.swap(next_level);
+  }
+
+  // Put items in the order of the leaves
+  vector<R3MeshBVHItem> sorted_items(nitems);
+  for (int i = 0; i < nitems; i++) sorted_items[i] = items[build_items[i].item];
+  items.swap(sorted_items);
+}
+
+
+
+void R3MeshBVH::
+Refit(R3ThreadPool *pool)
+{
+  // Check hierarchy
+  if (nodes.empty()) return;
+
+  // Use the given pool, or a pool with a thread per core
+  R3ThreadPool local_pool((pool) ? 1 : 0);
+  R3ThreadPool& threads = (pool) ? *pool : local_pool;
+
+  // Fit leaves to the moved vertices
+  threads.RunChunks(nodes.size(), 4096, [&](int begin, int end) {
+    for (int k = begin; k < end; k++) {
+      if (nodes[k].count > 0) FitLeaf(k);
+    }
+  });
+
+  // Fit interior nodes to their children, from the bottom up (children
+  // always come after their parents)
+  for (int k = nodes.size() - 1; k >= 0; k--) {
+    R3MeshBVHNode& node = nodes[k];
+    if (node.count > 0) continue;
+    EmptyBounds(node.bounds);
+    UnionBounds(node.bounds, nodes[node.first].bounds);
+    UnionBounds(node.bounds, nodes[node.first + 1].bounds);
+  }
+}
+
+
+
+void R3MeshBVH::
+FitLeaf(int node)
+{
+  // Bound the triangles of the items of a leaf
+  R3MeshBVHNode& leaf = nodes[node];
+  EmptyBounds(leaf.bounds);
+  for (int i = leaf.first; i < leaf.first + leaf.count; i++) {
+    R3Point p[3];
+    ItemPoints(items[i], p);
+    for (int j = 0; j < 3; j++) UnionBounds(leaf.bounds, p[j]);
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////
+// MESH BVH ITEM FUNCTIONS
+////////////////////////////////////////////////////////////
+
+void R3MeshBVH::
+ItemPoints(const R3MeshBVHItem& item, R3Point *points) const
+{
+  // Get the corners of a fan triangle of a face
+  int k = item.element;
+  if (k < mesh->NFaces()) {
+    R3MeshFace *face = mesh->Face(k);
+    points[0] = face->vertices[0]->position;
+    points[1] = face->vertices[item.corner + 1]->position;
+    points[2] = face->vertices[item.corner + 2]->position;
+    return;
+  }
+
+  // Get the corners of a triangle
+  k -= mesh->NFaces();
+  if (k < mesh->NTriangles()) {
+    const unsigned int *t = mesh->Triangle(k);
+    for (int j = 0; j < 3; j++) points[j] = mesh->Vertex(t[j])->position;
+    return;
+  }
+
+  // Get the corners of a packed triangle
+  k -= mesh->NTriangles();
+  const unsigned int *t = mesh->PackedTriangle(k);
+  for (int j = 0; j < 3; j++) {
+    points[j] = mesh->PackedBlock(t[j]).Position(mesh->PackedVertex(t[j]));
+  }
+}
+
+
+
+void R3MeshBVH::
+ElementHit(int element, R3MeshBVHHit *hit) const
+{
+  // Fill in the face, triangle or packed triangle of an element
+  int k = element;
+  hit->element = element;
+  hit->face = (k < mesh->NFaces()) ? mesh->Face(k) : NULL;
+  k -= mesh->NFaces();
+  hit->triangle = ((k >= 0) && (k < mesh->NTriangles())) ? k : -1;
+  k -= mesh->NTriangles();
+  hit->packed_triangle = (k >= 0) ? k : -1;
+}
+
+
+
+////////////////////////////////////////////////////////////
+// MESH BVH RAY QUERIES
+////////////////////////////////////////////////////////////
+
+// A ray set up for box tests in single precision (sign picks which
+// bounds of a node the ray meets first on each axis)
+struct R3MeshBVHRay {
+  R3MeshBVHRay(const R3Ray& ray);
+  float start[3];
+  float inverse[3];
+  int sign[3];
+};
+
+
+
+R3MeshBVHRay::
+R3MeshBVHRay(const R3Ray& ray)
+{
+  // Find start, inverse direction and direction signs
+  for (int dim = 0; dim < 3; dim++) {
+    start[dim] = (float) ray.Start()[dim];
+    inverse[dim] = 1.0F / (float) ray.Vector()[dim];
+    sign[dim] = (inverse[dim] < 0) ? 1 : 0;
+  }
+}
+
+
+
+static inline void
+IntersectChildren(const R3MeshBVHNode *children, const R3MeshBVHRay& ray, float tmax, float *t, bool *hit)
+{
+  // Clip the ray against the slabs of both children at once (a zero
+  // direction gives an infinite inverse, and then NaN comparisons keep
+  // the interval as it was); the far distance is padded a few ulps, so
+  // rounding never loses a hit
+  float tnear[2] = { 0, 0 };
+  float tfar[2] = { tmax, tmax };
+  for (int dim = 0; dim < 3; dim++) {
+    for (int c = 0; c < 2; c++) {
+      float t1 = (children[c].bounds[ray.sign[dim]][dim] - ray.start[dim]) * ray.inverse[dim];
+      float t2 = (children[c].bounds[1 - ray.sign[dim]][dim] - ray.start[dim]) * ray.inverse[dim];
+      tnear[c] = (t1 > tnear[c]) ? t1 : tnear[c];
+      tfar[c] = (t2 < tfar[c]) ? t2 : tfar[c];
+    }
+  }
+  for (int c = 0; c < 2; c++) {
+    t[c] = tnear[c];
+    hit[c] = tnear[c] <= tfar[c] * (1 + 4 * FLT_EPSILON);
+  }
+}
+
+
+
+static bool
+IntersectTriangle(const R3Ray& ray, const R3Point *p, double tmax, double *t)
+{
+  // Find barycentric coordinates of the ray's crossing of the triangle's
+  // plane (either side of the triangle is hit)
+  const R3Vector& d = ray.Vector();
+  R3Vector e1 = p[1] - p[0];
+  R3Vector e2 = p[2] - p[0];
+  R3Vector pv = d % e2;
+  double det = e1.Dot(pv);
+  if (det == 0) return false;
+  double inverse = 1 / det;
+  R3Vector tv = ray.Start() - p[0];
+  double u = tv.Dot(pv) * inverse;
+  if ((u < 0) || (u > 1)) return false;
+  R3Vector qv = tv % e1;
+  double v = d.Dot(qv) * inverse;
+  if ((v < 0) || (u + v > 1)) return false;
+
+  // Check distance along the ray
+  double s = e2.Dot(qv) * inverse;
+  if ((s < 0) || (s >= tmax)) return false;
+  *t = s;
+  return true;
+}
+
+
+
+bool R3MeshBVH::
+Intersect(const R3Ray& ray, R3MeshBVHHit *hit, double tmax) const
+{
+  // Check hierarchy
+  if (nodes.empty()) return false;
+
+  // Visit nodes whose boxes the ray enters before the closest hit so far,
+  // nearer child first (the root is visited as if it were a child)
+  R3MeshBVHRay box_ray(ray);
+  int hit_item = -1;
+  double hit_t = tmax;
+  int stack[R3_MESH_BVH_MAX_DEPTH + 2];
+  int nstack = 0;
+  stack[nstack++] = 0;
+  while (nstack > 0) {
+    const R3MeshBVHNode& node = nodes[stack[--nstack]];
+    if (node.count > 0) {
+      // Intersect the triangles of a leaf
+      for (int i = node.first; i < node.first + node.count; i++) {
+        R3Point p[3];
+        double t;
+        ItemPoints(items[i], p);
+        if (IntersectTriangle(ray, p, hit_t, &t)) { hit_t = t; hit_item = i; }
+      }
+    }
+    else {
+      // Push children the ray enters, the nearer one last
+      float t[2];
+      bool enters[2];
+      IntersectChildren(&nodes[node.first], box_ray, (float) hit_t, t, enters);
+      int nearer = (t[1] < t[0]) ? 1 : 0;
+      if (enters[1 - nearer]) stack[nstack++] = node.first + 1 - nearer;
+      if (enters[nearer]) stack[nstack++] = node.first + nearer;
+    }
+  }
+
+  // Check for hit
+  if (hit_item < 0) return false;
+
+  // Fill in the element that was hit
+  if (hit) {
+    ElementHit(items[hit_item].element, hit);
+    hit->position = ray.Point(hit_t);
+    hit->t = hit_t;
+  }
+
+  // Return hit
+  return true;
+}
+
+
+
+bool R3MeshBVH::
+IntersectAny(const R3Ray& ray, double tmax) const
+{
+  // Check hierarchy
+  if (nodes.empty()) return false;
+
+  // Visit nodes whose boxes the ray enters, until any triangle is hit
+  R3MeshBVHRay box_ray(ray);
+  int stack[R3_MESH_BVH_MAX_DEPTH + 2];
+  int nstack = 0;
+  stack[nstack++] = 0;
+  while (nstack > 0) {
+    const R3MeshBVHNode& node = nodes[stack[--nstack]];
+    if (node.count > 0) {
+      // Intersect the triangles of a leaf
+      for (int i = node.first; i < node.first + node.count; i++) {
+        R3Point p[3];
+        double t;
+        ItemPoints(items[i], p);
+        if (IntersectTriangle(ray, p, tmax, &t)) return true;
+      }
+    }
+    else {
+      // Push children the ray enters
+      float t[2];
+      bool enters[2];
+      IntersectChildren(&nodes[node.first], box_ray, (float) tmax, t, enters);
+      if (enters[1]) stack[nstack++] = node.first + 1;
+      if (enters[0]) stack[nstack++] = node.first;
+    }
+  }
+
+  // Return no hit
+  return false;
+}
+
+
+
+////////////////////////////////////////////////////////////
+// MESH BVH BOX QUERIES
+////////////////////////////////////////////////////////////
+
+static bool
+SeparatingAxis(const R3Vector *v, const R3Vector& half, const R3Vector& axis)
+{
+  // Return whether the triangle and the box (both centered at the
+  // origin) project onto the axis without overlapping
+  double p0 = v[0].Dot(axis), p1 = v[1].Dot(axis), p2 = v[2].Dot(axis);
+  double r = half[0] * fabs(axis[0]) + half[1] * fabs(axis[1]) + half[2] * fabs(axis[2]);
+  return (std::min(p0, std::min(p1, p2)) > r) || (std::max(p0, std::max(p1, p2)) < -r);
+}
+
+
+
+static bool
+TriangleOverlapsBox(const R3Point *p, const R3Box& box)
+{
+  // Move the triangle so that the box is centered at the origin
+  R3Point center = box.Centroid();
+  R3Vector half = 0.5 * (box.Max() - box.Min());
+  R3Vector v[3] = { p[0] - center, p[1] - center, p[2] - center };
+
+  // Look for a separating axis among the box axes, the triangle normal,
+  // and the cross products of box axes with triangle edges
+  R3Vector edges[3] = { v[1] - v[0], v[2] - v[1], v[0] - v[2] };
+  const R3Vector box_axes[3] = { R3posx_vector, R3posy_vector, R3posz_vector };
+  for (int i = 0; i < 3; i++) {
+    if (SeparatingAxis(v, half, box_axes[i])) return false;
+  }
+  if (SeparatingAxis(v, half, edges[0] % edges[1])) return false;
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      if (SeparatingAxis(v, half, box_axes[i] % edges[j])) return false;
+    }
+  }
+
+  // Return overlap
+  return true;
+}
+
+
+
+int R3MeshBVH::
+FindElements(const R3Box& box, vector<int>& elements) const
+{
+  // Check hierarchy and box
+  if (nodes.empty() || box.IsEmpty()) return 0;
+
+  // Visit nodes whose boxes overlap the box
+  vector<int> found;
+  int stack[R3_MESH_BVH_MAX_DEPTH + 2];
+  int nstack = 0;
+  stack[nstack++] = 0;
+  while (nstack > 0) {
+    const R3MeshBVHNode& node = nodes[stack[--nstack]];
+    bool overlaps = true;
+    for (int dim = 0; dim < 3; dim++) {
+      if ((node.bounds[1][dim] < box[0][dim]) || (node.bounds[0][dim] > box[1][dim])) overlaps = false;
+    }
+    if (!overlaps) continue;
+    if (node.count > 0) {
+      // Test the triangles of a leaf
+      for (int i = node.first; i < node.first + node.count; i++) {
+        R3Point p[3];
+        ItemPoints(items[i], p);
+        if (TriangleOverlapsBox(p, box)) found.push_back(items[i].element);
+      }
+    }
+    else {
+      // Push children
+      stack[nstack++] = node.first + 1;
+      stack[nstack++] = node.first;
+    }
+  }
+
+  // Append each element once (a face may have several triangles)
+  std::sort(found.begin(), found.end());
+  found.erase(std::unique(found.begin(), found.end()), found.end());
+  elements.insert(elements.end(), found.begin(), found.end());
+  return found.size();
+}
+
+
+
+////////////////////////////////////////////////////////////
+// MESH BVH POINT QUERIES
+////////////////////////////////////////////////////////////
+
+static R3Point
+ClosestPointOnTriangle(const R3Point& point, const R3Point *p)
+{
+  // Check if point is closest to the first corner
+  R3Vector ab = p[1] - p[0], ac = p[2] - p[0], ap = point - p[0];
+  double d1 = ab.Dot(ap), d2 = ac.Dot(ap);
+  if ((d1 <= 0) && (d2 <= 0)) return p[0];
+
+  // Check if point is closest to the second corner
+  R3Vector bp = point - p[1];
+  double d3 = ab.Dot(bp), d4 = ac.Dot(bp);
+  if ((d3 >= 0) && (d4 <= d3)) return p[1];
+
+  // Check if point is closest to the first edge
+  double vc = d1 * d4 - d3 * d2;
+  if ((vc <= 0) && (d1 >= 0) && (d3 <= 0)) return p[0] + ab * (d1 / (d1 - d3));
+
+  // Check if point is closest to the third corner
+  R3Vector cp = point - p[2];
+  double d5 = ab.Dot(cp), d6 = ac.Dot(cp);
+  if ((d6 >= 0) && (d5 <= d6)) return p[2];
+
+  // Check if point is closest to the second edge
+  double vb = d5 * d2 - d1 * d6;
+  if ((vb <= 0) && (d2 >= 0) && (d6 <= 0)) return p[0] + ac * (d2 / (d2 - d6));
+
+  // Check if point is closest to the third edge
+  double va = d3 * d6 - d5 * d4;
+  if ((va <= 0) && ((d4 - d3) >= 0) && ((d5 - d6) >= 0)) {
+    return p[1] + (p[2] - p[1]) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+  }
+
+  // Point is closest to the inside of the triangle
+  double denom = 1 / (va + vb + vc);
+  return p[0] + ab * (vb * denom) + ac * (vc * denom);
+}
+
+
+
+bool R3MeshBVH::
+FindClosest(const R3Point& point, R3MeshBVHHit *hit, double dmax) const
+{
+  // Check hierarchy
+  if (nodes.empty()) return false;
+
+  // Visit nodes closer than the closest point so far, nearer child first
+  int closest_item = -1;
+  R3Point closest_point;
+  double closest_d2 = (dmax < FLT_MAX) ? dmax * dmax : DBL_MAX;
+  int stack[R3_MESH_BVH_MAX_DEPTH + 2];
+  int nstack = 0;
+  if (BoundsDistanceSquared(nodes[0].bounds, point) <= closest_d2) stack[nstack++] = 0;
+  while (nstack > 0) {
+    const R3MeshBVHNode& node = nodes[stack[--nstack]];
+    if (BoundsDistanceSquared(node.bounds, point) > closest_d2) continue;
+    if (node.count > 0) {
+      // Find closest points on the triangles of a leaf
+      for (int i = node.first; i < node.first + node.count; i++) {
+        R3Point p[3];
+        ItemPoints(items[i], p);
+        R3Point q = ClosestPointOnTriangle(point, p);
+        double d2 = (q - point).Dot(q - point);
+        if (d2 <= closest_d2) { closest_d2 = d2; closest_point = q; closest_item = i; }
+      }
+    }
+    else {
+      // Push children that are close enough, the nearer one last
+      double d0 = BoundsDistanceSquared(nodes[node.first].bounds, point);
+      double d1 = BoundsDistanceSquared(nodes[node.first + 1].bounds, point);
+      int nearer = (d1 < d0) ? 1 : 0;
+      if (((nearer) ? d0 : d1) <= closest_d2) stack[nstack++] = node.first + 1 - nearer;
+      if (((nearer) ? d1 : d0) <= closest_d2) stack[nstack++] = node.first + nearer;
+    }
+  }
+
+  // Check for closest point
+  if (closest_item < 0) return false;
+
+  // Fill in the closest element
+  if (hit) {
+    ElementHit(items[closest_item].element, hit);
+    hit->position = closest_point;
+    hit->t = sqrt(closest_d2);
+  }
+
+  // Return success
+  return true;
+}
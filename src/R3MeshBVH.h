@@ -0,0 +1,135 @@
+#ifndef R3MESHBVH_H
+#define R3MESHBVH_H
+// Include file for bounding volume hierarchies over mesh faces
+//
+// A BVH holds every face, triangle and packed triangle of a mesh (faces
+// split into fans of triangles) in a binary tree of bounding boxes, so
+// that queries visit only the few boxes near what they are looking for.
+// It is built top-down with the surface area heuristic, choosing each
+// split among a few bins of triangle centroids, one level of the tree at
+// a time with the nodes of a level divided among the threads of a pool.
+// The nodes are kept in one array with single precision bounds (rounded
+// outwards), with the two children of an interior node next to each
+// other.
+//
+// The BVH refers to the mesh.  After vertices move (for example with
+// Translate, Scale, Rotate or Twist), Refit updates the bounds without
+// changing the tree.  After elements are created or deleted, it must be
+// built again.
+//
+// Elements are numbered faces first, then triangles, then packed
+// triangles.
+
+
+
+////////////////////////////////////////////////////////////
+// DEPENDENCY INCLUDE FILES
+////////////////////////////////////////////////////////////
+
+#include "R3Mesh.h"
+#include "R3ThreadPool.h"
+#include <cfloat>
+
+
+
+////////////////////////////////////////////////////////////
+// MESH BVH DECLARATION
+////////////////////////////////////////////////////////////
+
+// One triangle of a mesh element (corner is the fan triangle of a face)
+struct R3MeshBVHItem {
+  int element;
+  int corner;
+};
+
+// A node is a leaf if count is not zero, with items [first, first+count),
+// otherwise its children are nodes first and first+1 (bounds[0] is the
+// minimum corner and bounds[1] the maximum corner)
+struct R3MeshBVHNode {
+  float bounds[2][3];
+  int first;
+  int count;
+};
+
+// The element found by a query (exactly one of face, triangle and
+// packed_triangle is set), the point found on it, and how far it is
+// along the ray or from the query point
+struct R3MeshBVHHit {
+  R3MeshFace *face;
+  int triangle;
+  int packed_triangle;
+  int element;
+  R3Point position;
+  double t;
+};
+
+struct R3MeshBVH {
+  // Constructors (with no pool, one is made for the build)
+  R3MeshBVH(R3Mesh *mesh=NULL, R3ThreadPool *pool=NULL);
+
+  // Property functions
+  int NNodes(void) const;
+  int NItems(void) const;
+  R3Box BBox(void) const;
+
+  // Construction functions
+  void Build(R3Mesh *mesh, R3ThreadPool *pool=NULL);
+  void Refit(R3ThreadPool *pool=NULL);
+
+  // Ray queries (the first element hit within tmax of the ray start,
+  // or whether any element is)
+  bool Intersect(const R3Ray& ray, R3MeshBVHHit *hit, double tmax=FLT_MAX) const;
+  bool IntersectAny(const R3Ray& ray, double tmax=FLT_MAX) const;
+
+  // Box query (appends every element that overlaps the box, once each,
+  // and returns how many)
+  int FindElements(const R3Box& box, vector<int>& elements) const;
+
+  // Point query (the closest point on any element within dmax of point)
+  bool FindClosest(const R3Point& point, R3MeshBVHHit *hit, double dmax=FLT_MAX) const;
+
+  // Item functions
+  void ItemPoints(const R3MeshBVHItem& item, R3Point *points) const;
+  void ElementHit(int element, R3MeshBVHHit *hit) const;
+  void FitLeaf(int node);
+
+  // Data
+  R3Mesh *mesh;
+  vector<R3MeshBVHItem> items;
+  vector<R3MeshBVHNode> nodes;
+};
+
+// Build parameters (leaves have at most LEAF_SIZE items, unless
+// splitting them costs more, up to MAX_LEAF_SIZE; each split is chosen
+// among BINS bins on each axis; the depth is limited, so that queries
+// need only a small stack)
+#define R3_MESH_BVH_LEAF_SIZE 4
+#define R3_MESH_BVH_MAX_LEAF_SIZE 16
+#define R3_MESH_BVH_BINS 16
+#define R3_MESH_BVH_MAX_DEPTH 64
+
+
+
+////////////////////////////////////////////////////////////
+// MESH BVH INLINE FUNCTIONS
+////////////////////////////////////////////////////////////
+
+inline int R3MeshBVH::
+NNodes(void) const
+{
+  // Return number of nodes
+  return nodes.size();
+}
+
+
+
+inline int R3MeshBVH::
+NItems(void) const
+{
+  // Return number of triangles
+  return items.size();
+}
+
+
+
+#endif
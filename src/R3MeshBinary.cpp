@@ -0,0 +1,365 @@
+// Source file for binary mesh files (.offb)
+
+
+
+// Include files
+
+#include "R3MeshBinary.h"
+
+
+
+////////////////////////////////////////////////////////////
+// BYTE ORDER UTILITY FUNCTIONS
+////////////////////////////////////////////////////////////
+
+static const char R3mesh_binary_magic[8] = { 'L', '3', 'D', 'M', 'E', 'S', 'H', '\0' };
+
+
+
+static bool
+HostIsLittleEndian(void)
+{
+  // Return whether numbers are stored little endian on this machine
+  unsigned int one = 1;
+  return *((unsigned char *) &one) == 1;
+}
+
+
+
+static void
+SwapWords(void *words, size_t nwords, size_t word_size)
+{
+  // Reverse the byte order of every word in an array
+  unsigned char *p = (unsigned char *) words;
+  for (size_t i = 0; i < nwords; i++, p += word_size) {
+    for (size_t j = 0; j < word_size / 2; j++) {
+      unsigned char tmp = p[j];
+      p[j] = p[word_size-1-j];
+      p[word_size-1-j] = tmp;
+    }
+  }
+}
+
+
+
+static void
+SwapHeader(R3MeshBinaryHeader *header)
+{
+  // Reverse the byte order of the numbers in a header
+  SwapWords(&header->version, 6, 4);
+  SwapWords(&header->positions, 8, 8);
+}
+
+
+
+static unsigned long long
+AlignOffset(unsigned long long offset)
+{
+  // Round up to the start of the next section
+  return (offset + R3_MESH_BINARY_ALIGNMENT - 1) / R3_MESH_BINARY_ALIGNMENT * R3_MESH_BINARY_ALIGNMENT;
+}
+
+
+
+////////////////////////////////////////////////////////////
+// BINARY MESH FILE MEMBER FUNCTIONS
+////////////////////////////////////////////////////////////
+
+R3MeshBinary::
+R3MeshBinary(void)
+: copy(NULL),
+data(NULL),
+size(0)
+{
+  memset(&header, 0, sizeof(header));
+}
+
+
+
+R3MeshBinary::
+~R3MeshBinary(void)
+{
+  // Unmap file
+  Close();
+}
+
+
+
+int R3MeshBinary::
+Open(const char *filename)
+{
+  // Map file into memory
+  Close();
+  if (!file.Open(filename)) return 0;
+  data = file.data;
+  size = file.size;
+
+  // Read header
+  if (size < sizeof(header)) {
+    fprintf(stderr, "File %s is too small for a binary mesh\n", filename);
+    Close();
+    return 0;
+  }
+  memcpy(&header, data, sizeof(header));
+  bool swap = !HostIsLittleEndian();
+  if (swap) SwapHeader(&header);
+
+  // Check header
+  if (memcmp(header.magic, R3mesh_binary_magic, sizeof(header.magic)) || (header.version != R3_MESH_BINARY_VERSION)) {
+    fprintf(stderr, "File %s is not a version %d binary mesh\n", filename, R3_MESH_BINARY_VERSION);
+    Close();
+    return 0;
+  }
+
+  // Check that every section is aligned and inside the file
+  unsigned long long nv = header.nvertices;
+  unsigned long long sections[7][2] = {
+    { header.positions, 12 * nv },
+    { header.normals, (HasNormals()) ? 12 * nv : 0 },
+    { header.tangents, (HasTangents()) ? 12 * nv : 0 },
+    { header.texcoords, 8 * nv },
+    { header.indices, 4ULL * header.nindices },
+    { header.face_offsets, 4ULL * header.nfaces + 4 },
+    { header.leaf_flags, header.nfaces }
+  };
+  for (int i = 0; i < 7; i++) {
+    if (sections[i][1] == 0) continue;
+    if ((sections[i][0] % 4) || (sections[i][0] > size) || (sections[i][1] > size - sections[i][0])) {
+      fprintf(stderr, "Section %d is outside binary mesh file %s\n", i, filename);
+      Close();
+      return 0;
+    }
+  }
+
+  // On big endian machines, work on a byte swapped copy
+  if (swap) {
+    copy = (unsigned char *) malloc(size);
+    if (!copy) {
+      fprintf(stderr, "Unable to allocate memory for file %s\n", filename);
+      Close();
+      return 0;
+    }
+    memcpy(copy, data, size);
+    for (int i = 0; i < 6; i++) {
+      if (sections[i][1] > 0) SwapWords(copy + sections[i][0], sections[i][1] / 4, 4);
+    }
+    data = copy;
+    file.Close();
+  }
+
+  // Return success
+  return 1;
+}
+
+
+
+void R3MeshBinary::
+Close(void)
+{
+  // Release file data
+  file.Close();
+  if (copy) free(copy);
+
+  // Reset data
+  copy = NULL;
+  data = NULL;
+  size = 0;
+  memset(&header, 0, sizeof(header));
+}
+
+
+
+////////////////////////////////////////////////////////////
+// MESH BINARY FILE INPUT/OUTPUT
+////////////////////////////////////////////////////////////
+
+int R3Mesh::
+ReadBinary(const char *filename)
+{
+  // Map file
+  R3MeshBinary file;
+  if (!file.Open(filename)) return 0;
+
+  // Check vertex ids and face offsets, so they can be trusted below
+  int nvertices = file.NVertices();
+  int nfaces = file.NFaces();
+  const unsigned int *indices = file.Indices();
+  const unsigned int *offsets = file.FaceOffsets();
+  for (int i = 0; i < file.NIndices(); i++) {
+    if (indices[i] >= (unsigned int) nvertices) {
+      fprintf(stderr, "Invalid vertex id %u in file %s\n", indices[i], filename);
+      return 0;
+    }
+  }
+  for (int i = 0; i < nfaces; i++) {
+    unsigned int face_nverts = offsets[i+1] - offsets[i];
+    if ((offsets[i+1] < offsets[i]) || (file.IsTriangles() && (face_nverts != 3))) {
+      fprintf(stderr, "Invalid offset for face %d in file %s\n", i, filename);
+      return 0;
+    }
+  }
+  if ((offsets[0] != 0) || (offsets[nfaces] != (unsigned int) file.NIndices())) {
+    fprintf(stderr, "Invalid face offsets in file %s\n", filename);
+    return 0;
+  }
+
+  // Create vertices
+  vertices.reserve(vertices.size() + nvertices);
+  const float *p = file.Positions();
+  const float *n = file.Normals();
+  const float *t = file.Tangents();
+  const float *uv = file.TexCoords();
+  int first = NVertices();
+  for (int i = 0; i < nvertices; i++) {
+    R3Vector normal = (n) ? R3Vector(n[3*i], n[3*i+1], n[3*i+2]) : R3zero_vector;
+    R3MeshVertex *vertex = CreateVertex(R3Point(p[3*i], p[3*i+1], p[3*i+2]), normal, R2Point(uv[2*i], uv[2*i+1]));
+    if (t) vertex->tangent.Reset(t[3*i], t[3*i+1], t[3*i+2]);
+  }
+
+  // Create faces
+  CreateFaces(indices, offsets, file.LeafFlags(), nfaces, first);
+
+  // Return number of faces read
+  return nfaces;
+}
+
+
+
+static void
+WriteSection(FILE *fp, const void *words, size_t nwords, size_t word_size, unsigned long long *offset)
+{
+  // Write an array of numbers in little endian order
+  if (HostIsLittleEndian() || (word_size == 1)) {
+    fwrite(words, word_size, nwords, fp);
+  }
+  else {
+    vector<unsigned char> swapped((const unsigned char *) words, (const unsigned char *) words + nwords * word_size);
+    SwapWords(swapped.data(), nwords, word_size);
+    fwrite(swapped.data(), word_size, nwords, fp);
+  }
+
+  // Pad to the start of the next section
+  *offset += nwords * word_size;
+  static const char zeros[R3_MESH_BINARY_ALIGNMENT] = { 0 };
+  unsigned long long next = AlignOffset(*offset);
+  fwrite(zeros, 1, next - *offset, fp);
+  *offset = next;
+}
+
+
+
+int R3Mesh::
+WriteBinary(const char *filename)
+{
+  // Open file
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) {
+    fprintf(stderr, "Unable to open file %s\n", filename);
+    return 0;
+  }
+
+  // Check which attributes there are
+  unsigned int flags = 0;
+  if (HasVertexNormals()) flags |= R3_MESH_BINARY_NORMALS;
+  for (int i = 0; i < NVertices(); i++) {
+    if (!Vertex(i)->tangent.IsZero()) { flags |= R3_MESH_BINARY_TANGENTS; break; }
+  }
+
+  // Count face vertex indices
+  unsigned long long nfaces = NWrittenFaces();
+  unsigned long long nindices = 3ULL * (NPackedTriangles() + NTriangles());
+  bool all_triangles = true;
+  for (int i = 0; i < NFaces(); i++) {
+    nindices += Face(i)->vertices.size();
+    if (Face(i)->vertices.size() != 3) all_triangles = false;
+  }
+  if (all_triangles) flags |= R3_MESH_BINARY_TRIANGLES;
+  unsigned long long nv = NWrittenVertices();
+
+  // Lay out sections
+  R3MeshBinaryHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, R3mesh_binary_magic, sizeof(header.magic));
+  header.version = R3_MESH_BINARY_VERSION;
+  header.flags = flags;
+  header.nvertices = nv;
+  header.nfaces = nfaces;
+  header.nindices = nindices;
+  unsigned long long offset = AlignOffset(sizeof(header));
+  header.positions = offset; offset = AlignOffset(offset + 12 * nv);
+  if (flags & R3_MESH_BINARY_NORMALS) { header.normals = offset; offset = AlignOffset(offset + 12 * nv); }
+  if (flags & R3_MESH_BINARY_TANGENTS) { header.tangents = offset; offset = AlignOffset(offset + 12 * nv); }
+  header.texcoords = offset; offset = AlignOffset(offset + 8 * nv);
+  header.indices = offset; offset = AlignOffset(offset + 4 * nindices);
+  header.face_offsets = offset; offset = AlignOffset(offset + 4 * (nfaces + 1));
+  header.leaf_flags = offset; offset = AlignOffset(offset + nfaces);
+  header.size = offset;
+
+  // Write header
+  offset = 0;
+  R3MeshBinaryHeader file_header = header;
+  if (!HostIsLittleEndian()) SwapHeader(&file_header);
+  WriteSection(fp, &file_header, sizeof(file_header), 1, &offset);
+
+  // Write vertex attributes
+  for (int i = 0; i < NVertices(); i++) Vertex(i)->id = i;
+  vector<float> values;
+  values.reserve(3 * nv);
+  for (int i = 0; i < (int) nv; i++) {
+    R3Point p = WrittenPosition(i);
+    values.push_back(p.X()); values.push_back(p.Y()); values.push_back(p.Z());
+  }
+  WriteSection(fp, values.data(), values.size(), 4, &offset);
+  if (flags & R3_MESH_BINARY_NORMALS) {
+    values.clear();
+    for (int i = 0; i < (int) nv; i++) {
+      R3Vector n = WrittenNormal(i);
+      values.push_back(n.X()); values.push_back(n.Y()); values.push_back(n.Z());
+    }
+    WriteSection(fp, values.data(), values.size(), 4, &offset);
+  }
+  if (flags & R3_MESH_BINARY_TANGENTS) {
+    values.clear();
+    for (int i = 0; i < (int) nv; i++) {
+      R3Vector t = WrittenTangent(i);
+      values.push_back(t.X()); values.push_back(t.Y()); values.push_back(t.Z());
+    }
+    WriteSection(fp, values.data(), values.size(), 4, &offset);
+  }
+  values.clear();
+  for (int i = 0; i < (int) nv; i++) {
+    R2Point t = WrittenTexCoords(i);
+    values.push_back(t.X()); values.push_back(t.Y());
+  }
+  WriteSection(fp, values.data(), values.size(), 4, &offset);
+  vector<float>().swap(values);
+
+  // Write faces (packed triangles, faces, then triangles)
+  vector<unsigned int> indices;
+  vector<unsigned int> offsets;
+  vector<unsigned char> leaf;
+  indices.reserve(nindices);
+  offsets.reserve(nfaces + 1);
+  leaf.reserve(nfaces);
+  offsets.push_back(0);
+  for (int i = 0; i < (int) nfaces; i++) {
+    int face_nverts = NWrittenFaceVertices(i);
+    for (int j = 0; j < face_nverts; j++) indices.push_back(WrittenFaceVertex(i, j));
+    offsets.push_back(indices.size());
+    leaf.push_back(IsLeafWrittenFace(i));
+  }
+  WriteSection(fp, indices.data(), indices.size(), 4, &offset);
+  WriteSection(fp, offsets.data(), offsets.size(), 4, &offset);
+  WriteSection(fp, leaf.data(), leaf.size(), 1, &offset);
+
+  // Close file
+  int status = !ferror(fp);
+  if (fclose(fp)) status = 0;
+  if (!status) {
+    fprintf(stderr, "Unable to write file %s\n", filename);
+    return 0;
+  }
+
+  // Return number of faces written
+  return nfaces;
+}
@@ -0,0 +1,217 @@
+#ifndef R3MESHBINARY_H
+#define R3MESHBINARY_H
+// Include file for binary mesh files (.offb)
+//
+// A binary mesh file is the Off+ data laid out as arrays that can be used
+// in place once the file is mapped into memory.  It has a fixed 128-byte
+// header followed by sections, each starting at a multiple of 64 bytes:
+//
+//   positions      float[3*nvertices]
+//   normals        float[3*nvertices]   (if R3_MESH_BINARY_NORMALS)
+//   tangents       float[3*nvertices]   (if R3_MESH_BINARY_TANGENTS)
+//   texcoords      float[2*nvertices]
+//   indices        uint32[nindices]     (vertex ids of all faces)
+//   face offsets   uint32[nfaces+1]     (start of each face in indices)
+//   leaf flags     uint8[nfaces]
+//
+// All numbers are little endian.
+
+
+
+////////////////////////////////////////////////////////////
+// DEPENDENCY INCLUDE FILES
+////////////////////////////////////////////////////////////
+
+#include "R3Mesh.h"
+#include "R3MappedFile.h"
+
+
+
+////////////////////////////////////////////////////////////
+// BINARY MESH FILE DECLARATION
+////////////////////////////////////////////////////////////
+
+#define R3_MESH_BINARY_VERSION 1
+#define R3_MESH_BINARY_ALIGNMENT 64
+
+#define R3_MESH_BINARY_NORMALS   0x1
+#define R3_MESH_BINARY_TANGENTS  0x2
+#define R3_MESH_BINARY_TRIANGLES 0x4
+
+struct R3MeshBinaryHeader {
+  char magic[8];
+  unsigned int version;
+  unsigned int flags;
+  unsigned int nvertices;
+  unsigned int nfaces;
+  unsigned int nindices;
+  unsigned int reserved;
+  unsigned long long positions;
+  unsigned long long normals;
+  unsigned long long tangents;
+  unsigned long long texcoords;
+  unsigned long long indices;
+  unsigned long long face_offsets;
+  unsigned long long leaf_flags;
+  unsigned long long size;
+  char padding[32];
+};
+
+struct R3MeshBinary {
+  // Constructors
+  R3MeshBinary(void);
+  ~R3MeshBinary(void);
+
+  // File functions (the file stays mapped until closed)
+  int Open(const char *filename);
+  void Close(void);
+
+  // Property functions
+  int NVertices(void) const;
+  int NFaces(void) const;
+  int NIndices(void) const;
+  bool HasNormals(void) const;
+  bool HasTangents(void) const;
+  bool IsTriangles(void) const;
+
+  // Array access functions (valid while the file is open)
+  const float *Positions(void) const;
+  const float *Normals(void) const;
+  const float *Tangents(void) const;
+  const float *TexCoords(void) const;
+  const unsigned int *Indices(void) const;
+  const unsigned int *FaceOffsets(void) const;
+  const unsigned char *LeafFlags(void) const;
+
+  // Data
+  R3MeshBinaryHeader header;
+  R3MappedFile file;
+  unsigned char *copy;
+  const unsigned char *data;
+  size_t size;
+};
+
+
+
+////////////////////////////////////////////////////////////
+// BINARY MESH FILE INLINE FUNCTIONS
+////////////////////////////////////////////////////////////
+
+inline int R3MeshBinary::
+NVertices(void) const
+{
+  // Return number of vertices in file
+  return header.nvertices;
+}
+
+
+
+inline int R3MeshBinary::
+NFaces(void) const
+{
+  // Return number of faces in file
+  return header.nfaces;
+}
+
+
+
+inline int R3MeshBinary::
+NIndices(void) const
+{
+  // Return number of face vertex indices in file
+  return header.nindices;
+}
+
+
+
+inline bool R3MeshBinary::
+HasNormals(void) const
+{
+  // Return whether file has vertex normals
+  return header.flags & R3_MESH_BINARY_NORMALS;
+}
+
+
+
+inline bool R3MeshBinary::
+HasTangents(void) const
+{
+  // Return whether file has vertex tangents
+  return header.flags & R3_MESH_BINARY_TANGENTS;
+}
+
+
+
+inline bool R3MeshBinary::
+IsTriangles(void) const
+{
+  // Return whether every face is a triangle
+  return header.flags & R3_MESH_BINARY_TRIANGLES;
+}
+
+
+
+inline const float *R3MeshBinary::
+Positions(void) const
+{
+  // Return x,y,z for every vertex
+  return (const float *) (data + header.positions);
+}
+
+
+
+inline const float *R3MeshBinary::
+Normals(void) const
+{
+  // Return nx,ny,nz for every vertex (or NULL)
+  return (HasNormals()) ? (const float *) (data + header.normals) : NULL;
+}
+
+
+
+inline const float *R3MeshBinary::
+Tangents(void) const
+{
+  // Return tx,ty,tz for every vertex (or NULL)
+  return (HasTangents()) ? (const float *) (data + header.tangents) : NULL;
+}
+
+
+
+inline const float *R3MeshBinary::
+TexCoords(void) const
+{
+  // Return u,v for every vertex
+  return (const float *) (data + header.texcoords);
+}
+
+
+
+inline const unsigned int *R3MeshBinary::
+Indices(void) const
+{
+  // Return vertex ids of all faces, one face after another
+  return (const unsigned int *) (data + header.indices);
+}
+
+
+
+inline const unsigned int *R3MeshBinary::
+FaceOffsets(void) const
+{
+  // Return start of each face in the indices (plus the end of the last)
+  return (const unsigned int *) (data + header.face_offsets);
+}
+
+
+
+inline const unsigned char *R3MeshBinary::
+LeafFlags(void) const
+{
+  // Return isLeaf for every face
+  return data + header.leaf_flags;
+}
+
+
+
+#endif
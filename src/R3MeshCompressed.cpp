@@ -0,0 +1,717 @@
+// Source file for compressed mesh files (.offz)
+//
+// A compressed mesh file has an 80-byte header followed by one range coded
+// stream.  Vertex positions are quantized to a grid over the bounding box,
+// texture coordinates to a grid over their range, and normals to an
+// octahedral grid.  Each vertex attribute is predicted from earlier
+// vertices, with the predictor that codes a sample of that attribute
+// smallest, and only the difference is coded.  Face vertex ids are coded as differences
+// from the previous id, which are small because every shape is made of
+// consecutive vertices.  All numbers in the header are little endian.
+
+
+
+// Include files
+
+#include "R3Mesh.h"
+#include "R3MappedFile.h"
+
+
+
+////////////////////////////////////////////////////////////
+// COMPRESSED MESH FILE CONSTANTS
+////////////////////////////////////////////////////////////
+
+static const char R3mesh_compressed_magic[8] = { 'L', '3', 'D', 'M', 'E', 'S', 'H', 'Z' };
+
+#define R3_MESH_COMPRESSED_VERSION 1
+#define R3_MESH_COMPRESSED_HEADER_SIZE 80
+#define R3_MESH_COMPRESSED_NORMALS 0x1
+
+// Grid sizes (bits per component)
+#define R3_MESH_COMPRESSED_POSITION_BITS 16
+#define R3_MESH_COMPRESSED_TEXCOORD_BITS 14
+#define R3_MESH_COMPRESSED_NORMAL_BITS 12
+
+// Predictors are tried on up to this many blocks of this many vertices
+#define R3_MESH_COMPRESSED_SAMPLE_BLOCKS 16
+#define R3_MESH_COMPRESSED_SAMPLE_BLOCK_SIZE 4096
+
+// Limits checked when reading, so a bad header cannot ask for huge arrays
+#define R3_MESH_COMPRESSED_MAX_ELEMENTS (1 << 28)
+#define R3_MESH_COMPRESSED_MAX_FACE_VERTICES (1 << 16)
+
+// Vertex predictors
+enum {
+  R3mesh_no_prediction,      // 0
+  R3mesh_previous_vertex,    // v[i-1]
+  R3mesh_second_vertex,      // v[i-2]
+  R3mesh_second_linear,      // 2*v[i-2] - v[i-4]
+  R3mesh_npredictors
+};
+
+// Vertex attributes
+enum { R3mesh_positions, R3mesh_texcoords, R3mesh_normals, R3mesh_nattributes };
+
+
+
+////////////////////////////////////////////////////////////
+// RANGE CODER
+////////////////////////////////////////////////////////////
+
+// A binary adaptive range coder.  Every coded bit has a probability model
+// that adapts to the bits coded with it, and integers are coded as their
+// bit length followed by the bits below the leading one.
+
+#define R3_MESH_CODER_PROBABILITY_BITS 11
+#define R3_MESH_CODER_ADAPT_SHIFT 5
+#define R3_MESH_CODER_TOP (1U << 24)
+
+struct R3MeshBitModel {
+  R3MeshBitModel(void) : p(1U << (R3_MESH_CODER_PROBABILITY_BITS - 1)) {}
+  unsigned short p;
+};
+
+struct R3MeshIntegerModel {
+  R3MeshBitModel length[64];
+  R3MeshBitModel bits[33][32];
+};
+
+struct R3MeshRangeEncoder {
+  // Constructors
+  R3MeshRangeEncoder(void) : low(0), range(0xFFFFFFFF), cache(0), cache_size(1) {}
+
+  // Coding functions
+  void EncodeBit(R3MeshBitModel& model, int bit);
+  void EncodeInteger(R3MeshIntegerModel& model, long long value);
+  void Finish(void);
+  void ShiftLow(void);
+
+  // Data
+  vector<unsigned char> bytes;
+  unsigned long long low;
+  unsigned int range;
+  unsigned char cache;
+  unsigned long long cache_size;
+};
+
+struct R3MeshRangeDecoder {
+  // Constructors
+  R3MeshRangeDecoder(const unsigned char *data, size_t size);
+
+  // Coding functions
+  int DecodeBit(R3MeshBitModel& model);
+  long long DecodeInteger(R3MeshIntegerModel& model);
+  unsigned char NextByte(void);
+
+  // Data
+  const unsigned char *data;
+  size_t size;
+  size_t position;
+  unsigned int range;
+  unsigned int code;
+  bool overrun;
+};
+
+
+
+void R3MeshRangeEncoder::
+EncodeBit(R3MeshBitModel& model, int bit)
+{
+  // Split range by probability of a zero, and adapt the probability
+  unsigned int bound = (range >> R3_MESH_CODER_PROBABILITY_BITS) * model.p;
+  if (!bit) {
+    range = bound;
+    model.p += ((1U << R3_MESH_CODER_PROBABILITY_BITS) - model.p) >> R3_MESH_CODER_ADAPT_SHIFT;
+  }
+  else {
+    low += bound;
+    range -= bound;
+    model.p -= model.p >> R3_MESH_CODER_ADAPT_SHIFT;
+  }
+
+  // Output bytes that are settled
+  while (range < R3_MESH_CODER_TOP) {
+    range <<= 8;
+    ShiftLow();
+  }
+}
+
+
+
+void R3MeshRangeEncoder::
+ShiftLow(void)
+{
+  // Output the top byte of low, unless a carry may still change it
+  if (((unsigned int) low < 0xFF000000U) || ((low >> 32) != 0)) {
+    unsigned char carry = (unsigned char) (low >> 32);
+    unsigned char byte = cache;
+    do {
+      bytes.push_back(byte + carry);
+      byte = 0xFF;
+    } while (--cache_size != 0);
+    cache = (unsigned char) ((unsigned int) low >> 24);
+  }
+  cache_size++;
+  low = (low & 0x00FFFFFF) << 8;
+}
+
+
+
+void R3MeshRangeEncoder::
+EncodeInteger(R3MeshIntegerModel& model, long long value)
+{
+  // Map signed values to unsigned ones (0, -1, 1, -2, ... to 0, 1, 2, 3, ...)
+  unsigned long long u = (value < 0) ? ((unsigned long long) (-(value + 1)) << 1) | 1 : (unsigned long long) value << 1;
+
+  // Code the bit length with a bit tree
+  int length = 0;
+  while ((length < 33) && ((u >> length) != 0)) length++;
+  for (int i = 5, node = 1; i >= 0; i--) {
+    int bit = (length >> i) & 1;
+    EncodeBit(model.length[node], bit);
+    node = (node << 1) | bit;
+  }
+
+  // Code the bits below the leading one
+  for (int i = length - 2; i >= 0; i--) {
+    EncodeBit(model.bits[length][i], (u >> i) & 1);
+  }
+}
+
+
+
+void R3MeshRangeEncoder::
+Finish(void)
+{
+  // Output the rest of low
+  for (int i = 0; i < 5; i++) ShiftLow();
+}
+
+
+
+R3MeshRangeDecoder::
+R3MeshRangeDecoder(const unsigned char *data, size_t size)
+  : data(data), size(size), position(0), range(0xFFFFFFFF), code(0), overrun(false)
+{
+  // Read the first bytes of the code
+  for (int i = 0; i < 5; i++) code = (code << 8) | NextByte();
+}
+
+
+
+unsigned char R3MeshRangeDecoder::
+NextByte(void)
+{
+  // Return next byte of stream (or zero past the end)
+  if (position < size) return data[position++];
+  overrun = true;
+  return 0;
+}
+
+
+
+int R3MeshRangeDecoder::
+DecodeBit(R3MeshBitModel& model)
+{
+  // Find which part of the range the code is in, and adapt the probability
+  int bit;
+  unsigned int bound = (range >> R3_MESH_CODER_PROBABILITY_BITS) * model.p;
+  if (code < bound) {
+    range = bound;
+    model.p += ((1U << R3_MESH_CODER_PROBABILITY_BITS) - model.p) >> R3_MESH_CODER_ADAPT_SHIFT;
+    bit = 0;
+  }
+  else {
+    code -= bound;
+    range -= bound;
+    model.p -= model.p >> R3_MESH_CODER_ADAPT_SHIFT;
+    bit = 1;
+  }
+
+  // Read bytes as the range shrinks
+  while (range < R3_MESH_CODER_TOP) {
+    range <<= 8;
+    code = (code << 8) | NextByte();
+  }
+
+  // Return bit
+  return bit;
+}
+
+
+
+long long R3MeshRangeDecoder::
+DecodeInteger(R3MeshIntegerModel& model)
+{
+  // Decode the bit length
+  int node = 1;
+  for (int i = 0; i < 6; i++) node = (node << 1) | DecodeBit(model.length[node]);
+  int length = node - 64;
+  if (length > 33) { overrun = true; return 0; }
+
+  // Decode the bits below the leading one
+  unsigned long long u = (length > 0) ? 1 : 0;
+  for (int i = length - 2; i >= 0; i--) {
+    u = (u << 1) | DecodeBit(model.bits[length][i]);
+  }
+
+  // Map back to a signed value
+  return (u & 1) ? -(long long) (u >> 1) - 1 : (long long) (u >> 1);
+}
+
+
+
+////////////////////////////////////////////////////////////
+// COMPRESSED MESH UTILITY FUNCTIONS
+////////////////////////////////////////////////////////////
+
+static void
+PutWord(unsigned char *p, unsigned int word)
+{
+  // Store a number little endian
+  for (int i = 0; i < 4; i++) p[i] = (word >> (8 * i)) & 0xFF;
+}
+
+
+
+static unsigned int
+GetWord(const unsigned char *p)
+{
+  // Load a little endian number
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+
+
+static void
+PutFloat(unsigned char *p, float value)
+{
+  // Store a float little endian
+  unsigned int word;
+  memcpy(&word, &value, 4);
+  PutWord(p, word);
+}
+
+
+
+static float
+GetFloat(const unsigned char *p)
+{
+  // Load a little endian float
+  unsigned int word = GetWord(p);
+  float value;
+  memcpy(&value, &word, 4);
+  return value;
+}
+
+
+
+static unsigned int
+Quantize(double value, float min, float max, int bits)
+{
+  // Return the nearest grid point between min and max
+  unsigned int top = (1U << bits) - 1;
+  if (max <= min) return 0;
+  double q = floor((value - min) / ((double) max - min) * top + 0.5);
+  if (q < 0) return 0;
+  if (q > top) return top;
+  return (unsigned int) q;
+}
+
+
+
+static double
+Dequantize(unsigned int q, float min, float max, int bits)
+{
+  // Return the value at a grid point
+  unsigned int top = (1U << bits) - 1;
+  return min + q * (((double) max - min) / top);
+}
+
+
+
+static void
+QuantizeNormal(const R3Vector& normal, int bits, unsigned int *q)
+{
+  // Project the normal onto an octahedron, and unfold it into a square
+  double x = normal.X(), y = normal.Y(), z = normal.Z();
+  double sum = fabs(x) + fabs(y) + fabs(z);
+  x /= sum; y /= sum; z /= sum;
+  if (z < 0) {
+    double fx = (1 - fabs(y)) * ((x < 0) ? -1 : 1);
+    double fy = (1 - fabs(x)) * ((y < 0) ? -1 : 1);
+    x = fx; y = fy;
+  }
+
+  // Quantize square coordinates
+  q[0] = Quantize(x, -1, 1, bits);
+  q[1] = Quantize(y, -1, 1, bits);
+}
+
+
+
+static R3Vector
+DequantizeNormal(const unsigned int *q, int bits)
+{
+  // Fold the square back onto the octahedron, and normalize
+  double x = Dequantize(q[0], -1, 1, bits);
+  double y = Dequantize(q[1], -1, 1, bits);
+  double z = 1 - fabs(x) - fabs(y);
+  if (z < 0) {
+    double fx = (1 - fabs(y)) * ((x < 0) ? -1 : 1);
+    double fy = (1 - fabs(x)) * ((y < 0) ? -1 : 1);
+    x = fx; y = fy;
+  }
+  R3Vector normal(x, y, z);
+  normal.Normalize();
+  return normal;
+}
+
+
+
+static long long
+Predict(const unsigned int *values, int i, int c, int ncomponents, int predictor)
+{
+  // Return component c of vertex i predicted from earlier vertices
+  const unsigned int *v = values + c;
+  if ((predictor == R3mesh_second_linear) && (i >= 4)) {
+    return 2LL * v[(i-2) * ncomponents] - v[(i-4) * ncomponents];
+  }
+  if ((predictor >= R3mesh_second_vertex) && (i >= 2)) return v[(i-2) * ncomponents];
+  if ((predictor >= R3mesh_previous_vertex) && (i >= 1)) return v[(i-1) * ncomponents];
+  return 0;
+}
+
+
+
+static int
+ResidualContext(long long residual)
+{
+  // Return which model codes the next residual, from the size of this one
+  if (residual == 0) return 0;
+  if ((residual > -16) && (residual < 16)) return 1;
+  if ((residual > -256) && (residual < 256)) return 2;
+  return 3;
+}
+
+
+
+static void
+EncodeAttribute(R3MeshRangeEncoder& encoder, unsigned int *values, const unsigned char *zero,
+  int nvertices, int ncomponents, int predictor, int bits)
+{
+  // Code the difference of every component from its prediction, with
+  // models picked by the previous difference of the same component
+  R3MeshIntegerModel models[3][4];
+  R3MeshBitModel zero_models[2];
+  int contexts[3] = { 0, 0, 0 };
+  long long top = (1U << bits) - 1;
+  for (int i = 0; i < nvertices; i++) {
+    if (zero) encoder.EncodeBit(zero_models[(i > 0) ? zero[i-1] : 0], zero[i]);
+    for (int c = 0; c < ncomponents; c++) {
+      long long prediction = Predict(values, i, c, ncomponents, predictor);
+      if (zero && zero[i]) {
+        // Missing normals take the prediction, as when decoding
+        values[i * ncomponents + c] = (prediction < 0) ? 0 : (prediction > top) ? top : prediction;
+      }
+      else {
+        long long residual = (long long) values[i * ncomponents + c] - prediction;
+        encoder.EncodeInteger(models[c][contexts[c]], residual);
+        contexts[c] = ResidualContext(residual);
+      }
+    }
+  }
+}
+
+
+
+static bool
+DecodeAttribute(R3MeshRangeDecoder& decoder, unsigned int *values, unsigned char *zero,
+  int nvertices, int ncomponents, int predictor, int bits)
+{
+  // Decode the difference of every component from its prediction
+  R3MeshIntegerModel models[3][4];
+  R3MeshBitModel zero_models[2];
+  int contexts[3] = { 0, 0, 0 };
+  long long top = (1U << bits) - 1;
+  for (int i = 0; i < nvertices; i++) {
+    bool missing = false;
+    if (zero) {
+      zero[i] = decoder.DecodeBit(zero_models[(i > 0) ? zero[i-1] : 0]);
+      missing = zero[i];
+    }
+    for (int c = 0; c < ncomponents; c++) {
+      long long value = Predict(values, i, c, ncomponents, predictor);
+      if (!missing) {
+        long long residual = decoder.DecodeInteger(models[c][contexts[c]]);
+        contexts[c] = ResidualContext(residual);
+        value += residual;
+      }
+      else value = (value < 0) ? 0 : (value > top) ? top : value;
+      if ((value < 0) || (value > top)) return false;
+      values[i * ncomponents + c] = (unsigned int) value;
+    }
+  }
+
+  // Return whether all values were in the stream
+  return !decoder.overrun;
+}
+
+
+
+////////////////////////////////////////////////////////////
+// MESH COMPRESSED FILE INPUT/OUTPUT
+////////////////////////////////////////////////////////////
+
+int R3Mesh::
+ReadCompressed(const char *filename)
+{
+  // Map file
+  R3MappedFile file;
+  if (!file.Open(filename)) return 0;
+
+  // Read header
+  const unsigned char *h = file.data;
+  if ((file.size < R3_MESH_COMPRESSED_HEADER_SIZE) || memcmp(h, R3mesh_compressed_magic, 8) ||
+      (GetWord(h + 8) != R3_MESH_COMPRESSED_VERSION)) {
+    fprintf(stderr, "File %s is not a compressed mesh file\n", filename);
+    return 0;
+  }
+  unsigned int flags = GetWord(h + 12);
+  unsigned int nvertices = GetWord(h + 16);
+  unsigned int nfaces = GetWord(h + 20);
+  unsigned int nindices = GetWord(h + 24);
+  int bits[R3mesh_nattributes] = { h[28], h[29], h[30] };
+  int predictors[R3mesh_nattributes] = { h[32], h[33], h[34] };
+  float position_min[3], position_max[3], texcoord_min[2], texcoord_max[2];
+  for (int c = 0; c < 3; c++) position_min[c] = GetFloat(h + 36 + 4 * c);
+  for (int c = 0; c < 3; c++) position_max[c] = GetFloat(h + 48 + 4 * c);
+  for (int c = 0; c < 2; c++) texcoord_min[c] = GetFloat(h + 60 + 4 * c);
+  for (int c = 0; c < 2; c++) texcoord_max[c] = GetFloat(h + 68 + 4 * c);
+  unsigned int stream_size = GetWord(h + 76);
+
+  // Check header
+  bool valid = (nvertices <= R3_MESH_COMPRESSED_MAX_ELEMENTS) && (nfaces <= R3_MESH_COMPRESSED_MAX_ELEMENTS) &&
+    (nindices <= R3_MESH_COMPRESSED_MAX_ELEMENTS) && (stream_size <= file.size - R3_MESH_COMPRESSED_HEADER_SIZE);
+  for (int a = 0; a < R3mesh_nattributes; a++) {
+    if ((bits[a] < 1) || (bits[a] > 24) || (predictors[a] >= R3mesh_npredictors)) valid = false;
+  }
+  if (!valid) {
+    fprintf(stderr, "Invalid header in compressed mesh file %s\n", filename);
+    return 0;
+  }
+
+  // Decode vertex attributes
+  R3MeshRangeDecoder decoder(h + R3_MESH_COMPRESSED_HEADER_SIZE, stream_size);
+  vector<unsigned int> positions(3 * nvertices);
+  vector<unsigned int> texcoords(2 * nvertices);
+  vector<unsigned int> normals((flags & R3_MESH_COMPRESSED_NORMALS) ? 2 * nvertices : 0);
+  vector<unsigned char> zero_normals(normals.size() / 2);
+  if (!DecodeAttribute(decoder, positions.data(), NULL, nvertices, 3, predictors[R3mesh_positions], bits[R3mesh_positions]) ||
+      !DecodeAttribute(decoder, texcoords.data(), NULL, nvertices, 2, predictors[R3mesh_texcoords], bits[R3mesh_texcoords]) ||
+      (!normals.empty() && !DecodeAttribute(decoder, normals.data(), zero_normals.data(), nvertices, 2, predictors[R3mesh_normals], bits[R3mesh_normals]))) {
+    fprintf(stderr, "Invalid vertex data in compressed mesh file %s\n", filename);
+    return 0;
+  }
+
+  // Decode faces
+  vector<unsigned int> indices;
+  vector<unsigned int> offsets(1, 0);
+  vector<unsigned char> leaf(nfaces);
+  indices.reserve(nindices);
+  offsets.reserve(nfaces + 1);
+  R3MeshIntegerModel count_model;
+  R3MeshIntegerModel index_models[4];
+  R3MeshBitModel leaf_models[2];
+  long long previous = 0;
+  for (unsigned int i = 0; i < nfaces; i++) {
+    long long face_nverts = decoder.DecodeInteger(count_model) + 3;
+    leaf[i] = decoder.DecodeBit(leaf_models[(i > 0) ? leaf[i-1] : 0]);
+    if ((face_nverts < 3) || (face_nverts > R3_MESH_COMPRESSED_MAX_FACE_VERTICES) ||
+        (indices.size() + face_nverts > nindices) || decoder.overrun) {
+      fprintf(stderr, "Invalid face %u in compressed mesh file %s\n", i, filename);
+      return 0;
+    }
+    for (int j = 0; j < face_nverts; j++) {
+      previous += decoder.DecodeInteger(index_models[(j < 3) ? j : 3]);
+      if ((previous < 0) || (previous >= nvertices)) {
+        fprintf(stderr, "Invalid vertex id %lld in compressed mesh file %s\n", previous, filename);
+        return 0;
+      }
+      indices.push_back(previous);
+    }
+    offsets.push_back(indices.size());
+  }
+  if (decoder.overrun) {
+    fprintf(stderr, "File %s ends before all faces\n", filename);
+    return 0;
+  }
+
+  // Create vertices
+  int first = NVertices();
+  vertices.reserve(first + nvertices);
+  for (unsigned int i = 0; i < nvertices; i++) {
+    R3Point position;
+    for (int c = 0; c < 3; c++) {
+      position[c] = Dequantize(positions[3*i+c], position_min[c], position_max[c], bits[R3mesh_positions]);
+    }
+    R2Point uv(Dequantize(texcoords[2*i], texcoord_min[0], texcoord_max[0], bits[R3mesh_texcoords]),
+      Dequantize(texcoords[2*i+1], texcoord_min[1], texcoord_max[1], bits[R3mesh_texcoords]));
+    R3Vector normal = R3zero_vector;
+    if (!normals.empty() && !zero_normals[i]) normal = DequantizeNormal(&normals[2*i], bits[R3mesh_normals]);
+    CreateVertex(position, normal, uv);
+  }
+
+  // Create faces
+  CreateFaces(indices.data(), offsets.data(), leaf.data(), nfaces, first);
+
+  // Return number of faces read
+  return nfaces;
+}
+
+
+
+int R3Mesh::
+WriteCompressed(const char *filename)
+{
+  // Open file
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) {
+    fprintf(stderr, "Unable to open file %s\n", filename);
+    return 0;
+  }
+
+  // Find ranges of positions and texture coordinates
+  int nvertices = NWrittenVertices();
+  int nfaces = NWrittenFaces();
+  float position_min[3] = { 0, 0, 0 }, position_max[3] = { 0, 0, 0 };
+  float texcoord_min[2] = { 0, 0 }, texcoord_max[2] = { 0, 0 };
+  for (int i = 0; i < nvertices; i++) {
+    R3Point position = WrittenPosition(i);
+    R2Point texcoords = WrittenTexCoords(i);
+    for (int c = 0; c < 3; c++) {
+      float value = position[c];
+      if ((i == 0) || (value < position_min[c])) position_min[c] = value;
+      if ((i == 0) || (value > position_max[c])) position_max[c] = value;
+    }
+    for (int c = 0; c < 2; c++) {
+      float value = texcoords[c];
+      if ((i == 0) || (value < texcoord_min[c])) texcoord_min[c] = value;
+      if ((i == 0) || (value > texcoord_max[c])) texcoord_max[c] = value;
+    }
+  }
+
+  // Quantize vertex attributes
+  bool has_normals = HasVertexNormals();
+  vector<unsigned int> positions(3 * nvertices);
+  vector<unsigned int> texcoords(2 * nvertices);
+  vector<unsigned int> normals((has_normals) ? 2 * nvertices : 0);
+  vector<unsigned char> zero_normals(normals.size() / 2);
+  for (int i = 0; i < NVertices(); i++) Vertex(i)->id = i;
+  for (int i = 0; i < nvertices; i++) {
+    R3Point position = WrittenPosition(i);
+    R2Point texcoord = WrittenTexCoords(i);
+    for (int c = 0; c < 3; c++) {
+      positions[3*i+c] = Quantize(position[c], position_min[c], position_max[c], R3_MESH_COMPRESSED_POSITION_BITS);
+    }
+    for (int c = 0; c < 2; c++) {
+      texcoords[2*i+c] = Quantize(texcoord[c], texcoord_min[c], texcoord_max[c], R3_MESH_COMPRESSED_TEXCOORD_BITS);
+    }
+    if (has_normals) {
+      R3Vector normal = WrittenNormal(i);
+      zero_normals[i] = normal.IsZero();
+      if (!zero_normals[i]) QuantizeNormal(normal, R3_MESH_COMPRESSED_NORMAL_BITS, &normals[2*i]);
+    }
+  }
+
+  // Pick the predictor that codes each attribute smallest, trying them on
+  // blocks of vertices spread over the mesh (or on all vertices, if few)
+  unsigned int *values[R3mesh_nattributes] = { positions.data(), texcoords.data(), normals.data() };
+  const unsigned char *zero[R3mesh_nattributes] = { NULL, NULL, zero_normals.data() };
+  int ncomponents[R3mesh_nattributes] = { 3, 2, 2 };
+  int bits[R3mesh_nattributes] = { R3_MESH_COMPRESSED_POSITION_BITS, R3_MESH_COMPRESSED_TEXCOORD_BITS, R3_MESH_COMPRESSED_NORMAL_BITS };
+  int predictors[R3mesh_nattributes] = { 0, 0, 0 };
+  int nattributes = (has_normals) ? 3 : 2;
+  int nblocks = R3_MESH_COMPRESSED_SAMPLE_BLOCKS, block_size = R3_MESH_COMPRESSED_SAMPLE_BLOCK_SIZE;
+  if (nvertices <= nblocks * block_size) { nblocks = 1; block_size = nvertices; }
+  for (int a = 0; a < nattributes; a++) {
+    vector<unsigned int> sample;
+    vector<unsigned char> sample_zero;
+    for (int k = 0; k < nblocks; k++) {
+      int start = (int) ((long long) k * (nvertices - block_size) / ((nblocks > 1) ? nblocks - 1 : 1));
+      sample.insert(sample.end(), values[a] + start * ncomponents[a], values[a] + (start + block_size) * ncomponents[a]);
+      if (zero[a]) sample_zero.insert(sample_zero.end(), zero[a] + start, zero[a] + start + block_size);
+    }
+    int nsamples = nblocks * block_size;
+    size_t best_size = 0;
+    for (int predictor = 0; predictor < R3mesh_npredictors; predictor++) {
+      R3MeshRangeEncoder trial;
+      EncodeAttribute(trial, sample.data(), (zero[a]) ? sample_zero.data() : NULL, nsamples, ncomponents[a], predictor, bits[a]);
+      trial.Finish();
+      if ((predictor == 0) || (trial.bytes.size() < best_size)) {
+        best_size = trial.bytes.size();
+        predictors[a] = predictor;
+      }
+    }
+  }
+
+  // Encode vertex attributes
+  R3MeshRangeEncoder encoder;
+  for (int a = 0; a < nattributes; a++) {
+    EncodeAttribute(encoder, values[a], zero[a], nvertices, ncomponents[a], predictors[a], bits[a]);
+  }
+
+  // Encode packed triangles, faces, then triangles
+  R3MeshIntegerModel count_model;
+  R3MeshIntegerModel index_models[4];
+  R3MeshBitModel leaf_models[2];
+  long long previous = 0;
+  int previous_leaf = 0;
+  unsigned int nindices = 0;
+  for (int i = 0; i < nfaces; i++) {
+    int face_nverts = NWrittenFaceVertices(i);
+    int isLeaf = IsLeafWrittenFace(i);
+    encoder.EncodeInteger(count_model, face_nverts - 3);
+    encoder.EncodeBit(leaf_models[previous_leaf], isLeaf);
+    for (int j = 0; j < face_nverts; j++) {
+      long long id = WrittenFaceVertex(i, j);
+      encoder.EncodeInteger(index_models[(j < 3) ? j : 3], id - previous);
+      previous = id;
+    }
+    previous_leaf = isLeaf;
+    nindices += face_nverts;
+  }
+  encoder.Finish();
+
+  // Write header
+  unsigned char header[R3_MESH_COMPRESSED_HEADER_SIZE];
+  memset(header, 0, sizeof(header));
+  memcpy(header, R3mesh_compressed_magic, 8);
+  PutWord(header + 8, R3_MESH_COMPRESSED_VERSION);
+  PutWord(header + 12, (has_normals) ? R3_MESH_COMPRESSED_NORMALS : 0);
+  PutWord(header + 16, nvertices);
+  PutWord(header + 20, nfaces);
+  PutWord(header + 24, nindices);
+  for (int a = 0; a < R3mesh_nattributes; a++) header[28 + a] = bits[a];
+  for (int a = 0; a < R3mesh_nattributes; a++) header[32 + a] = predictors[a];
+  for (int c = 0; c < 3; c++) PutFloat(header + 36 + 4 * c, position_min[c]);
+  for (int c = 0; c < 3; c++) PutFloat(header + 48 + 4 * c, position_max[c]);
+  for (int c = 0; c < 2; c++) PutFloat(header + 60 + 4 * c, texcoord_min[c]);
+  for (int c = 0; c < 2; c++) PutFloat(header + 68 + 4 * c, texcoord_max[c]);
+  PutWord(header + 76, encoder.bytes.size());
+  fwrite(header, 1, sizeof(header), fp);
+
+  // Write coded stream
+  fwrite(encoder.bytes.data(), 1, encoder.bytes.size(), fp);
+
+  // Close file
+  bool error = ferror(fp);
+  if (fclose(fp) || error) {
+    fprintf(stderr, "Unable to write file %s\n", filename);
+    return 0;
+  }
+
+  // Return number of faces written
+  return nfaces;
+}
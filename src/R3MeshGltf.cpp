@@ -0,0 +1,706 @@
+// Source file for binary glTF 2.0 output (.glb)
+//
+// The file has one scene with a tree node, whose mesh has a bark and a
+// leaf primitive, and optionally leaves nodes that draw a leaf shape, one
+// node for each bend, at every leaf position with EXT_mesh_gpu_instancing
+// (leaves that match no bent shape stay in the leaf primitive).  All data
+// is in the single binary buffer of the file, including the bark and leaf
+// textures, which are converted to JPEG.
+//
+// Scenes are written the same way, with a mesh for every distinct tree
+// and a node with a transformation for every placed tree.
+
+
+
+// Include files
+
+#include "R3Mesh.h"
+#include "R3Scene.h"
+#include <cfloat>
+#include <map>
+#include <string>
+
+
+
+////////////////////////////////////////////////////////////
+// GLTF CONSTANTS
+////////////////////////////////////////////////////////////
+
+// Textures, as used by meshview
+static const char *R3mesh_bark_texture = "textures/lightwood.bmp";
+static const char *R3mesh_leaf_texture = "textures/leaf.bmp";
+
+// The unbent shape made by R3Mesh::Leaf, which bends vertices 3 to 5 by
+// z/2, z and z/2 (and moves the tip down by z); instanced leaves are drawn
+// with shapes bent by the nearest multiple of 1/R3mesh_leaf_bend_steps, which
+// gives at most 17 shapes for bends between -1/4 and 1/4
+static const int R3mesh_leaf_bend_steps = 32;
+static const float R3mesh_leaf_positions[8][2] = {
+  { 0, .01f }, { .2f, .1f }, { .25f, .3f }, { .2f, .6f },
+  { 0, 1 }, { -.2f, .6f }, { -.25f, .3f }, { -.2f, .1f }
+};
+static const float R3mesh_leaf_texcoords[8][2] = {
+  { .5f, .01f }, { .7f, .1f }, { .75f, .3f }, { .7f, .6f },
+  { .5f, 1 }, { .3f, .6f }, { .25f, .3f }, { .3f, .1f }
+};
+
+// Numbers from the glTF specification
+#define R3_GLTF_FLOAT 5126
+#define R3_GLTF_UNSIGNED_INT 5125
+#define R3_GLTF_ARRAY_BUFFER 34962
+#define R3_GLTF_ELEMENT_ARRAY_BUFFER 34963
+
+
+
+////////////////////////////////////////////////////////////
+// GLTF UTILITY FUNCTIONS
+////////////////////////////////////////////////////////////
+
+struct R3GltfVertex {
+  float position[3];
+  float normal[3];
+  float texcoords[2];
+};
+
+struct R3GltfLeafInstance {
+  float translation[3];
+  float rotation[4];
+  float scale[3];
+  int bend;
+};
+
+
+
+static void
+AppendData(vector<unsigned char>& buffer, const void *data, size_t nwords, size_t word_size)
+{
+  // Append an array of numbers in little endian order, starting at a multiple of 4 bytes
+  buffer.resize((buffer.size() + 3) & ~((size_t) 3), 0);
+  const unsigned char *bytes = (const unsigned char *) data;
+  unsigned int one = 1;
+  if (*((unsigned char *) &one) == 1) {
+    buffer.insert(buffer.end(), bytes, bytes + nwords * word_size);
+  }
+  else {
+    for (size_t i = 0; i < nwords; i++) {
+      for (size_t j = word_size; j > 0; j--) buffer.push_back(bytes[i * word_size + j - 1]);
+    }
+  }
+}
+
+
+
+static void
+AppendNumber(std::string& json, double value)
+{
+  // Append a number with enough digits for a float
+  char text[32];
+  snprintf(text, sizeof(text), "%.9g", value);
+  json += text;
+}
+
+
+
+static void
+AppendBufferView(std::string& json, size_t offset, size_t length, int stride, int target)
+{
+  // Append a view of the binary buffer
+  if (json.back() == '}') json += ",";
+  json += "{\"buffer\":0,\"byteOffset\":" + std::to_string(offset) + ",\"byteLength\":" + std::to_string(length);
+  if (stride > 0) json += ",\"byteStride\":" + std::to_string(stride);
+  if (target > 0) json += ",\"target\":" + std::to_string(target);
+  json += "}";
+}
+
+
+
+static void
+AppendAccessor(std::string& json, int view, size_t offset, int component_type, size_t count,
+  const char *type, const float *min = NULL, const float *max = NULL)
+{
+  // Append an accessor (min and max are for 3-vectors)
+  if (json.back() == '}') json += ",";
+  json += "{\"bufferView\":" + std::to_string(view) + ",\"byteOffset\":" + std::to_string(offset);
+  json += ",\"componentType\":" + std::to_string(component_type) + ",\"count\":" + std::to_string(count);
+  json += ",\"type\":\"" + std::string(type) + "\"";
+  if (min && max) {
+    json += ",\"min\":[";
+    for (int i = 0; i < 3; i++) { if (i > 0) json += ","; AppendNumber(json, min[i]); }
+    json += "],\"max\":[";
+    for (int i = 0; i < 3; i++) { if (i > 0) json += ","; AppendNumber(json, max[i]); }
+    json += "]";
+  }
+  json += "}";
+}
+
+
+
+static bool
+ReadTextureJPEG(const char *texture_filename, const char *output_filename, vector<unsigned char>& jpeg)
+{
+  // Convert a texture image to JPEG, through a temporary file next to the output
+  R2Image image;
+  FILE *fp = fopen(texture_filename, "rb");
+  if (!fp) return false;
+  fclose(fp);
+  if (!image.Read(texture_filename)) return false;
+  std::string jpeg_filename = std::string(output_filename) + ".texture.jpg";
+  if (!image.WriteJPEG(jpeg_filename.c_str())) return false;
+
+  // Read JPEG data
+  fp = fopen(jpeg_filename.c_str(), "rb");
+  if (!fp) return false;
+  unsigned char block[65536];
+  size_t n;
+  while ((n = fread(block, 1, sizeof(block), fp)) > 0) jpeg.insert(jpeg.end(), block, block + n);
+  fclose(fp);
+  remove(jpeg_filename.c_str());
+  return !jpeg.empty();
+}
+
+
+
+static R3Point
+LeafShapePosition(int i, double z)
+{
+  // Return a vertex of the leaf shape bent by z as by R3Mesh::Leaf
+  double x = R3mesh_leaf_positions[i][0], y = R3mesh_leaf_positions[i][1];
+  if (i == 4) return R3Point(x, y - z, z);
+  if ((i == 3) || (i == 5)) return R3Point(x, y, z/2);
+  return R3Point(x, y, 0);
+}
+
+
+
+static R3Vector
+LeafShapeNormal(int i, double z)
+{
+  // Return a vertex normal of the leaf shape bent by z, tilted by the slope
+  // of the midrib as by R3Mesh::Leaf
+  double middle = (z/2)/.3, tip = (z/2)/(.4-z);
+  R3Vector normal(0, 0, 1);
+  if ((i == 2) || (i == 6)) normal = R3Vector(0, -middle/2, 1);
+  else if ((i == 3) || (i == 5)) normal = R3Vector(0, -(middle+tip)/2, 1);
+  else if (i == 4) normal = R3Vector(0, -tip, 1);
+  normal.Normalize();
+  return normal;
+}
+
+
+
+static bool
+FindLeafInstance(const R3Point *leaf, R3GltfLeafInstance *instance)
+{
+  // Leaves are the unbent leaf shape scaled, rotated and translated, and
+  // the vertices at y=.1 and y=.3 are never bent, so they give the transformation
+  const R3Point& p1 = leaf[1];
+  const R3Point& p2 = leaf[2];
+  const R3Point& p6 = leaf[6];
+  const R3Point& p7 = leaf[7];
+  R3Vector x = (p2 - p6) / .5;
+  R3Vector y = ((p2 - p1) + (p6 - p7)) / .4;
+  double scale = x.Length();
+  if ((scale < 1e-12) || (fabs(y.Length() - scale) > 1e-3 * scale) || (fabs(x.Dot(y)) > 1e-3 * scale * scale)) return false;
+  x /= scale;
+  y /= scale;
+  R3Vector z = x % y;
+  z.Normalize();
+  y = z % x;
+  R3Point origin = p2 + (p6 - p2) / 2 - .3 * scale * y;
+
+  // The tip gives the bend, and every vertex must match the bent shape
+  // (leaves bent some other way are left as they are); the instance is
+  // drawn with the nearest quantized bend
+  double bend = (leaf[4] - origin).Dot(z) / scale;
+  instance->bend = (int) floor(bend * R3mesh_leaf_bend_steps + .5);
+  for (int i = 0; i < 8; i++) {
+    R3Point p = LeafShapePosition(i, bend);
+    R3Point q = origin + scale * (p.X() * x + p.Y() * y + p.Z() * z);
+    if (R3Distance(q, leaf[i]) > 1e-3 * scale) return false;
+  }
+
+  // Convert rotation matrix (columns x, y, z) to a quaternion
+  double m[3][3] = {
+    { x.X(), y.X(), z.X() },
+    { x.Y(), y.Y(), z.Y() },
+    { x.Z(), y.Z(), z.Z() }
+  };
+  double q[4];
+  double trace = m[0][0] + m[1][1] + m[2][2];
+  if (trace > 0) {
+    double s = 0.5 / sqrt(trace + 1);
+    q[3] = 0.25 / s;
+    q[0] = (m[2][1] - m[1][2]) * s;
+    q[1] = (m[0][2] - m[2][0]) * s;
+    q[2] = (m[1][0] - m[0][1]) * s;
+  }
+  else if ((m[0][0] > m[1][1]) && (m[0][0] > m[2][2])) {
+    double s = 2 * sqrt(1 + m[0][0] - m[1][1] - m[2][2]);
+    q[3] = (m[2][1] - m[1][2]) / s;
+    q[0] = 0.25 * s;
+    q[1] = (m[0][1] + m[1][0]) / s;
+    q[2] = (m[0][2] + m[2][0]) / s;
+  }
+  else if (m[1][1] > m[2][2]) {
+    double s = 2 * sqrt(1 + m[1][1] - m[0][0] - m[2][2]);
+    q[3] = (m[0][2] - m[2][0]) / s;
+    q[0] = (m[0][1] + m[1][0]) / s;
+    q[1] = 0.25 * s;
+    q[2] = (m[1][2] + m[2][1]) / s;
+  }
+  else {
+    double s = 2 * sqrt(1 + m[2][2] - m[0][0] - m[1][1]);
+    q[3] = (m[1][0] - m[0][1]) / s;
+    q[0] = (m[0][2] + m[2][0]) / s;
+    q[1] = (m[1][2] + m[2][1]) / s;
+    q[2] = 0.25 * s;
+  }
+
+  // Fill in instance
+  double length = sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+  for (int i = 0; i < 4; i++) instance->rotation[i] = q[i] / length;
+  instance->translation[0] = origin.X();
+  instance->translation[1] = origin.Y();
+  instance->translation[2] = origin.Z();
+  instance->scale[0] = instance->scale[1] = instance->scale[2] = scale;
+  return true;
+}
+
+
+
+////////////////////////////////////////////////////////////
+// GLTF FILE BUILDING FUNCTIONS
+////////////////////////////////////////////////////////////
+
+struct R3GltfFile {
+  // Binary buffer, and JSON arrays of buffer views, accessors and meshes
+  vector<unsigned char> bin;
+  std::string views;
+  std::string accessors;
+  std::string meshes;
+  int nviews;
+  int naccessors;
+  int nmeshes;
+
+  // Leaf shapes, one for each bend that a tree needs, with the first
+  // of their accessors (their meshes are added after all trees)
+  std::map<int, int> leaf_shapes;
+  vector<int> leaf_accessors;
+
+  R3GltfFile(void) 
+  : views(",\"bufferViews\":["), accessors(",\"accessors\":["),
+    nviews(0), naccessors(0), nmeshes(0) {}
+};
+
+struct R3GltfTree {
+  // Mesh with the bark and leaf primitives of a tree (-1 if it has none),
+  // and for every leaf shape that it uses, the shape and the first of the
+  // accessors of its instance transformations
+  int mesh;
+  vector<int> leaf_shapes;
+  vector<int> leaves;
+};
+
+
+
+static int
+AppendLeafShape(R3GltfFile& gltf, int bend)
+{
+  // Add the leaf shape with a bend, once for all trees
+  std::map<int, int>::iterator found = gltf.leaf_shapes.find(bend);
+  if (found != gltf.leaf_shapes.end()) return found->second;
+  R3GltfVertex leaf_vertices[8];
+  float leaf_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, leaf_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+  for (int i = 0; i < 8; i++) {
+    R3GltfVertex& v = leaf_vertices[i];
+    R3Point position = LeafShapePosition(i, (double) bend / R3mesh_leaf_bend_steps);
+    R3Vector normal = LeafShapeNormal(i, (double) bend / R3mesh_leaf_bend_steps);
+    for (int j = 0; j < 3; j++) {
+      v.position[j] = position[j];
+      v.normal[j] = normal[j];
+      if (v.position[j] < leaf_min[j]) leaf_min[j] = v.position[j];
+      if (v.position[j] > leaf_max[j]) leaf_max[j] = v.position[j];
+    }
+    v.texcoords[0] = R3mesh_leaf_texcoords[i][0];
+    v.texcoords[1] = 1 - R3mesh_leaf_texcoords[i][1];
+  }
+  unsigned int leaf_indices[18];
+  for (int j = 2; j < 8; j++) {
+    leaf_indices[3*(j-2)] = 0;
+    leaf_indices[3*(j-2)+1] = j - 1;
+    leaf_indices[3*(j-2)+2] = j;
+  }
+  size_t offset = (gltf.bin.size() + 3) & ~((size_t) 3);
+  AppendData(gltf.bin, leaf_vertices, 8 * 8, 4);
+  AppendBufferView(gltf.views, offset, gltf.bin.size() - offset, sizeof(R3GltfVertex), R3_GLTF_ARRAY_BUFFER);
+  AppendAccessor(gltf.accessors, gltf.nviews, 0, R3_GLTF_FLOAT, 8, "VEC3", leaf_min, leaf_max);
+  AppendAccessor(gltf.accessors, gltf.nviews, 12, R3_GLTF_FLOAT, 8, "VEC3");
+  AppendAccessor(gltf.accessors, gltf.nviews, 24, R3_GLTF_FLOAT, 8, "VEC2");
+  gltf.nviews++;
+  offset = gltf.bin.size();
+  AppendData(gltf.bin, leaf_indices, 18, 4);
+  AppendBufferView(gltf.views, offset, gltf.bin.size() - offset, 0, R3_GLTF_ELEMENT_ARRAY_BUFFER);
+  AppendAccessor(gltf.accessors, gltf.nviews++, 0, R3_GLTF_UNSIGNED_INT, 18, "SCALAR");
+  int shape = gltf.leaf_accessors.size();
+  gltf.leaf_shapes[bend] = shape;
+  gltf.leaf_accessors.push_back(gltf.naccessors);
+  gltf.naccessors += 4;
+  return shape;
+}
+
+
+
+static R3GltfTree
+AppendTree(R3GltfFile& gltf, R3Mesh *mesh, const char *name, bool instance_leaves)
+{
+  // Find leaves that can be drawn as instances of one leaf shape
+  int nfaces = mesh->NWrittenFaces();
+  vector<R3GltfLeafInstance> instances;
+  vector<bool> instanced(nfaces, false);
+  if (instance_leaves) {
+    R3GltfLeafInstance instance;
+    R3Point leaf[8];
+    for (int i = 0; i < nfaces; i++) {
+      if (!mesh->IsLeafWrittenFace(i)) continue;
+      if (mesh->NWrittenFaceVertices(i) == 8) {
+        // A leaf face
+        for (int j = 0; j < 8; j++) leaf[j] = mesh->WrittenPosition(mesh->WrittenFaceVertex(i, j));
+        if (!FindLeafInstance(leaf, &instance)) continue;
+        instances.push_back(instance);
+        instanced[i] = true;
+        continue;
+      }
+
+      // A leaf in the triangle buffer is a fan of 6 triangles
+      if (i + 6 > nfaces) continue;
+      unsigned int center = mesh->WrittenFaceVertex(i, 0);
+      bool fan = true;
+      for (int j = 0; fan && (j < 6); j++) {
+        fan = mesh->IsLeafWrittenFace(i + j) && (mesh->NWrittenFaceVertices(i + j) == 3) &&
+          (mesh->WrittenFaceVertex(i + j, 0) == center) &&
+          ((j == 0) || (mesh->WrittenFaceVertex(i + j, 1) == mesh->WrittenFaceVertex(i + j - 1, 2)));
+      }
+      if (!fan) continue;
+      leaf[0] = mesh->WrittenPosition(center);
+      leaf[1] = mesh->WrittenPosition(mesh->WrittenFaceVertex(i, 1));
+      for (int j = 0; j < 6; j++) leaf[j + 2] = mesh->WrittenPosition(mesh->WrittenFaceVertex(i + j, 2));
+      if (!FindLeafInstance(leaf, &instance)) continue;
+      instances.push_back(instance);
+      for (int j = 0; j < 6; j++) instanced[i + j] = true;
+      i += 5;
+    }
+  }
+
+  // Gather bark and leaf triangles, numbering only the vertices they use
+  vector<int> vertex_index(mesh->NWrittenVertices(), -1);
+  vector<unsigned int> used_vertices;
+  vector<unsigned int> indices[2];
+  for (int i = 0; i < mesh->NVertices(); i++) mesh->Vertex(i)->id = i;
+  for (int i = 0; i < nfaces; i++) {
+    // Add polygon as a fan of triangles
+    if (instanced[i]) continue;
+    int nvertices = mesh->NWrittenFaceVertices(i);
+    int leaf = mesh->IsLeafWrittenFace(i);
+    for (int j = 0; j < nvertices; j++) {
+      unsigned int id = mesh->WrittenFaceVertex(i, j);
+      int& index = vertex_index[id];
+      if (index < 0) { index = used_vertices.size(); used_vertices.push_back(id); }
+    }
+    for (int j = 2; j < nvertices; j++) {
+      indices[leaf].push_back(vertex_index[mesh->WrittenFaceVertex(i, 0)]);
+      indices[leaf].push_back(vertex_index[mesh->WrittenFaceVertex(i, j - 1)]);
+      indices[leaf].push_back(vertex_index[mesh->WrittenFaceVertex(i, j)]);
+    }
+  }
+
+  // Interleave vertex attributes (glTF wants unit normals, and texture v down)
+  vector<int>().swap(vertex_index);
+  vector<R3GltfVertex> vertex_data(used_vertices.size());
+  float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+  for (unsigned int i = 0; i < used_vertices.size(); i++) {
+    R3Point position = mesh->WrittenPosition(used_vertices[i]);
+    R3Vector normal = mesh->WrittenNormal(used_vertices[i]);
+    R2Point texcoords = mesh->WrittenTexCoords(used_vertices[i]);
+    if (normal.IsZero()) normal = R3posy_vector;
+    else normal.Normalize();
+    R3GltfVertex& v = vertex_data[i];
+    for (int j = 0; j < 3; j++) {
+      v.position[j] = position[j];
+      v.normal[j] = normal[j];
+      if (v.position[j] < min[j]) min[j] = v.position[j];
+      if (v.position[j] > max[j]) max[j] = v.position[j];
+    }
+    v.texcoords[0] = texcoords.X();
+    v.texcoords[1] = 1 - texcoords.Y();
+  }
+
+  // Add tree vertices and triangles (with room made for them at once, so
+  // the buffer is not copied while they are added, and growing at least
+  // twofold, so trees of a scene are not copied again one by one)
+  vector<unsigned int>().swap(used_vertices);
+  size_t size = gltf.bin.size() + sizeof(R3GltfVertex) * vertex_data.size() + 4 * (indices[0].size() + indices[1].size()) + 8;
+  if (size > gltf.bin.capacity()) gltf.bin.reserve(std::max(size, 2 * gltf.bin.capacity()));
+  R3GltfTree tree;
+  tree.mesh = -1;
+  std::string primitives;
+  int vertex_accessor = gltf.naccessors;
+  if (!vertex_data.empty()) {
+    size_t offset = (gltf.bin.size() + 3) & ~((size_t) 3);
+    AppendData(gltf.bin, vertex_data.data(), vertex_data.size() * 8, 4);
+    AppendBufferView(gltf.views, offset, gltf.bin.size() - offset, sizeof(R3GltfVertex), R3_GLTF_ARRAY_BUFFER);
+    AppendAccessor(gltf.accessors, gltf.nviews, 0, R3_GLTF_FLOAT, vertex_data.size(), "VEC3", min, max);
+    AppendAccessor(gltf.accessors, gltf.nviews, 12, R3_GLTF_FLOAT, vertex_data.size(), "VEC3");
+    AppendAccessor(gltf.accessors, gltf.nviews, 24, R3_GLTF_FLOAT, vertex_data.size(), "VEC2");
+    gltf.nviews++;
+    gltf.naccessors += 3;
+    vector<R3GltfVertex>().swap(vertex_data);
+  }
+  for (int leaf = 0; leaf < 2; leaf++) {
+    if (indices[leaf].empty()) continue;
+    size_t offset = (gltf.bin.size() + 3) & ~((size_t) 3);
+    AppendData(gltf.bin, indices[leaf].data(), indices[leaf].size(), 4);
+    AppendBufferView(gltf.views, offset, gltf.bin.size() - offset, 0, R3_GLTF_ELEMENT_ARRAY_BUFFER);
+    AppendAccessor(gltf.accessors, gltf.nviews++, 0, R3_GLTF_UNSIGNED_INT, indices[leaf].size(), "SCALAR");
+    primitives += (primitives.empty()) ? "" : ",";
+    primitives += "{\"attributes\":{\"POSITION\":" + std::to_string(vertex_accessor) + ",\"NORMAL\":" + std::to_string(vertex_accessor + 1) +
+      ",\"TEXCOORD_0\":" + std::to_string(vertex_accessor + 2) + "},\"indices\":" + std::to_string(gltf.naccessors++) +
+      ",\"material\":" + std::to_string(leaf) + "}";
+  }
+  if (!primitives.empty()) {
+    gltf.meshes += (gltf.meshes.empty()) ? "" : ",";
+    gltf.meshes += "{\"name\":\"" + std::string(name) + "\",\"primitives\":[" + primitives + "]}";
+    tree.mesh = gltf.nmeshes++;
+  }
+
+  // Add leaf shapes and instance transformations, grouped by bend
+  std::map<int, vector<const R3GltfLeafInstance *> > bends;
+  for (unsigned int i = 0; i < instances.size(); i++) bends[instances[i].bend].push_back(&instances[i]);
+  for (std::map<int, vector<const R3GltfLeafInstance *> >::iterator it = bends.begin(); it != bends.end(); ++it) {
+    // Translations, rotations and scales are each one array
+    const vector<const R3GltfLeafInstance *>& group = it->second;
+    tree.leaf_shapes.push_back(AppendLeafShape(gltf, it->first));
+    vector<float> values;
+    for (int k = 0; k < 3; k++) {
+      values.clear();
+      for (unsigned int i = 0; i < group.size(); i++) {
+        const float *v = (k == 0) ? group[i]->translation : (k == 1) ? group[i]->rotation : group[i]->scale;
+        values.insert(values.end(), v, v + ((k == 1) ? 4 : 3));
+      }
+      size_t offset = gltf.bin.size();
+      AppendData(gltf.bin, values.data(), values.size(), 4);
+      AppendBufferView(gltf.views, offset, gltf.bin.size() - offset, 0, 0);
+      AppendAccessor(gltf.accessors, gltf.nviews++, 0, R3_GLTF_FLOAT, group.size(), (k == 1) ? "VEC4" : "VEC3");
+    }
+    tree.leaves.push_back(gltf.naccessors);
+    gltf.naccessors += 3;
+  }
+
+  // Return glTF mesh and leaf instances of tree
+  return tree;
+}
+
+
+
+static std::string
+LeavesNode(const R3GltfFile& gltf, const R3GltfTree& tree, int k)
+{
+  // Return the JSON of a node drawing the k-th leaf shape of a tree at its
+  // leaves (the leaf meshes are added after all trees)
+  int leaves = tree.leaves[k];
+  return "{\"name\":\"leaves\",\"mesh\":" + std::to_string(gltf.nmeshes + tree.leaf_shapes[k]) +
+    ",\"extensions\":{\"EXT_mesh_gpu_instancing\":{\"attributes\":{\"TRANSLATION\":" + std::to_string(leaves) +
+    ",\"ROTATION\":" + std::to_string(leaves + 1) + ",\"SCALE\":" + std::to_string(leaves + 2) + "}}}}";
+}
+
+
+
+static int
+WriteGLBFile(const char *filename, R3GltfFile& gltf, const std::string& nodes, const std::string& scene_nodes)
+{
+  // Start JSON
+  std::string json = "{\"asset\":{\"version\":\"2.0\",\"generator\":\"L3D\"}";
+  if (!gltf.leaf_accessors.empty()) json += ",\"extensionsUsed\":[\"EXT_mesh_gpu_instancing\"]";
+  json += ",\"scene\":0";
+
+  // Add textures
+  vector<unsigned char> jpeg[2];
+  bool textured[2];
+  const char *texture_filenames[2] = { R3mesh_bark_texture, R3mesh_leaf_texture };
+  std::string images;
+  for (int i = 0; i < 2; i++) {
+    textured[i] = ReadTextureJPEG(texture_filenames[i], filename, jpeg[i]);
+    if (!textured[i]) {
+      fprintf(stderr, "Unable to read texture %s, writing %s without it\n", texture_filenames[i], filename);
+      continue;
+    }
+    size_t offset = (gltf.bin.size() + 3) & ~((size_t) 3);
+    AppendData(gltf.bin, jpeg[i].data(), jpeg[i].size(), 1);
+    AppendBufferView(gltf.views, offset, gltf.bin.size() - offset, 0, 0);
+    images += (images.empty()) ? "" : ",";
+    images += "{\"bufferView\":" + std::to_string(gltf.nviews++) + ",\"mimeType\":\"image/jpeg\"}";
+  }
+
+  // Add materials (leaves are single sided polygons, so they are seen from both sides)
+  json += ",\"materials\":[";
+  const char *material_names[2] = { "bark", "leaf" };
+  const char *material_colors[2] = { "0.55,0.4,0.25,1", "0.3,0.6,0.2,1" };
+  for (int i = 0, ntextures = 0; i < 2; i++) {
+    if (i > 0) json += ",";
+    json += "{\"name\":\"" + std::string(material_names[i]) + "\",\"pbrMetallicRoughness\":{";
+    if (textured[i]) json += "\"baseColorTexture\":{\"index\":" + std::to_string(ntextures++) + "},";
+    else json += "\"baseColorFactor\":[" + std::string(material_colors[i]) + "],";
+    json += "\"metallicFactor\":0,\"roughnessFactor\":1}";
+    if (i == 1) json += ",\"doubleSided\":true";
+    json += "}";
+  }
+  json += "]";
+  if (!images.empty()) {
+    json += ",\"images\":[" + images + "]";
+    json += ",\"samplers\":[{\"magFilter\":9729,\"minFilter\":9987,\"wrapS\":10497,\"wrapT\":10497}]";
+    json += ",\"textures\":[";
+    for (int i = 0, n = 0; i < 2; i++) {
+      if (!textured[i]) continue;
+      json += (n > 0) ? "," : "";
+      json += "{\"sampler\":0,\"source\":" + std::to_string(n++) + "}";
+    }
+    json += "]";
+  }
+
+  // Add leaf meshes, then meshes, nodes and scene
+  for (unsigned int i = 0; i < gltf.leaf_accessors.size(); i++) {
+    int a = gltf.leaf_accessors[i];
+    gltf.meshes += (gltf.meshes.empty()) ? "" : ",";
+    gltf.meshes += "{\"name\":\"leaf\",\"primitives\":[{\"attributes\":{\"POSITION\":" + std::to_string(a) + ",\"NORMAL\":" + std::to_string(a + 1) +
+      ",\"TEXCOORD_0\":" + std::to_string(a + 2) + "},\"indices\":" + std::to_string(a + 3) + ",\"material\":1}]}";
+    gltf.nmeshes++;
+  }
+  json += ",\"scenes\":[{\"nodes\":[" + scene_nodes + "]}]";
+  if (gltf.nmeshes > 0) json += ",\"meshes\":[" + gltf.meshes + "],\"nodes\":[" + nodes + "]";
+  if (gltf.nviews > 0) json += gltf.views + "]" + gltf.accessors + "]";
+  vector<unsigned char>& bin = gltf.bin;
+  bin.resize((bin.size() + 3) & ~((size_t) 3), 0);
+  if (!bin.empty()) json += ",\"buffers\":[{\"byteLength\":" + std::to_string(bin.size()) + "}]";
+  json += "}";
+  json.resize((json.size() + 3) & ~((size_t) 3), ' ');
+
+  // Open file
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) {
+    fprintf(stderr, "Unable to open file %s\n", filename);
+    return 0;
+  }
+
+  // Write header, JSON chunk and binary chunk
+  vector<unsigned char> header;
+  unsigned int words[5] = { 0x46546C67, 2, 0, (unsigned int) json.size(), 0x4E4F534A };
+  words[2] = 12 + 8 + json.size() + ((bin.empty()) ? 0 : 8 + bin.size());
+  AppendData(header, words, 5, 4);
+  fwrite(header.data(), 1, header.size(), fp);
+  fwrite(json.data(), 1, json.size(), fp);
+  if (!bin.empty()) {
+    header.clear();
+    unsigned int bin_words[2] = { (unsigned int) bin.size(), 0x004E4942 };
+    AppendData(header, bin_words, 2, 4);
+    fwrite(header.data(), 1, header.size(), fp);
+    fwrite(bin.data(), 1, bin.size(), fp);
+  }
+
+  // Close file
+  bool error = ferror(fp);
+  if (fclose(fp) || error) {
+    fprintf(stderr, "Unable to write file %s\n", filename);
+    return 0;
+  }
+
+  // Return success
+  return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////
+// MESH GLTF OUTPUT
+////////////////////////////////////////////////////////////
+
+int R3Mesh::
+WriteGLB(const char *filename, bool instance_leaves)
+{
+  // Add tree
+  R3GltfFile gltf;
+  R3GltfTree tree = AppendTree(gltf, this, "tree", instance_leaves);
+
+  // Add a tree node and a leaves node for every leaf shape
+  std::string nodes, scene_nodes;
+  int nnodes = 0;
+  if (tree.mesh >= 0) {
+    nodes += "{\"name\":\"tree\",\"mesh\":" + std::to_string(tree.mesh) + "}";
+    scene_nodes += std::to_string(nnodes++);
+  }
+  for (unsigned int k = 0; k < tree.leaves.size(); k++) {
+    nodes += (nodes.empty()) ? "" : ",";
+    nodes += LeavesNode(gltf, tree, k);
+    scene_nodes += (scene_nodes.empty()) ? "" : ",";
+    scene_nodes += std::to_string(nnodes++);
+  }
+
+  // Write file
+  if (!WriteGLBFile(filename, gltf, nodes, scene_nodes)) return 0;
+
+  // Return number of faces written
+  return NWrittenFaces();
+}
+
+
+
+////////////////////////////////////////////////////////////
+// SCENE GLTF OUTPUT
+////////////////////////////////////////////////////////////
+
+int R3Scene::
+WriteGLB(const char *filename, bool instance_leaves)
+{
+  // Add every distinct tree once
+  R3GltfFile gltf;
+  vector<R3GltfTree> gltf_trees;
+  for (int i = 0; i < NTrees(); i++) {
+    gltf_trees.push_back(AppendTree(gltf, Tree(i), tree_names[i].c_str(), instance_leaves));
+  }
+
+  // Add a node for every placed tree, with a child node for each of its leaf shapes
+  std::string nodes, scene_nodes;
+  int nnodes = 0;
+  for (int i = 0; i < NInstances(); i++) {
+    const R3SceneInstance& instance = Instance(i);
+    const R3GltfTree& tree = gltf_trees[instance.tree];
+    if ((tree.mesh < 0) && tree.leaves.empty()) continue;
+    nodes += (nodes.empty()) ? "" : ",";
+    nodes += "{\"name\":\"" + tree_names[instance.tree] + "\"";
+    if (tree.mesh >= 0) nodes += ",\"mesh\":" + std::to_string(tree.mesh);
+    if (!tree.leaves.empty()) {
+      nodes += ",\"children\":[";
+      for (unsigned int k = 0; k < tree.leaves.size(); k++) nodes += ((k > 0) ? "," : "") + std::to_string(nnodes + 1 + k);
+      nodes += "]";
+    }
+    nodes += ",\"translation\":[";
+    for (int j = 0; j < 3; j++) { if (j > 0) nodes += ","; AppendNumber(nodes, instance.position[j]); }
+    nodes += "],\"rotation\":[0,";
+    AppendNumber(nodes, sin(instance.angle / 2));
+    nodes += ",0,";
+    AppendNumber(nodes, cos(instance.angle / 2));
+    nodes += "],\"scale\":[";
+    for (int j = 0; j < 3; j++) { if (j > 0) nodes += ","; AppendNumber(nodes, instance.scale); }
+    nodes += "]}";
+    scene_nodes += (scene_nodes.empty()) ? "" : ",";
+    scene_nodes += std::to_string(nnodes++);
+    for (unsigned int k = 0; k < tree.leaves.size(); k++) {
+      nodes += "," + LeavesNode(gltf, tree, k);
+      nnodes++;
+    }
+  }
+
+  // Write file
+  if (!WriteGLBFile(filename, gltf, nodes, scene_nodes)) return 0;
+
+  // Return number of placed trees written
+  return NInstances();
+}
@@ -0,0 +1,435 @@
+// Source file for binary PLY mesh files (.ply)
+//
+// Meshes are written as binary little endian PLY, with float vertex
+// properties x y z [nx ny nz] s t, and faces with a vertex_indices list
+// and a uchar leaf flag.  Any binary PLY can be read: vertex values that
+// are missing are zero, and other properties and elements are skipped.
+
+
+
+// Include files
+
+#include "R3Mesh.h"
+#include "R3MappedFile.h"
+#include <string>
+
+
+
+////////////////////////////////////////////////////////////
+// PLY UTILITY FUNCTIONS
+////////////////////////////////////////////////////////////
+
+// Property types
+enum {
+  R3ply_char, R3ply_uchar, R3ply_short, R3ply_ushort,
+  R3ply_int, R3ply_uint, R3ply_float, R3ply_double, R3ply_ntypes
+};
+
+static const char *R3ply_type_names[R3ply_ntypes][2] = {
+  { "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" }, { "ushort", "uint16" },
+  { "int", "int32" }, { "uint", "uint32" }, { "float", "float32" }, { "double", "float64" }
+};
+
+static const int R3ply_type_sizes[R3ply_ntypes] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+
+// Vertex values read into the mesh, with the property names used for each
+enum { R3ply_x, R3ply_y, R3ply_z, R3ply_nx, R3ply_ny, R3ply_nz, R3ply_s, R3ply_t, R3ply_nvalues };
+
+static const char *R3ply_value_names[R3ply_nvalues][3] = {
+  { "x", "x", "x" }, { "y", "y", "y" }, { "z", "z", "z" },
+  { "nx", "nx", "nx" }, { "ny", "ny", "ny" }, { "nz", "nz", "nz" },
+  { "s", "u", "texture_u" }, { "t", "v", "texture_v" }
+};
+
+struct R3PlyProperty {
+  std::string name;
+  int type;
+  int count_type;  // type of the list length, or -1 if not a list
+};
+
+struct R3PlyElement {
+  std::string name;
+  int count;
+  vector<R3PlyProperty> properties;
+};
+
+
+
+static bool
+HostIsLittleEndian(void)
+{
+  // Return whether numbers are stored little endian on this machine
+  unsigned int one = 1;
+  return *((unsigned char *) &one) == 1;
+}
+
+
+
+static int
+FindPlyType(const char *name)
+{
+  // Return the property type with this name (or -1)
+  for (int i = 0; i < R3ply_ntypes; i++) {
+    if (!strcmp(name, R3ply_type_names[i][0]) || !strcmp(name, R3ply_type_names[i][1])) return i;
+  }
+  return -1;
+}
+
+
+
+static int
+FindPlyValue(const std::string& name)
+{
+  // Return which vertex value a property holds (or -1)
+  for (int i = 0; i < R3ply_nvalues; i++) {
+    for (int j = 0; j < 3; j++) {
+      if (name == R3ply_value_names[i][j]) return i;
+    }
+  }
+  return -1;
+}
+
+
+
+static double
+ReadPlyValue(const unsigned char *p, int type, bool swap)
+{
+  // Get bytes in host order
+  unsigned char bytes[8];
+  int size = R3ply_type_sizes[type];
+  for (int i = 0; i < size; i++) bytes[i] = (swap) ? p[size-1-i] : p[i];
+
+  // Convert from the property type
+  switch (type) {
+  case R3ply_char: return (signed char) bytes[0];
+  case R3ply_uchar: return bytes[0];
+  case R3ply_short: { short v; memcpy(&v, bytes, 2); return v; }
+  case R3ply_ushort: { unsigned short v; memcpy(&v, bytes, 2); return v; }
+  case R3ply_int: { int v; memcpy(&v, bytes, 4); return v; }
+  case R3ply_uint: { unsigned int v; memcpy(&v, bytes, 4); return v; }
+  case R3ply_float: { float v; memcpy(&v, bytes, 4); return v; }
+  default: { double v; memcpy(&v, bytes, 8); return v; }
+  }
+}
+
+
+
+static bool
+ReadPlyHeader(const unsigned char *data, size_t size, vector<R3PlyElement>& elements,
+  bool *swap, size_t *data_offset)
+{
+  // Read header lines up to end_header
+  bool format = false;
+  size_t start = 0;
+  while (start < size) {
+    // Get next line
+    const unsigned char *end = (const unsigned char *) memchr(data + start, '\n', size - start);
+    if (!end) return false;
+    std::string line((const char *) data + start, end - data - start);
+    bool first_line = (start == 0);
+    start = end - data + 1;
+
+    // Split line into words
+    char word[5][64];
+    int nwords = sscanf(line.c_str(), "%63s%63s%63s%63s%63s", word[0], word[1], word[2], word[3], word[4]);
+    if (first_line && ((nwords != 1) || strcmp(word[0], "ply"))) return false;
+    if (nwords < 1) continue;
+
+    // Process keyword
+    if (!strcmp(word[0], "end_header")) {
+      *data_offset = start;
+      return format;
+    }
+    else if (!strcmp(word[0], "format")) {
+      // Only binary files are read
+      if (nwords < 2) return false;
+      if (!strcmp(word[1], "binary_little_endian")) *swap = !HostIsLittleEndian();
+      else if (!strcmp(word[1], "binary_big_endian")) *swap = HostIsLittleEndian();
+      else return false;
+      format = true;
+    }
+    else if (!strcmp(word[0], "element")) {
+      // Start element
+      if (nwords < 3) return false;
+      R3PlyElement element;
+      element.name = word[1];
+      element.count = atoi(word[2]);
+      if (element.count < 0) return false;
+      elements.push_back(element);
+    }
+    else if (!strcmp(word[0], "property")) {
+      // Add property to last element
+      if (elements.empty() || (nwords < 3)) return false;
+      R3PlyProperty property;
+      if (!strcmp(word[1], "list")) {
+        if (nwords < 5) return false;
+        property.count_type = FindPlyType(word[2]);
+        property.type = FindPlyType(word[3]);
+        property.name = word[4];
+        if (property.count_type < 0) return false;
+      }
+      else {
+        property.count_type = -1;
+        property.type = FindPlyType(word[1]);
+        property.name = word[2];
+      }
+      if (property.type < 0) return false;
+      elements.back().properties.push_back(property);
+    }
+  }
+
+  // Header has no end
+  return false;
+}
+
+
+
+static void
+AppendPlyWord(vector<unsigned char>& bytes, const void *word, int size)
+{
+  // Append a number in little endian order
+  const unsigned char *p = (const unsigned char *) word;
+  if (HostIsLittleEndian()) bytes.insert(bytes.end(), p, p + size);
+  else for (int i = size - 1; i >= 0; i--) bytes.push_back(p[i]);
+}
+
+
+
+////////////////////////////////////////////////////////////
+// MESH PLY FILE INPUT/OUTPUT
+////////////////////////////////////////////////////////////
+
+int R3Mesh::
+ReadPly(const char *filename)
+{
+  // Map file
+  R3MappedFile file;
+  if (!file.Open(filename)) return 0;
+  const unsigned char *data = file.data;
+  size_t size = file.size;
+
+  // Read header
+  vector<R3PlyElement> elements;
+  bool swap = false;
+  size_t offset = 0;
+  if (!ReadPlyHeader(data, size, elements, &swap, &offset)) {
+    fprintf(stderr, "File %s is not a binary PLY file\n", filename);
+    return 0;
+  }
+
+  // Read elements (vertices are only created once the faces are checked)
+  int first = NVertices();
+  int nvertices = -1;
+  size_t vertex_offset = 0, vertex_row_size = 0;
+  int value_offsets[R3ply_nvalues];
+  int value_types[R3ply_nvalues];
+  bool all_floats = true;
+  vector<unsigned int> indices;
+  vector<unsigned int> offsets(1, 0);
+  vector<unsigned char> leaf;
+  for (unsigned int e = 0; e < elements.size(); e++) {
+    const R3PlyElement& element = elements[e];
+    const vector<R3PlyProperty>& properties = element.properties;
+
+    // Find size of rows without lists
+    size_t row_size = 0;
+    bool fixed_size = true;
+    for (unsigned int i = 0; i < properties.size(); i++) {
+      if (properties[i].count_type >= 0) fixed_size = false;
+      else row_size += R3ply_type_sizes[properties[i].type];
+    }
+    if (fixed_size && (row_size > 0) && ((size - offset) / row_size < (size_t) element.count)) {
+      fprintf(stderr, "File %s ends before all %s elements\n", filename, element.name.c_str());
+      return 0;
+    }
+
+    if (element.name == "vertex") {
+      // Check vertex rows
+      if (!fixed_size || (nvertices >= 0)) {
+        fprintf(stderr, "Unable to read vertex element in file %s\n", filename);
+        return 0;
+      }
+
+      // Find where each value is in a row
+      for (int i = 0; i < R3ply_nvalues; i++) value_offsets[i] = -1;
+      for (unsigned int i = 0, row_offset = 0; i < properties.size(); i++) {
+        int value = FindPlyValue(properties[i].name);
+        if (value >= 0) {
+          value_offsets[value] = row_offset;
+          value_types[value] = properties[i].type;
+        }
+        if (properties[i].type != R3ply_float) all_floats = false;
+        row_offset += R3ply_type_sizes[properties[i].type];
+      }
+
+      // Remember where the rows are
+      nvertices = element.count;
+      vertex_offset = offset;
+      vertex_row_size = row_size;
+      offset += (size_t) element.count * row_size;
+    }
+    else if (fixed_size) {
+      // Skip other elements without lists
+      offset += element.count * row_size;
+    }
+    else {
+      // Read elements with lists row by row, keeping only faces
+      bool face = (element.name == "face");
+      for (int i = 0; i < element.count; i++) {
+        unsigned char isLeaf = 0;
+        bool has_indices = false;
+        for (unsigned int j = 0; j < properties.size(); j++) {
+          const R3PlyProperty& property = properties[j];
+          size_t value_size = R3ply_type_sizes[property.type];
+
+          // Read leaf flag
+          if (property.count_type < 0) {
+            if (value_size > size - offset) { offset = size + 1; break; }
+            if (face && ((property.name == "leaf") || (property.name == "isLeaf") || (property.name == "is_leaf"))) {
+              isLeaf = (ReadPlyValue(data + offset, property.type, swap) != 0);
+            }
+            offset += value_size;
+            continue;
+          }
+
+          // Read list length
+          size_t count_size = R3ply_type_sizes[property.count_type];
+          if (count_size > size - offset) { offset = size + 1; break; }
+          double count = ReadPlyValue(data + offset, property.count_type, swap);
+          offset += count_size;
+          if ((count < 0) || (count * value_size > size - offset)) { offset = size + 1; break; }
+
+          // Read vertex ids
+          if (face && !has_indices && ((property.name == "vertex_indices") || (property.name == "vertex_index"))) {
+            for (int k = 0; k < (int) count; k++) {
+              double id = ReadPlyValue(data + offset + k * value_size, property.type, swap);
+              if ((id < 0) || (id >= nvertices)) {
+                fprintf(stderr, "Invalid vertex id %g in file %s\n", id, filename);
+                return 0;
+              }
+              indices.push_back((unsigned int) id);
+            }
+            has_indices = true;
+          }
+          offset += (size_t) count * value_size;
+        }
+
+        // Check for end of file
+        if (offset > size) {
+          fprintf(stderr, "File %s ends before all %s elements\n", filename, element.name.c_str());
+          return 0;
+        }
+
+        // Add face
+        if (has_indices) {
+          offsets.push_back(indices.size());
+          leaf.push_back(isLeaf);
+        }
+      }
+    }
+  }
+
+  // Create vertices, reading rows of floats in host order straight from the file
+  vertices.reserve(first + std::max(nvertices, 0));
+  for (int i = 0; i < nvertices; i++) {
+    const unsigned char *row = data + vertex_offset + (size_t) i * vertex_row_size;
+    double values[R3ply_nvalues];
+    for (int j = 0; j < R3ply_nvalues; j++) {
+      if (value_offsets[j] < 0) values[j] = 0;
+      else if (all_floats && !swap) { float v; memcpy(&v, row + value_offsets[j], 4); values[j] = v; }
+      else values[j] = ReadPlyValue(row + value_offsets[j], value_types[j], swap);
+    }
+    CreateVertex(R3Point(values[R3ply_x], values[R3ply_y], values[R3ply_z]),
+      R3Vector(values[R3ply_nx], values[R3ply_ny], values[R3ply_nz]),
+      R2Point(values[R3ply_s], values[R3ply_t]));
+  }
+
+  // Create faces
+  int nfaces = leaf.size();
+  CreateFaces(indices.data(), offsets.data(), leaf.data(), nfaces, first);
+
+  // Return number of faces read
+  return nfaces;
+}
+
+
+
+int R3Mesh::
+WritePly(const char *filename)
+{
+  // Open file
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) {
+    fprintf(stderr, "Unable to open file %s\n", filename);
+    return 0;
+  }
+
+  // Check whether face vertex counts fit in a byte
+  bool byte_counts = true;
+  for (int i = 0; i < NFaces(); i++) {
+    if (Face(i)->vertices.size() > 255) { byte_counts = false; break; }
+  }
+
+  // Write header
+  bool normals = HasVertexNormals();
+  int nvertices = NWrittenVertices();
+  int nfaces = NWrittenFaces();
+  fprintf(fp, "ply\n");
+  fprintf(fp, "format binary_little_endian 1.0\n");
+  fprintf(fp, "element vertex %d\n", nvertices);
+  fprintf(fp, "property float x\nproperty float y\nproperty float z\n");
+  if (normals) fprintf(fp, "property float nx\nproperty float ny\nproperty float nz\n");
+  fprintf(fp, "property float s\nproperty float t\n");
+  fprintf(fp, "element face %d\n", nfaces);
+  fprintf(fp, "property list %s int vertex_indices\n", (byte_counts) ? "uchar" : "uint");
+  fprintf(fp, "property uchar leaf\n");
+  fprintf(fp, "end_header\n");
+
+  // Write vertex rows
+  for (int i = 0; i < NVertices(); i++) Vertex(i)->id = i;
+  vector<unsigned char> bytes;
+  bytes.reserve((size_t) nvertices * ((normals) ? 32 : 20));
+  for (int i = 0; i < nvertices; i++) {
+    R3Point position = WrittenPosition(i);
+    R2Point texcoords = WrittenTexCoords(i);
+    float row[8];
+    int n = 0;
+    row[n++] = position.X();
+    row[n++] = position.Y();
+    row[n++] = position.Z();
+    if (normals) {
+      R3Vector normal = WrittenNormal(i);
+      row[n++] = normal.X();
+      row[n++] = normal.Y();
+      row[n++] = normal.Z();
+    }
+    row[n++] = texcoords.X();
+    row[n++] = texcoords.Y();
+    for (int j = 0; j < n; j++) AppendPlyWord(bytes, &row[j], 4);
+  }
+  fwrite(bytes.data(), 1, bytes.size(), fp);
+
+  // Write face rows (packed triangles, faces, then triangles)
+  bytes.clear();
+  for (int i = 0; i < nfaces; i++) {
+    unsigned int nverts = NWrittenFaceVertices(i);
+    if (byte_counts) bytes.push_back(nverts);
+    else AppendPlyWord(bytes, &nverts, 4);
+    for (unsigned int j = 0; j < nverts; j++) {
+      unsigned int id = WrittenFaceVertex(i, j);
+      AppendPlyWord(bytes, &id, 4);
+    }
+    bytes.push_back(IsLeafWrittenFace(i));
+  }
+  fwrite(bytes.data(), 1, bytes.size(), fp);
+
+  // Close file
+  bool error = ferror(fp);
+  if (fclose(fp) || error) {
+    fprintf(stderr, "Unable to write file %s\n", filename);
+    return 0;
+  }
+
+  // Return number of faces written
+  return nfaces;
+}
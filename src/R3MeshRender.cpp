@@ -0,0 +1,599 @@
+// Source file for the software mesh renderer
+
+
+
+// Include files
+
+#include "R3MeshRender.h"
+#include "R2/R2Image.h"
+#include <algorithm>
+extern "C" {
+#   define XMD_H // Otherwise, a conflict with INT32
+#   undef FAR // Otherwise, a conflict with windows.h
+#   include "jpeg/jpeglib.h"
+};
+
+
+
+////////////////////////////////////////////////////////////
+// PRIVATE TYPES
+////////////////////////////////////////////////////////////
+
+// One fan triangle of a face, triangle or packed triangle (numbered like
+// the elements of R3MeshBVH: faces, then triangles, then packed triangles)
+struct R3MeshRenderItem {
+  int element;
+  int corner;
+};
+
+// A triangle corner in camera coordinates (x right, y up, w the distance
+// in front of the eye), with its lit color and texture coordinates
+struct R3MeshRenderVertex {
+  double x, y, w;
+  double color;
+  double u, v;
+};
+
+// A triangle set up for filling in window coordinates: the edge function
+// of the edge opposite each corner, whether the edge is a top or left
+// edge, the planes of 1/w and of color, u and v divided by w, and the
+// pixels it may cover
+struct R3MeshRenderTriangle {
+  double edges[3][3];
+  bool top_left[3];
+  double planes[4][3];
+  int xmin, ymin, xmax, ymax;
+};
+
+// The camera and viewport
+struct R3MeshRenderView {
+  R3Point eye;
+  R3Vector right, up, towards;
+  double xscale, yscale;
+  double near_w, far_q;
+  int width, height;
+};
+
+
+
+////////////////////////////////////////////////////////////
+// RENDERER CONSTRUCTORS
+////////////////////////////////////////////////////////////
+
+R3MeshRenderer::
+R3MeshRenderer(int width, int height)
+  : width(width),
+    height(height),
+    pixels(3 * width * height),
+    depths(width * height),
+    eye(0, 0, 4),
+    towards(0, 0, 1),
+    up(0, 1, 0),
+    yfov(0.75)
+{
+  // Start with a blank image
+  Clear();
+}
+
+
+
+////////////////////////////////////////////////////////////
+// CAMERA FUNCTIONS
+////////////////////////////////////////////////////////////
+
+void R3MeshRenderer::
+SetCamera(const R3Point& eye, const R3Vector& towards, const R3Vector& up, double yfov)
+{
+  // Set camera
+  this->eye = eye;
+  this->towards = towards;
+  this->up = up;
+  this->yfov = yfov;
+}
+
+
+
+void R3MeshRenderer::
+FitCamera(R3Mesh *mesh)
+{
+  // Look at the mesh from the front, as meshview starts out
+  towards = R3Vector(0, 0, 1);
+  up = R3Vector(0, 1, 0);
+  yfov = 0.75;
+  eye = mesh->Center() + towards * 2.5 * mesh->Radius();
+}
+
+
+
+////////////////////////////////////////////////////////////
+// TEXTURE FUNCTIONS
+////////////////////////////////////////////////////////////
+
+int R3MeshRenderer::
+ReadTexture(int material, const char *filename)
+{
+  // Read texture with its mipmap levels
+  return textures[material].Read(filename);
+}
+
+
+
+int R3MeshRenderer::
+ReadTextures(const char *bark_filename, const char *leaf_filename)
+{
+  // Read the textures for bark and leaves
+  int status = 1;
+  if (!ReadTexture(R3_MESH_RENDER_BARK, bark_filename)) status = 0;
+  if (!ReadTexture(R3_MESH_RENDER_LEAF, leaf_filename)) status = 0;
+  return status;
+}
+
+
+
+////////////////////////////////////////////////////////////
+// TRIANGLE SETUP
+////////////////////////////////////////////////////////////
+
+static void
+ItemVertices(R3Mesh *mesh, const R3MeshRenderItem& item, R3Point *p, R3Vector *n, R2Point *t)
+{
+  // Get a fan triangle of a face, giving vertices without normals the face normal
+  int k = item.element;
+  if (k < mesh->NFaces()) {
+    R3MeshFace *face = mesh->Face(k);
+    R3MeshVertex *v[3] = { face->vertices[0], face->vertices[item.corner + 1], face->vertices[item.corner + 2] };
+    for (int j = 0; j < 3; j++) {
+      p[j] = v[j]->position;
+      n[j] = (v[j]->normal.IsZero()) ? face->plane.Normal() : v[j]->normal;
+      t[j] = v[j]->texcoords;
+    }
+    return;
+  }
+
+  // Get a triangle or packed triangle
+  k -= mesh->NFaces();
+  if (k < mesh->NTriangles()) {
+    const unsigned int *triangle = mesh->Triangle(k);
+    for (int j = 0; j < 3; j++) {
+      R3MeshVertex *v = mesh->Vertex(triangle[j]);
+      p[j] = v->position;
+      n[j] = v->normal;
+      t[j] = v->texcoords;
+    }
+  }
+  else {
+    const unsigned int *triangle = mesh->PackedTriangle(k - mesh->NTriangles());
+    for (int j = 0; j < 3; j++) {
+      const R3MeshPackedBlock& block = mesh->PackedBlock(triangle[j]);
+      const R3MeshPackedVertex& vertex = mesh->PackedVertex(triangle[j]);
+      p[j] = block.Position(vertex);
+      n[j] = block.Normal(vertex);
+      t[j] = block.TexCoords(vertex);
+    }
+  }
+
+  // Give vertices without normals the triangle normal
+  R3Vector normal = (p[1] - p[0]) % (p[2] - p[0]);
+  normal.Normalize();
+  for (int j = 0; j < 3; j++) {
+    if (n[j].IsZero()) n[j] = normal;
+  }
+}
+
+
+
+static double
+Shade(const R3Point& p, R3Vector n, const R3Point& eye)
+{
+  // Light like meshview sets up OpenGL: ambient light 0.2, a white
+  // directional light from (3,4,5) with highlights, a half-white one
+  // from (-3,-2,-3), a local viewer, and a material with ambient and
+  // diffuse 0.8, specular 0.2 and shininess 64
+  static const R3Vector light0(3 / sqrt(50.0), 4 / sqrt(50.0), 5 / sqrt(50.0));
+  static const R3Vector light1(-3 / sqrt(22.0), -2 / sqrt(22.0), -3 / sqrt(22.0));
+  if (!n.IsZero()) n.Normalize();
+  double color = 0.2 * 0.8;
+  double d0 = n.Dot(light0);
+  if (d0 > 0) {
+    color += 0.8 * d0;
+    R3Vector v = eye - p;
+    v.Normalize();
+    R3Vector h = light0 + v;
+    h.Normalize();
+    double s = n.Dot(h);
+    if (s > 0) color += 0.2 * pow(s, 64);
+  }
+  double d1 = n.Dot(light1);
+  if (d1 > 0) color += 0.5 * 0.8 * d1;
+  return (color < 1) ? color : 1;
+}
+
+
+
+static bool
+SetupTriangle(const R3MeshRenderView& view, const R3MeshRenderVertex *v0,
+  const R3MeshRenderVertex *v1, const R3MeshRenderVertex *v2, R3MeshRenderTriangle *triangle)
+{
+  // Project corners to window coordinates
+  const R3MeshRenderVertex *v[3] = { v0, v1, v2 };
+  double x[3], y[3];
+  for (int i = 0; i < 3; i++) {
+    x[i] = (view.xscale * v[i]->x / v[i]->w + 1) * 0.5 * view.width;
+    y[i] = (view.yscale * v[i]->y / v[i]->w + 1) * 0.5 * view.height;
+  }
+
+  // Make corners counterclockwise (both sides are drawn), skipping degenerate triangles
+  double area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+  if (area == 0) return false;
+  if (area < 0) {
+    std::swap(v[1], v[2]);
+    std::swap(x[1], x[2]);
+    std::swap(y[1], y[2]);
+    area = -area;
+  }
+
+  // Make the edge function of the edge opposite each corner, which is area at the corner
+  for (int i = 0; i < 3; i++) {
+    int j = (i + 1) % 3, k = (i + 2) % 3;
+    double *edge = triangle->edges[i];
+    edge[0] = y[j] - y[k];
+    edge[1] = x[k] - x[j];
+    edge[2] = -(edge[0] * x[j] + edge[1] * y[j]);
+    triangle->top_left[i] = (y[k] < y[j]) || ((y[k] == y[j]) && (x[k] < x[j]));
+  }
+
+  // Make planes of the values interpolated linearly in window coordinates
+  for (int m = 0; m < 4; m++) {
+    double *plane = triangle->planes[m];
+    plane[0] = plane[1] = plane[2] = 0;
+    for (int i = 0; i < 3; i++) {
+      double q = 1 / v[i]->w;
+      double value = (m == 0) ? q : q * ((m == 1) ? v[i]->color : (m == 2) ? v[i]->u : v[i]->v);
+      for (int c = 0; c < 3; c++) plane[c] += value * triangle->edges[i][c] / area;
+    }
+  }
+
+  // Find the pixels whose centers may be covered
+  double xmin = std::min(x[0], std::min(x[1], x[2]));
+  double xmax = std::max(x[0], std::max(x[1], x[2]));
+  double ymin = std::min(y[0], std::min(y[1], y[2]));
+  double ymax = std::max(y[0], std::max(y[1], y[2]));
+  if ((xmax < 0) || (ymax < 0) || (xmin > view.width) || (ymin > view.height)) return false;
+  triangle->xmin = std::max(0, (int) ceil(xmin - 0.5));
+  triangle->ymin = std::max(0, (int) ceil(ymin - 0.5));
+  triangle->xmax = std::min(view.width - 1, (int) floor(xmax - 0.5));
+  triangle->ymax = std::min(view.height - 1, (int) floor(ymax - 0.5));
+  return (triangle->xmin <= triangle->xmax) && (triangle->ymin <= triangle->ymax);
+}
+
+
+
+static int
+SetupItem(R3Mesh *mesh, const R3MeshRenderItem& item, const R3MeshRenderView& view, R3MeshRenderTriangle *triangles)
+{
+  // Light corners and move them into camera coordinates
+  R3Point p[3];
+  R3Vector n[3];
+  R2Point t[3];
+  ItemVertices(mesh, item, p, n, t);
+  R3MeshRenderVertex v[3];
+  for (int i = 0; i < 3; i++) {
+    R3Vector d = p[i] - view.eye;
+    v[i].x = view.right.Dot(d);
+    v[i].y = view.up.Dot(d);
+    v[i].w = -view.towards.Dot(d);
+    v[i].color = Shade(p[i], n[i], view.eye);
+    v[i].u = t[i].X();
+    v[i].v = t[i].Y();
+  }
+
+  // Clip to the near plane, leaving a polygon of up to four corners
+  R3MeshRenderVertex polygon[4];
+  int npolygon = 0;
+  for (int i = 0; i < 3; i++) {
+    const R3MeshRenderVertex& a = v[i];
+    const R3MeshRenderVertex& b = v[(i + 1) % 3];
+    if (a.w >= view.near_w) polygon[npolygon++] = a;
+    if ((a.w >= view.near_w) != (b.w >= view.near_w)) {
+      double s = (view.near_w - a.w) / (b.w - a.w);
+      R3MeshRenderVertex& c = polygon[npolygon++];
+      c.x = a.x + s * (b.x - a.x);
+      c.y = a.y + s * (b.y - a.y);
+      c.w = view.near_w;
+      c.color = a.color + s * (b.color - a.color);
+      c.u = a.u + s * (b.u - a.u);
+      c.v = a.v + s * (b.v - a.v);
+    }
+  }
+
+  // Set up the polygon as a fan of triangles
+  int ntriangles = 0;
+  for (int i = 2; i < npolygon; i++) {
+    if (SetupTriangle(view, &polygon[0], &polygon[i-1], &polygon[i], &triangles[ntriangles])) ntriangles++;
+  }
+  return ntriangles;
+}
+
+
+
+////////////////////////////////////////////////////////////
+// TRIANGLE FILLING
+////////////////////////////////////////////////////////////
+
+static void
+SampleTexture(const R3MeshTexture& texture, double u, double v, double rho, double *rgb)
+{
+  // Pick the nearest mipmap level for the footprint of the pixel
+  // (GL_LINEAR_MIPMAP_NEAREST), with rho in texels of the first level
+  int level = 0;
+  if (rho > 1) level = std::min((int) texture.levels.size() - 1, (int) ceil(log2(rho) + 0.5) - 1);
+
+  // Blend the four nearest texels, repeating the texture
+  int w = texture.widths[level];
+  int h = texture.heights[level];
+  double s = u * w - 0.5, t = v * h - 0.5;
+  double fs = floor(s), ft = floor(t);
+  double a = s - fs, b = t - ft;
+  int i0 = (((int) fs) % w + w) % w, i1 = (i0 + 1) % w;
+  int j0 = (((int) ft) % h + h) % h, j1 = (j0 + 1) % h;
+  const unsigned char *data = texture.levels[level].data();
+  const unsigned char *t00 = &data[3 * (j0*w + i0)];
+  const unsigned char *t10 = &data[3 * (j0*w + i1)];
+  const unsigned char *t01 = &data[3 * (j1*w + i0)];
+  const unsigned char *t11 = &data[3 * (j1*w + i1)];
+  for (int k = 0; k < 3; k++) {
+    double value = (1 - b) * ((1 - a) * t00[k] + a * t10[k]) + b * ((1 - a) * t01[k] + a * t11[k]);
+    rgb[k] = value / 255.0;
+  }
+}
+
+
+
+static void
+FillTriangle(const R3MeshRenderTriangle& triangle, const R3MeshTexture& texture, const R3MeshRenderView& view,
+  int xmin, int ymin, int xmax, int ymax, unsigned char *pixels, float *depths)
+{
+  // Fill the pixels of a tile whose centers are inside the triangle and
+  // nearer than what is there (rows counted from the bottom)
+  xmin = std::max(xmin, triangle.xmin);
+  ymin = std::max(ymin, triangle.ymin);
+  xmax = std::min(xmax, triangle.xmax);
+  ymax = std::min(ymax, triangle.ymax);
+  const double (*planes)[3] = triangle.planes;
+  bool textured = !texture.levels.empty();
+  for (int j = ymin; j <= ymax; j++) {
+    double py = j + 0.5;
+    int row = view.height - 1 - j;
+    for (int i = xmin; i <= xmax; i++) {
+      double px = i + 0.5;
+
+      // Check coverage
+      bool inside = true;
+      for (int k = 0; k < 3; k++) {
+        double e = triangle.edges[k][0] * px + triangle.edges[k][1] * py + triangle.edges[k][2];
+        if ((e < 0) || ((e == 0) && !triangle.top_left[k])) { inside = false; break; }
+      }
+      if (!inside) continue;
+
+      // Check depth (larger 1/w is nearer)
+      double q = planes[0][0] * px + planes[0][1] * py + planes[0][2];
+      float& depth = depths[row * view.width + i];
+      if ((q <= depth) || (q < view.far_q)) continue;
+      depth = q;
+
+      // Interpolate lit color
+      double color = (planes[1][0] * px + planes[1][1] * py + planes[1][2]) / q;
+      double rgb[3] = { color, color, color };
+
+      // Modulate by the texture, with the texel footprint from the
+      // derivatives of the perspective-correct texture coordinates
+      if (textured) {
+        double u = (planes[2][0] * px + planes[2][1] * py + planes[2][2]) / q;
+        double v = (planes[3][0] * px + planes[3][1] * py + planes[3][2]) / q;
+        double dudx = texture.widths[0] * (planes[2][0] - u * planes[0][0]) / q;
+        double dudy = texture.widths[0] * (planes[2][1] - u * planes[0][1]) / q;
+        double dvdx = texture.heights[0] * (planes[3][0] - v * planes[0][0]) / q;
+        double dvdy = texture.heights[0] * (planes[3][1] - v * planes[0][1]) / q;
+        double rho = std::max(sqrt(dudx*dudx + dvdx*dvdx), sqrt(dudy*dudy + dvdy*dvdy));
+        double texel[3];
+        SampleTexture(texture, u, v, rho, texel);
+        for (int k = 0; k < 3; k++) rgb[k] *= texel[k];
+      }
+
+      // Write pixel
+      unsigned char *pixel = &pixels[3 * (row * view.width + i)];
+      for (int k = 0; k < 3; k++) {
+        double value = std::min(1.0, std::max(0.0, rgb[k]));
+        pixel[k] = (unsigned char) (255 * value + 0.5);
+      }
+    }
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////
+// RENDERING FUNCTIONS
+////////////////////////////////////////////////////////////
+
+void R3MeshRenderer::
+Clear(void)
+{
+  // Clear to white and to infinitely far
+  std::fill(pixels.begin(), pixels.end(), 255);
+  std::fill(depths.begin(), depths.end(), 0.0F);
+}
+
+
+
+void R3MeshRenderer::
+Render(R3Mesh *mesh, R3ThreadPool *pool)
+{
+  // Use a pool of all cores if none is given
+  R3ThreadPool local_pool((pool) ? 1 : 0);
+  R3ThreadPool& threads = (pool) ? *pool : local_pool;
+
+  // Set up the camera like meshview (near and far planes from the mesh size)
+  Clear();
+  R3MeshRenderView view;
+  view.eye = eye;
+  view.towards = towards;
+  view.towards.Normalize();
+  view.right = up % towards;
+  view.right.Normalize();
+  view.up = view.towards % view.right;
+  view.yscale = 1 / tan(0.5 * yfov);
+  view.xscale = view.yscale * height / width;
+  view.near_w = 0.01 * mesh->Radius();
+  view.far_q = 1 / (100 * mesh->Radius());
+  view.width = width;
+  view.height = height;
+
+  // Make lists of bark and leaf triangles, in the order meshview draws them
+  vector<R3MeshRenderItem> items[R3_MESH_RENDER_NUM_MATERIALS];
+  for (int i = 0; i < mesh->NFaces(); i++) {
+    R3MeshFace *face = mesh->Face(i);
+    int material = (face->isLeaf) ? R3_MESH_RENDER_LEAF : R3_MESH_RENDER_BARK;
+    for (int j = 0; j + 2 < (int) face->vertices.size(); j++) {
+      R3MeshRenderItem item = { i, j };
+      items[material].push_back(item);
+    }
+  }
+  for (int i = 0; i < mesh->NTriangles(); i++) {
+    int material = (mesh->IsLeafTriangle(i)) ? R3_MESH_RENDER_LEAF : R3_MESH_RENDER_BARK;
+    R3MeshRenderItem item = { mesh->NFaces() + i, 0 };
+    items[material].push_back(item);
+  }
+  for (int i = 0; i < mesh->NPackedTriangles(); i++) {
+    int material = (mesh->IsLeafPackedTriangle(i)) ? R3_MESH_RENDER_LEAF : R3_MESH_RENDER_BARK;
+    R3MeshRenderItem item = { mesh->NFaces() + mesh->NTriangles() + i, 0 };
+    items[material].push_back(item);
+  }
+
+  // Draw batches of triangles, bark first
+  int tile_size = R3_MESH_RENDER_TILE_SIZE;
+  int ntiles_x = (width + tile_size - 1) / tile_size;
+  int ntiles_y = (height + tile_size - 1) / tile_size;
+  vector<vector<int> > tiles(ntiles_x * ntiles_y);
+  vector<R3MeshRenderTriangle> triangles(2 * R3_MESH_RENDER_BATCH_SIZE);
+  vector<int> ntriangles(R3_MESH_RENDER_BATCH_SIZE);
+  for (int material = 0; material < R3_MESH_RENDER_NUM_MATERIALS; material++) {
+    const vector<R3MeshRenderItem>& list = items[material];
+    for (int first = 0; first < (int) list.size(); first += R3_MESH_RENDER_BATCH_SIZE) {
+      int count = std::min(R3_MESH_RENDER_BATCH_SIZE, (int) list.size() - first);
+
+      // Light, clip and set up triangles on all threads (each item makes
+      // at most two after clipping)
+      threads.RunChunks(count, 1024, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+          ntriangles[i] = SetupItem(mesh, list[first + i], view, &triangles[2*i]);
+        }
+      });
+
+      // Sort triangles into the tiles they overlap, keeping their order
+      for (unsigned int k = 0; k < tiles.size(); k++) tiles[k].clear();
+      for (int i = 0; i < count; i++) {
+        for (int t = 0; t < ntriangles[i]; t++) {
+          const R3MeshRenderTriangle& triangle = triangles[2*i + t];
+          for (int ty = triangle.ymin / tile_size; ty <= triangle.ymax / tile_size; ty++) {
+            for (int tx = triangle.xmin / tile_size; tx <= triangle.xmax / tile_size; tx++) {
+              tiles[ty * ntiles_x + tx].push_back(2*i + t);
+            }
+          }
+        }
+      }
+
+      // Fill tiles on all threads
+      threads.Run(tiles.size(), [&](int k, int thread) {
+        int x0 = (k % ntiles_x) * tile_size;
+        int y0 = (k / ntiles_x) * tile_size;
+        int x1 = std::min(width, x0 + tile_size) - 1;
+        int y1 = std::min(height, y0 + tile_size) - 1;
+        for (unsigned int i = 0; i < tiles[k].size(); i++) {
+          FillTriangle(triangles[tiles[k][i]], textures[material], view, x0, y0, x1, y1, pixels.data(), depths.data());
+        }
+      });
+    }
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////
+// OUTPUT FUNCTIONS
+////////////////////////////////////////////////////////////
+
+int R3MeshRenderer::
+WriteImage(const char *filename) const
+{
+  // Write pixels
+  return WriteImage(filename, pixels.data(), width, height);
+}
+
+
+
+int R3MeshRenderer::
+WriteImage(const char *filename, const unsigned char *pixels, int width, int height, bool bottom_up)
+{
+  // Write JPEG directly from the pixels
+  const char *extension = strrchr(filename, '.');
+  if (extension && (!strcmp(extension, ".jpg") || !strcmp(extension, ".jpeg"))) {
+    return WriteJPEG(filename, pixels, width, height, bottom_up);
+  }
+
+  // Write other formats through an image (whose first row is the bottom)
+  R2Image image(width, height);
+  for (int j = 0; j < height; j++) {
+    const unsigned char *row = &pixels[3 * ((bottom_up) ? j : height - 1 - j) * width];
+    for (int i = 0; i < width; i++) {
+      image.SetPixel(i, j, R2Pixel(row[3*i] / 255.0, row[3*i+1] / 255.0, row[3*i+2] / 255.0, 1));
+    }
+  }
+  return image.Write(filename);
+}
+
+
+
+int R3MeshRenderer::
+WriteJPEG(const char *filename, const unsigned char *pixels, int width, int height, bool bottom_up, int quality)
+{
+  // Open file
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) {
+    fprintf(stderr, "Unable to open image file: %s\n", filename);
+    return 0;
+  }
+
+  // Initialize compression info
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+  jpeg_stdio_dest(&cinfo, fp);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  cinfo.dct_method = JDCT_ISLOW;
+  jpeg_set_defaults(&cinfo);
+  cinfo.optimize_coding = TRUE;
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+
+  // Hand rows to the encoder straight from the pixels, top row first
+  while (cinfo.next_scanline < cinfo.image_height) {
+    int j = (bottom_up) ? height - 1 - cinfo.next_scanline : cinfo.next_scanline;
+    JSAMPROW row = (JSAMPROW) &pixels[3 * j * width];
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+
+  // Finish compression
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+
+  // Close file
+  fclose(fp);
+
+  // Return success
+  return 1;
+}
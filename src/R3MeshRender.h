@@ -0,0 +1,81 @@
+#ifndef R3MESHRENDER_H
+#define R3MESHRENDER_H
+// Include file for the software mesh renderer
+//
+// The renderer draws the faces of a mesh into an image in memory the way
+// meshview draws them: with the same camera, lights and material, with
+// bark and leaf textures modulating the lit color, and with a z-buffer
+// and perspective-correct, mipmapped texture lookups.  It needs no
+// display or OpenGL, so meshpro can write pictures of trees directly.
+//
+// The image is divided into tiles.  Triangles are lit, clipped and set
+// up in batches on all threads of a pool and sorted into the tiles they
+// overlap, and then the tiles are filled on all threads.  Every tile
+// draws its triangles in mesh order, so the image does not depend on
+// the number of threads.
+
+
+
+////////////////////////////////////////////////////////////
+// DEPENDENCY INCLUDE FILES
+////////////////////////////////////////////////////////////
+
+#include "R3Mesh.h"
+#include "R3MeshTexture.h"
+#include "R3ThreadPool.h"
+
+
+
+////////////////////////////////////////////////////////////
+// MESH RENDERER DECLARATION
+////////////////////////////////////////////////////////////
+
+// Materials (leaf faces use the leaf texture, all others the bark texture)
+#define R3_MESH_RENDER_BARK 0
+#define R3_MESH_RENDER_LEAF 1
+#define R3_MESH_RENDER_NUM_MATERIALS 2
+
+// Width and height of tiles, and number of triangles set up at a time
+#define R3_MESH_RENDER_TILE_SIZE 32
+#define R3_MESH_RENDER_BATCH_SIZE 32768
+
+struct R3MeshRenderer {
+  // Constructors
+  R3MeshRenderer(int width=800, int height=800);
+
+  // Camera functions (as in meshview, the camera looks along -towards,
+  // and yfov is the vertical field of view in radians)
+  void SetCamera(const R3Point& eye, const R3Vector& towards, const R3Vector& up, double yfov=0.75);
+  void FitCamera(R3Mesh *mesh);
+
+  // Texture functions (a missing texture leaves its faces untextured)
+  int ReadTexture(int material, const char *filename);
+  int ReadTextures(const char *bark_filename=R3_MESH_BARK_TEXTURE, const char *leaf_filename=R3_MESH_LEAF_TEXTURE);
+
+  // Rendering functions
+  void Clear(void);
+  void Render(R3Mesh *mesh, R3ThreadPool *pool=NULL);
+
+  // Output functions (pixels are 8-bit RGB, rows from the top, or from
+  // the bottom as OpenGL reads them)
+  int WriteImage(const char *filename) const;
+  static int WriteImage(const char *filename, const unsigned char *pixels, int width, int height,
+    bool bottom_up=false);
+  static int WriteJPEG(const char *filename, const unsigned char *pixels, int width, int height,
+    bool bottom_up=false, int quality=75);
+
+  // Data
+  int width;
+  int height;
+  vector<unsigned char> pixels;
+  vector<float> depths;
+  R3Point eye;
+  R3Vector towards;
+  R3Vector up;
+  double yfov;
+  R3MeshTexture textures[R3_MESH_RENDER_NUM_MATERIALS];
+};
+
+
+
+#endif
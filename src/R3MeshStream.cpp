@@ -0,0 +1,177 @@
+// Source file for streaming mesh output
+
+
+
+// Include files
+
+#include "R3MeshStream.h"
+
+
+
+////////////////////////////////////////////////////////////
+// MESH STREAM CONSTANTS
+////////////////////////////////////////////////////////////
+
+// Most blocks of text waiting for the writer, which bounds memory use
+static const unsigned int R3mesh_stream_queue_size = 16;
+
+// Size of the buffer used to copy temporary files into the output file
+static const size_t R3mesh_stream_copy_size = 1 << 20;
+
+
+
+////////////////////////////////////////////////////////////
+// MESH STREAM MEMBER FUNCTIONS
+////////////////////////////////////////////////////////////
+
+R3MeshStream::
+R3MeshStream(int format, bool normals)
+: format(format),
+normals(normals),
+nvertices(0),
+nfaces(0),
+closing(false),
+error(false)
+{
+  section_files[0] = section_files[1] = NULL;
+}
+
+
+
+R3MeshStream::
+~R3MeshStream(void)
+{
+  // Stop writer
+  if (writer.joinable()) {
+    { std::lock_guard<std::mutex> lock(mutex); closing = true; }
+    changed.notify_all();
+    writer.join();
+  }
+
+  // Remove temporary files of a stream that was not closed
+  for (int i = 0; i < 2; i++) {
+    if (!section_files[i]) continue;
+    fclose(section_files[i]);
+    remove(section_filenames[i].c_str());
+  }
+}
+
+
+
+int R3MeshStream::
+Open(const char *filename)
+{
+  // Create temporary files for vertices and faces
+  this->filename = filename;
+  section_filenames[R3_MESH_STREAM_VERTICES] = this->filename + ".vertices";
+  section_filenames[R3_MESH_STREAM_FACES] = this->filename + ".faces";
+  for (int i = 0; i < 2; i++) {
+    section_files[i] = fopen(section_filenames[i].c_str(), "w+b");
+    if (!section_files[i]) {
+      fprintf(stderr, "Unable to open file %s\n", section_filenames[i].c_str());
+      return 0;
+    }
+  }
+
+  // Start writer
+  writer = std::thread(&R3MeshStream::WriteQueue, this);
+
+  // Return success
+  return 1;
+}
+
+
+
+void R3MeshStream::
+Write(int section, std::vector<char>& text, size_t size)
+{
+  // Wait for room in the queue
+  std::unique_lock<std::mutex> lock(mutex);
+  changed.wait(lock, [this]() { return queue.size() < R3mesh_stream_queue_size; });
+
+  // Hand the text to the writer, and give the caller an empty buffer in its place
+  queue.push_back(Block());
+  queue.back().section = section;
+  queue.back().size = size;
+  queue.back().text.swap(text);
+  if (!spare_text.empty()) {
+    text.swap(spare_text.back());
+    spare_text.pop_back();
+  }
+  lock.unlock();
+  changed.notify_all();
+}
+
+
+
+void R3MeshStream::
+WriteQueue(void)
+{
+  // Write blocks of text until the stream is closed and the queue is empty
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    changed.wait(lock, [this]() { return closing || !queue.empty(); });
+    if (queue.empty()) break;
+    Block block;
+    block.section = queue.front().section;
+    block.size = queue.front().size;
+    block.text.swap(queue.front().text);
+    queue.pop_front();
+    lock.unlock();
+    changed.notify_all();
+
+    // Write without holding the lock, so generation can continue
+    bool ok = (fwrite(block.text.data(), 1, block.size, section_files[block.section]) == block.size);
+
+    // Keep the buffer for reuse
+    lock.lock();
+    if (!ok) error = true;
+    spare_text.push_back(std::vector<char>());
+    spare_text.back().swap(block.text);
+  }
+}
+
+
+
+int R3MeshStream::
+Close(const std::string& header)
+{
+  // Wait for writer to finish the queue
+  { std::lock_guard<std::mutex> lock(mutex); closing = true; }
+  changed.notify_all();
+  writer.join();
+
+  // Open output file
+  FILE *fp = fopen(filename.c_str(), "wb");
+  if (!fp) {
+    fprintf(stderr, "Unable to open file %s\n", filename.c_str());
+    return 0;
+  }
+
+  // Write header, then vertices, then faces
+  fwrite(header.data(), 1, header.size(), fp);
+  std::vector<char> buffer(R3mesh_stream_copy_size);
+  for (int i = 0; i < 2; i++) {
+    FILE *section_fp = section_files[i];
+    if (fflush(section_fp) || fseek(section_fp, 0, SEEK_SET)) error = true;
+    size_t n;
+    while ((n = fread(buffer.data(), 1, buffer.size(), section_fp)) > 0) {
+      if (fwrite(buffer.data(), 1, n, fp) != n) error = true;
+    }
+    if (ferror(section_fp)) error = true;
+    fclose(section_fp);
+    remove(section_filenames[i].c_str());
+    section_files[i] = NULL;
+  }
+
+  // Close output file
+  if (ferror(fp)) error = true;
+  if (fclose(fp)) error = true;
+  if (error) {
+    fprintf(stderr, "Unable to write file %s\n", filename.c_str());
+    return 0;
+  }
+
+  // Return success
+  return 1;
+}
@@ -0,0 +1,71 @@
+#ifndef R3MESHSTREAM_H
+#define R3MESHSTREAM_H
+// Include file for streaming mesh output
+//
+// A mesh stream collects the text of vertices and of faces in two
+// temporary files next to the output file, written by a background
+// thread while the mesh is still being generated.  Closing the stream
+// writes the header and then both temporary files into the output file.
+
+
+
+////////////////////////////////////////////////////////////
+// DEPENDENCY INCLUDE FILES
+////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+
+////////////////////////////////////////////////////////////
+// MESH STREAM DECLARATION
+////////////////////////////////////////////////////////////
+
+// Sections of a mesh stream
+#define R3_MESH_STREAM_VERTICES 0
+#define R3_MESH_STREAM_FACES    1
+
+struct R3MeshStream {
+  // Constructors
+  R3MeshStream(int format, bool normals);
+  ~R3MeshStream(void);
+
+  // Stream functions
+  int Open(const char *filename);
+  void Write(int section, std::vector<char>& text, size_t size);
+  int Close(const std::string& header);
+
+  // Writer thread function
+  void WriteQueue(void);
+
+  // Data
+  int format;
+  bool normals;
+  int nvertices;
+  int nfaces;
+  std::vector<char> vertex_text;
+  std::vector<char> face_text;
+  std::string filename;
+  std::string section_filenames[2];
+  FILE *section_files[2];
+
+  // Writer thread data
+  struct Block { int section; size_t size; std::vector<char> text; };
+  std::deque<Block> queue;
+  std::vector<std::vector<char> > spare_text;
+  std::thread writer;
+  std::mutex mutex;
+  std::condition_variable changed;
+  bool closing;
+  bool error;
+};
+
+
+
+#endif
@@ -0,0 +1,289 @@
+// Source file for mesh textures
+
+
+
+// Include files
+
+#include "R3MeshTexture.h"
+#include "R2/R2Image.h"
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include <windows.h>
+#include <process.h>
+#define getpid _getpid
+#endif
+
+
+
+////////////////////////////////////////////////////////////
+// CACHE FILE FORMAT
+////////////////////////////////////////////////////////////
+
+// The header of a cache file, followed by the texels of every level after
+// the first (the first is the image itself, so it is not stored again)
+struct R3MeshTextureCacheHeader {
+  char magic[8];
+  long long image_size;
+  long long image_time;
+  int width;
+  int height;
+  int nlevels;
+  int reserved;
+};
+
+static const char R3mesh_texture_cache_magic[8] = "R3MIP02";
+
+// Number of caches written by this process, which with the process id and
+// the time makes the name of the temporary file unique
+static std::atomic<unsigned int> R3mesh_texture_cache_count(0);
+
+
+
+////////////////////////////////////////////////////////////
+// CACHE UTILITY FUNCTIONS
+////////////////////////////////////////////////////////////
+
+static int
+RenameCache(const char *from, const char *to)
+{
+  // Move a file over another in one step (rename does not replace an
+  // existing file on Windows)
+#ifdef _WIN32
+  return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+#else
+  return rename(from, to);
+#endif
+}
+
+
+
+////////////////////////////////////////////////////////////
+// TEXTURE CONSTRUCTORS
+////////////////////////////////////////////////////////////
+
+R3MeshTexture::
+R3MeshTexture(void)
+{
+}
+
+
+
+////////////////////////////////////////////////////////////
+// TEXTURE INPUT/OUTPUT
+////////////////////////////////////////////////////////////
+
+int R3MeshTexture::
+Read(const char *filename)
+{
+  // Find size and modification time of image
+  Clear();
+  struct stat st;
+  if (stat(filename, &st) != 0) {
+    fprintf(stderr, "Unable to open texture %s\n", filename);
+    return 0;
+  }
+  long long image_size = st.st_size;
+  long long image_time = st.st_mtime;
+
+  // Decode image
+  if (!ReadImage(filename)) return 0;
+
+  // Read the other mipmap levels from the cache, if it was made from this image
+  std::string cache_filename = std::string(filename) + ".mip";
+  if (ReadCache(cache_filename.c_str(), image_size, image_time)) return 1;
+
+  // Otherwise make mipmap levels, and save them for next time
+  MakeMipmaps();
+  WriteCache(cache_filename.c_str(), image_size, image_time);
+
+  // Return success
+  return 1;
+}
+
+
+
+int R3MeshTexture::
+ReadImage(const char *filename)
+{
+  // Decode image
+  Clear();
+  R2Image image;
+  if (!image.Read(filename)) {
+    fprintf(stderr, "Unable to read texture %s\n", filename);
+    return 0;
+  }
+
+  // Convert pixels to 8-bit RGB texels
+  int width = image.Width();
+  int height = image.Height();
+  vector<unsigned char> texels(3 * width * height);
+  for (int j = 0; j < height; j++) {
+    for (int i = 0; i < width; i++) {
+      const R2Pixel& pixel = image.Pixel(i, j);
+      unsigned char *texel = &texels[3 * (j * width + i)];
+      for (int k = 0; k < 3; k++) {
+        double value = pixel[k];
+        if (value < 0) value = 0;
+        if (value > 1) value = 1;
+        texel[k] = (unsigned char) (255 * value + 0.5);
+      }
+    }
+  }
+  levels.push_back(texels);
+  widths.push_back(width);
+  heights.push_back(height);
+
+  // Return success
+  return 1;
+}
+
+
+
+int R3MeshTexture::
+ReadCache(const char *filename, long long image_size, long long image_time)
+{
+  // Check that there is only the first level, decoded from the image
+  if (NLevels() != 1) return 0;
+
+  // Open file (a missing cache is not an error)
+  FILE *fp = fopen(filename, "rb");
+  if (!fp) return 0;
+
+  // Read header, and check that it belongs to the image
+  R3MeshTextureCacheHeader header;
+  if ((fread(&header, sizeof(header), 1, fp) != 1) ||
+      memcmp(header.magic, R3mesh_texture_cache_magic, sizeof(header.magic)) ||
+      (header.image_size != image_size) || (header.image_time != image_time) ||
+      (header.width != Width()) || (header.height != Height()) || (header.nlevels <= 0) || (header.nlevels > 32)) {
+    fclose(fp);
+    return 0;
+  }
+
+  // Read levels after the first
+  int width = Width();
+  int height = Height();
+  for (int level = 1; level < header.nlevels; level++) {
+    width = (width > 1) ? width / 2 : 1;
+    height = (height > 1) ? height / 2 : 1;
+    levels.push_back(vector<unsigned char>(3 * width * height));
+    widths.push_back(width);
+    heights.push_back(height);
+    if (fread(levels.back().data(), 1, levels.back().size(), fp) != levels.back().size()) {
+      levels.resize(1);
+      widths.resize(1);
+      heights.resize(1);
+      fclose(fp);
+      return 0;
+    }
+  }
+
+  // Close file
+  fclose(fp);
+
+  // Return success
+  return 1;
+}
+
+
+
+int R3MeshTexture::
+WriteCache(const char *filename, long long image_size, long long image_time) const
+{
+  // Write to a file of this writer only, and rename it over the cache
+  // when complete, so that readers never see a partial cache
+  if (IsEmpty()) return 0;
+  long long ticks = std::chrono::steady_clock::now().time_since_epoch().count();
+  std::string temporary_filename = std::string(filename) + "." + std::to_string((long long) getpid()) +
+    "." + std::to_string(R3mesh_texture_cache_count++) + "." + std::to_string(ticks);
+  FILE *fp = fopen(temporary_filename.c_str(), "wb");
+  if (!fp) return 0;
+
+  // Write header
+  R3MeshTextureCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, R3mesh_texture_cache_magic, sizeof(header.magic));
+  header.image_size = image_size;
+  header.image_time = image_time;
+  header.width = Width();
+  header.height = Height();
+  header.nlevels = NLevels();
+  bool ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+
+  // Write levels after the first
+  for (int level = 1; ok && (level < NLevels()); level++) {
+    ok = (fwrite(Texels(level), 1, levels[level].size(), fp) == levels[level].size());
+  }
+
+  // Close file, and put it in place
+  if (fclose(fp) != 0) ok = false;
+  if (!ok || (RenameCache(temporary_filename.c_str(), filename) != 0)) {
+    remove(temporary_filename.c_str());
+    return 0;
+  }
+
+  // Return success
+  return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////
+// MIPMAP FUNCTIONS
+////////////////////////////////////////////////////////////
+
+void R3MeshTexture::
+Clear(void)
+{
+  // Remove all levels
+  levels.clear();
+  widths.clear();
+  heights.clear();
+}
+
+
+
+void R3MeshTexture::
+MakeMipmaps(void)
+{
+  // Keep only the first level
+  if (IsEmpty()) return;
+  levels.resize(1);
+  widths.resize(1);
+  heights.resize(1);
+
+  // Make levels down to one texel by averaging blocks of texels, as
+  // gluBuild2DMipmaps does (an odd last row or column is dropped)
+  int width = widths[0];
+  int height = heights[0];
+  while ((width > 1) || (height > 1)) {
+    int w = (width > 1) ? width / 2 : 1;
+    int h = (height > 1) ? height / 2 : 1;
+    int dx = (width > 1) ? 1 : 0;
+    int dy = (height > 1) ? 1 : 0;
+    int n = (1 + dx) * (1 + dy);
+    const vector<unsigned char>& level = levels.back();
+    vector<unsigned char> next(3 * w * h);
+    for (int j = 0; j < h; j++) {
+      for (int i = 0; i < w; i++) {
+        const unsigned char *a = &level[3 * ((j*(1+dy)) * width + i*(1+dx))];
+        const unsigned char *b = a + 3 * dx;
+        const unsigned char *c = a + 3 * dy * width;
+        const unsigned char *d = c + 3 * dx;
+        for (int k = 0; k < 3; k++) {
+          int sum = (n == 4) ? a[k] + b[k] + c[k] + d[k] : a[k] + d[k];
+          next[3 * (j*w + i) + k] = (sum + n / 2) / n;
+        }
+      }
+    }
+    levels.push_back(next);
+    widths.push_back(w);
+    heights.push_back(h);
+    width = w;
+    height = h;
+  }
+}
@@ -0,0 +1,114 @@
+#ifndef R3MESHTEXTURE_H
+#define R3MESHTEXTURE_H
+// Include file for mesh textures
+//
+// A texture is an image decoded with R2Image (so it has its real size),
+// with a chain of mipmap levels down to one texel, each made by averaging
+// blocks of two by two texels of the one before.  Texels are 8-bit RGB,
+// with the first row at the bottom, as OpenGL takes them.
+//
+// Making the levels takes longer than reading them, so Read keeps them in
+// a cache file next to the image (filename.mip), which holds the size
+// and modification time of the image it was made from and the levels
+// after the first one after another (the first is the image, so the
+// cache is a third of its size).  The cache is made again when the image
+// changes, and a cache that cannot be written is skipped.
+
+
+
+////////////////////////////////////////////////////////////
+// DEPENDENCY INCLUDE FILES
+////////////////////////////////////////////////////////////
+
+#include "R3Mesh.h"
+
+
+
+////////////////////////////////////////////////////////////
+// MESH TEXTURE DECLARATION
+////////////////////////////////////////////////////////////
+
+// Textures meshview draws bark and leaves with
+#define R3_MESH_BARK_TEXTURE "textures/lightwood.bmp"
+#define R3_MESH_LEAF_TEXTURE "textures/leaf.bmp"
+
+struct R3MeshTexture {
+  // Constructors
+  R3MeshTexture(void);
+
+  // Property functions
+  bool IsEmpty(void) const;
+  int NLevels(void) const;
+  int Width(int level=0) const;
+  int Height(int level=0) const;
+  const unsigned char *Texels(int level=0) const;
+
+  // Input/output functions (Read uses the cache when it is up to date,
+  // and ReadCache adds the levels after the one ReadImage decoded)
+  int Read(const char *filename);
+  int ReadImage(const char *filename);
+  int ReadCache(const char *filename, long long image_size, long long image_time);
+  int WriteCache(const char *filename, long long image_size, long long image_time) const;
+
+  // Mipmap functions
+  void Clear(void);
+  void MakeMipmaps(void);
+
+  // Data
+  vector<vector<unsigned char> > levels;
+  vector<int> widths;
+  vector<int> heights;
+};
+
+
+
+////////////////////////////////////////////////////////////
+// MESH TEXTURE INLINE FUNCTIONS
+////////////////////////////////////////////////////////////
+
+inline bool R3MeshTexture::
+IsEmpty(void) const
+{
+  // Return whether there are no texels
+  return levels.empty();
+}
+
+
+
+inline int R3MeshTexture::
+NLevels(void) const
+{
+  // Return number of mipmap levels
+  return levels.size();
+}
+
+
+
+inline int R3MeshTexture::
+Width(int level) const
+{
+  // Return width of mipmap level
+  return widths[level];
+}
+
+
+
+inline int R3MeshTexture::
+Height(int level) const
+{
+  // Return height of mipmap level
+  return heights[level];
+}
+
+
+
+inline const unsigned char *R3MeshTexture::
+Texels(int level) const
+{
+  // Return RGB texels of mipmap level, first row at the bottom
+  return levels[level].data();
+}
+
+
+
+#endif
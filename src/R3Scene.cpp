@@ -0,0 +1,260 @@
+// Source file for scenes of many trees
+
+
+
+// Include files
+
+#include "R3Scene.h"
+#include "R3ThreadPool.h"
+
+
+
+// Variant seeds of successive scene seeds are this far apart, so every
+// scene seed gives other trees (for species with fewer variants than this)
+static const unsigned int R3scene_seed_stride = 65536;
+
+
+
+////////////////////////////////////////////////////////////
+// SCENE CONSTRUCTORS/DESTRUCTORS
+////////////////////////////////////////////////////////////
+
+R3Scene::
+R3Scene(void)
+{
+}
+
+
+
+R3Scene::
+~R3Scene(void)
+{
+  // Delete trees
+  for (int i = 0; i < NTrees(); i++) {
+    delete trees[i];
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////
+// SCENE INPUT
+////////////////////////////////////////////////////////////
+
+static std::string
+ScenePath(const char *scene_filename, const char *filename)
+{
+  // Return filename relative to the directory of the scene file (unless it is absolute)
+  if ((filename[0] == '/') || (filename[0] == '\\') || (filename[0] && (filename[1] == ':'))) return filename;
+  const char *slash = strrchr(scene_filename, '/');
+  const char *backslash = strrchr(scene_filename, '\\');
+  if (backslash && (!slash || (backslash > slash))) slash = backslash;
+  if (!slash) return filename;
+  return std::string(scene_filename, slash + 1) + filename;
+}
+
+
+
+static int
+FindSpecies(const vector<R3SceneSpecies>& species, const char *name)
+{
+  // Return index of species with name, or -1
+  for (unsigned int i = 0; i < species.size(); i++) {
+    if (species[i].name == name) return i;
+  }
+  return -1;
+}
+
+
+
+int R3Scene::
+Read(const char *filename)
+{
+  // Open file
+  FILE *fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(stderr, "Unable to open scene %s\n", filename);
+    return 0;
+  }
+
+  // Read one species or placement per line
+  char line[4096];
+  int line_number = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    line_number++;
+
+    // Skip blank lines and comments
+    char keyword[64], name[1024], tree_file_name[1024];
+    if ((sscanf(line, "%63s", keyword) != 1) || (keyword[0] == '#')) continue;
+
+    // Parse line
+    bool ok = false;
+    if (!strcmp(keyword, "species")) {
+      // Add species, with a tree for each variant
+      R3SceneSpecies s;
+      ok = (sscanf(line, "%*s%1023s%1023s%d%d", name, tree_file_name, &s.iterations, &s.nvariants) == 4) && (s.nvariants > 0);
+      if (ok && (FindSpecies(species, name) >= 0)) {
+        fprintf(stderr, "Species %s defined twice on line %d of scene %s\n", name, line_number, filename);
+        fclose(fp);
+        return 0;
+      }
+      std::string path = (ok) ? ScenePath(filename, tree_file_name) : "";
+      FILE *tree_fp = (ok) ? fopen(path.c_str(), "r") : NULL;
+      if (ok && !tree_fp) {
+        fprintf(stderr, "Unable to open tree description %s on line %d of scene %s\n", path.c_str(), line_number, filename);
+        fclose(fp);
+        return 0;
+      }
+      if (ok) {
+        fclose(tree_fp);
+        s.name = name;
+        s.tree_file_name = path;
+        s.first_tree = tree_names.size();
+        for (int i = 0; i < s.nvariants; i++) tree_names.push_back(s.name + "." + std::to_string(i + 1));
+        species.push_back(s);
+      }
+    }
+    else if (!strcmp(keyword, "tree")) {
+      // Add one tree at an explicit position
+      int variant;
+      double x, y, z, degrees, scale;
+      ok = (sscanf(line, "%*s%1023s%d%lf%lf%lf%lf%lf", name, &variant, &x, &y, &z, &degrees, &scale) == 7);
+      int k = (ok) ? FindSpecies(species, name) : -1;
+      ok = ok && (k >= 0) && (variant >= 0) && (variant < species[k].nvariants);
+      if (ok) {
+        R3SceneInstance instance = { species[k].first_tree + variant, R3Point(x, y, z), degrees * M_PI / 180, scale };
+        instances.push_back(instance);
+      }
+    }
+    else if (!strcmp(keyword, "scatter")) {
+      // Add trees at random positions, variants and rotations over a rectangle of the ground
+      double xmin, zmin, xmax, zmax, density;
+      unsigned int seed;
+      ok = (sscanf(line, "%*s%1023s%lf%lf%lf%lf%lf%u", name, &xmin, &zmin, &xmax, &zmax, &density, &seed) == 7);
+      int k = (ok) ? FindSpecies(species, name) : -1;
+      ok = ok && (k >= 0) && (xmax >= xmin) && (zmax >= zmin) && (density >= 0);
+      if (ok) {
+        R3MeshRandom random(seed);
+        int count = (int) ((xmax - xmin) * (zmax - zmin) * density + 0.5);
+        for (int i = 0; i < count; i++) {
+          double u = random.Next() / (RAND_MAX + 1.0);
+          double v = random.Next() / (RAND_MAX + 1.0);
+          double angle = 2 * M_PI * random.Next() / (RAND_MAX + 1.0);
+          int variant = random.Next() % species[k].nvariants;
+          R3Point position(xmin + u * (xmax - xmin), 0, zmin + v * (zmax - zmin));
+          R3SceneInstance instance = { species[k].first_tree + variant, position, angle, 1 };
+          instances.push_back(instance);
+        }
+      }
+    }
+    if (!ok) {
+      fprintf(stderr, "Syntax error on line %d of scene %s\n", line_number, filename);
+      fclose(fp);
+      return 0;
+    }
+  }
+
+  // Close file
+  fclose(fp);
+
+  // Return success
+  return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////
+// SCENE GENERATION
+////////////////////////////////////////////////////////////
+
+int R3Scene::
+Generate(int nthreads, bool triangulate, bool pack, unsigned int seed)
+{
+  // Make a list of the species variant of every tree
+  vector<const R3SceneSpecies *> tree_species(tree_names.size());
+  for (unsigned int i = 0; i < species.size(); i++) {
+    for (int j = 0; j < species[i].nvariants; j++) tree_species[species[i].first_tree + j] = &species[i];
+  }
+
+  // Generate each distinct tree once, variant i with seed i+1 when the
+  // scene seed is 1 (other scene seeds start their variants further on)
+  for (int i = 0; i < NTrees(); i++) delete trees[i];
+  trees.assign(tree_names.size(), NULL);
+  R3ThreadPool pool(nthreads);
+  pool.Run(trees.size(), [&](int k, int thread) {
+    const R3SceneSpecies *s = tree_species[k];
+    R3Mesh *mesh = new R3Mesh();
+    mesh->verbose = false;
+    mesh->triangulate = triangulate;
+    mesh->packing = pack;
+    mesh->random.Seed((seed - 1) * R3scene_seed_stride + (k - s->first_tree) + 1);
+    mesh->Tree(s->tree_file_name.c_str(), s->iterations);
+    trees[k] = mesh;
+  });
+
+  // Return number of trees
+  return NTrees();
+}
+
+
+
+////////////////////////////////////////////////////////////
+// SCENE OUTPUT
+////////////////////////////////////////////////////////////
+
+static void
+AppendInstance(R3Mesh *merged, R3Mesh *tree, const R3SceneInstance& instance)
+{
+  // Copy vertices, scaled, rotated about y and translated
+  double c = cos(instance.angle), s = sin(instance.angle);
+  int first = merged->NVertices();
+  for (int i = 0; i < tree->NWrittenVertices(); i++) {
+    R3Point p = tree->WrittenPosition(i);
+    R3Vector n = tree->WrittenNormal(i);
+    R3Vector t = tree->WrittenTangent(i);
+    R3Point position(c * p.X() + s * p.Z(), p.Y(), -s * p.X() + c * p.Z());
+    position *= instance.scale;
+    position += instance.position.Vector();
+    R3MeshVertex *vertex = merged->CreateVertex(position, R3Vector(c * n.X() + s * n.Z(), n.Y(), -s * n.X() + c * n.Z()), tree->WrittenTexCoords(i));
+    vertex->tangent = R3Vector(c * t.X() + s * t.Z(), t.Y(), -s * t.X() + c * t.Z());
+  }
+  for (int i = 0; i < tree->NVertices(); i++) tree->Vertex(i)->id = i;
+
+  // Copy faces as faces, and packed triangles and triangles as triangles
+  vector<R3MeshVertex *> polygon;
+  for (int i = 0; i < tree->NWrittenFaces(); i++) {
+    int nvertices = tree->NWrittenFaceVertices(i);
+    int k = i - tree->NPackedTriangles();
+    if ((k >= 0) && (k < tree->NFaces())) {
+      polygon.clear();
+      for (int j = 0; j < nvertices; j++) polygon.push_back(merged->Vertex(first + tree->WrittenFaceVertex(i, j)));
+      merged->CreateFace(polygon.data(), polygon.size())->isLeaf = tree->IsLeafWrittenFace(i);
+    }
+    else {
+      for (int j = 0; j < 3; j++) merged->triangles.push_back(first + tree->WrittenFaceVertex(i, j));
+      merged->triangle_leaf.push_back(tree->IsLeafWrittenFace(i));
+    }
+  }
+}
+
+
+
+int R3Scene::
+WriteMerged(const char *filename)
+{
+  // Text formats are streamed, so only one placed tree at a time is in memory
+  const char *extension = strrchr(filename, '.');
+  bool stream = extension && (!strcmp(extension, ".off") || !strcmp(extension, ".off+") || !strcmp(extension, ".ray"));
+  R3Mesh merged;
+  if (stream && !merged.BeginStream(filename)) return 0;
+
+  // Add every placed tree
+  for (int i = 0; i < NInstances(); i++) {
+    AppendInstance(&merged, Tree(Instance(i).tree), Instance(i));
+    merged.FlushStream();
+  }
+
+  // Write mesh
+  if (stream) return merged.EndStream();
+  return merged.Write(filename);
+}
@@ -0,0 +1,120 @@
+#ifndef R3SCENE_H
+#define R3SCENE_H
+// Include file for scenes of many trees
+//
+// A scene is read from a text file that lists species of trees and
+// where to place them:
+//
+//   # name, tree description (relative to the scene file), iterations
+//   # (0 for the file's own), variants
+//   species oak ../L++/tree.l++ 0 3
+//   # species, variant, position, rotation about y (degrees), scale
+//   tree oak 0  0 0 0  45 1.5
+//   # species, rectangle xmin zmin xmax zmax on the ground, trees per unit area, seed
+//   scatter oak -50 -50 50 50 0.01 1
+//
+// Every variant of a species is a tree generated with its own seed, made
+// from the scene seed so that seed 1 gives the variants seeds 1, 2, 3, ... and
+// other seeds give other trees; it is generated only once however many times
+// it is placed, so memory grows with the number of variants rather than
+// with the number of trees.
+
+
+
+////////////////////////////////////////////////////////////
+// DEPENDENCY INCLUDE FILES
+////////////////////////////////////////////////////////////
+
+#include "R3Mesh.h"
+#include <string>
+
+
+
+////////////////////////////////////////////////////////////
+// SCENE DECLARATION
+////////////////////////////////////////////////////////////
+
+struct R3SceneSpecies {
+  std::string name;
+  std::string tree_file_name;
+  int iterations;
+  int nvariants;
+  int first_tree;
+};
+
+struct R3SceneInstance {
+  int tree;
+  R3Point position;
+  double angle;
+  double scale;
+};
+
+struct R3Scene {
+  // Constructors
+  R3Scene(void);
+  ~R3Scene(void);
+
+  // Access functions
+  int NTrees(void) const;
+  R3Mesh *Tree(int k) const;
+  int NInstances(void) const;
+  const R3SceneInstance& Instance(int k) const;
+
+  // Input/output functions
+  int Read(const char *filename);
+  int WriteGLB(const char *filename, bool instance_leaves=false);
+  int WriteMerged(const char *filename);
+
+  // Generation (every variant of every species, on nthreads threads)
+  int Generate(int nthreads=0, bool triangulate=false, bool pack=false, unsigned int seed=1);
+
+  // Data
+  vector<R3SceneSpecies> species;
+  vector<R3Mesh *> trees;
+  vector<std::string> tree_names;
+  vector<R3SceneInstance> instances;
+};
+
+
+
+////////////////////////////////////////////////////////////
+// SCENE INLINE FUNCTIONS
+////////////////////////////////////////////////////////////
+
+inline int R3Scene::
+NTrees(void) const
+{
+  // Return number of distinct trees (species variants)
+  return trees.size();
+}
+
+
+
+inline R3Mesh *R3Scene::
+Tree(int k) const
+{
+  // Return kth distinct tree
+  return trees[k];
+}
+
+
+
+inline int R3Scene::
+NInstances(void) const
+{
+  // Return number of placed trees
+  return instances.size();
+}
+
+
+
+inline const R3SceneInstance& R3Scene::
+Instance(int k) const
+{
+  // Return kth placed tree
+  return instances[k];
+}
+
+
+
+#endif
@@ -0,0 +1,154 @@
+// Source file for the work-stealing thread pool
+
+
+
+// Include files
+
+#include "R3ThreadPool.h"
+#include <algorithm>
+
+
+
+////////////////////////////////////////////////////////////
+// THREAD POOL MEMBER FUNCTIONS
+////////////////////////////////////////////////////////////
+
+R3ThreadPool::
+R3ThreadPool(int nthreads)
+: shares((nthreads > 0) ? nthreads : ((std::thread::hardware_concurrency() > 0) ? std::thread::hardware_concurrency() : 1)),
+function(NULL),
+generation(0),
+busy(0),
+stopping(false)
+{
+  // Start worker threads (the calling thread is thread 0)
+  for (unsigned int i = 1; i < shares.size(); i++) {
+    workers.push_back(std::thread(&R3ThreadPool::WorkLoop, this, i));
+  }
+}
+
+
+
+R3ThreadPool::
+~R3ThreadPool(void)
+{
+  // Stop worker threads
+  { std::lock_guard<std::mutex> lock(mutex); stopping = true; }
+  started.notify_all();
+  for (unsigned int i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+}
+
+
+
+void R3ThreadPool::
+Run(int ntasks, const std::function<void(int, int)>& function)
+{
+  // Check tasks
+  if (ntasks <= 0) return;
+
+  // Give each thread an even share of the tasks
+  int nthreads = NThreads();
+  for (int i = 0; i < nthreads; i++) {
+    shares[i].begin = (int) ((long long) ntasks * i / nthreads);
+    shares[i].end = (int) ((long long) ntasks * (i + 1) / nthreads);
+  }
+
+  // Wake up worker threads
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->function = &function;
+    busy = workers.size();
+    generation++;
+  }
+  started.notify_all();
+
+  // Work on the calling thread too
+  Work(0);
+
+  // Wait for worker threads to run out of tasks
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [this] { return busy == 0; });
+  this->function = NULL;
+}
+
+
+
+void R3ThreadPool::
+RunChunks(int n, int chunk_size, const std::function<void(int, int)>& function)
+{
+  // Run each chunk as a task
+  Run((n + chunk_size - 1) / chunk_size, [&](int task, int thread) {
+    function(task * chunk_size, std::min(n, (task + 1) * chunk_size));
+  });
+}
+
+
+
+void R3ThreadPool::
+WorkLoop(int thread)
+{
+  // Run tasks whenever Run() starts a new generation of them
+  unsigned int seen = 0;
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    started.wait(lock, [&] { return stopping || (generation != seen); });
+    if (stopping) return;
+    seen = generation;
+    lock.unlock();
+    Work(thread);
+    lock.lock();
+    if (--busy == 0) finished.notify_all();
+  }
+}
+
+
+
+void R3ThreadPool::
+Work(int thread)
+{
+  // Run tasks from the front of this thread's share, then steal
+  Share& share = shares[thread];
+  while (true) {
+    int task = -1;
+    {
+      std::lock_guard<std::mutex> lock(share.mutex);
+      if (share.begin < share.end) task = share.begin++;
+    }
+    if ((task < 0) && !Steal(thread, &task)) return;
+    (*function)(task, thread);
+  }
+}
+
+
+
+bool R3ThreadPool::
+Steal(int thread, int *task)
+{
+  // Look for another thread with tasks left, starting with the next one
+  int nthreads = NThreads();
+  for (int i = 1; i < nthreads; i++) {
+    Share& victim = shares[(thread + i) % nthreads];
+    int begin, end;
+    {
+      // Take the back half of its remaining tasks
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      int count = victim.end - victim.begin;
+      if (count <= 0) continue;
+      end = victim.end;
+      begin = victim.end = end - (count + 1) / 2;
+    }
+
+    // Run the first stolen task now and keep the rest as this thread's share
+    Share& share = shares[thread];
+    std::lock_guard<std::mutex> lock(share.mutex);
+    share.begin = begin + 1;
+    share.end = end;
+    *task = begin;
+    return true;
+  }
+
+  // No tasks are left anywhere (tasks never add more tasks)
+  return false;
+}
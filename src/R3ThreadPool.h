@@ -0,0 +1,78 @@
+#ifndef R3THREADPOOL_H
+#define R3THREADPOOL_H
+// Include file for a work-stealing thread pool
+//
+// Run() splits a range of tasks evenly among the threads of the pool
+// (the calling thread is one of them).  Each thread works through its
+// own share from the front, and a thread that runs out takes the back
+// half of another thread's remaining share, so uneven tasks still keep
+// every thread busy.  The threads are kept between calls.
+
+
+
+////////////////////////////////////////////////////////////
+// DEPENDENCY INCLUDE FILES
+////////////////////////////////////////////////////////////
+
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+
+////////////////////////////////////////////////////////////
+// THREAD POOL DECLARATION
+////////////////////////////////////////////////////////////
+
+struct R3ThreadPool {
+  // Constructors (0 threads means one per core)
+  R3ThreadPool(int nthreads=0);
+  ~R3ThreadPool(void);
+
+  // Property functions
+  int NThreads(void) const;
+
+  // Run function(task, thread) for every task in [0, ntasks) and wait
+  void Run(int ntasks, const std::function<void(int, int)>& function);
+
+  // Run function(begin, end) on chunks of [0, n) of chunk_size each, and wait
+  void RunChunks(int n, int chunk_size, const std::function<void(int, int)>& function);
+
+  // Worker functions
+  void WorkLoop(int thread);
+  void Work(int thread);
+  bool Steal(int thread, int *task);
+
+  // Data (one share of tasks per thread)
+  struct Share { std::mutex mutex; int begin; int end; };
+  std::vector<Share> shares;
+  std::vector<std::thread> workers;
+  const std::function<void(int, int)> *function;
+
+  // Synchronization data
+  std::mutex mutex;
+  std::condition_variable started;
+  std::condition_variable finished;
+  unsigned int generation;
+  int busy;
+  bool stopping;
+};
+
+
+
+////////////////////////////////////////////////////////////
+// THREAD POOL INLINE FUNCTIONS
+////////////////////////////////////////////////////////////
+
+inline int R3ThreadPool::
+NThreads(void) const
+{
+  // Return number of threads, including the calling thread
+  return shares.size();
+}
+
+
+
+#endif
@@ -7,14 +7,14 @@ LPlusSystem::LPlusSystem(R3Mesh * m)
 {
 }
 
-string LPlusSystem::generateFromFile(const char * filename,const int iterationsOverride )
+string LPlusSystem::generateFromFile(const char * filename,const int iterationsOverride, LSystemCache *cache )
 {
 	int l=strlen(filename);
 	if (strcmp(filename+l-3,"l++")==0) //this is an l++
 	{
 		isPlus=true;
 	}
-	return LSystem::generateFromFile(filename,iterationsOverride);
+	return LSystem::generateFromFile(filename,iterationsOverride,cache);
 
 }
 void LPlusSystem::run(const char command,const float param)
@@ -12,6 +12,6 @@ class LPlusSystem: public LSystem
 public:
 	bool isPlus;
 	LPlusSystem(R3Mesh *m);
-	string generateFromFile(const char * filename,const int iterationsOverride );
+	string generateFromFile(const char * filename,const int iterationsOverride, LSystemCache *cache=NULL );
 	virtual void run(const char command,const float param);
 };
\ No newline at end of file
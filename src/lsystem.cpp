@@ -1,5 +1,6 @@
 #include "lsystem.h"
 #include <fstream>
+#include <cstring>
 using namespace std;
 void LSystem::replaceAll(string& str, const string& from, const string& to) 
 {
@@ -20,7 +21,7 @@ string LSystem::produce(const string axiom, const AssociativeArray rules)
 	{
 		string key=iter->first;
 		vector<string> value=iter->second;
-		int index=rand()%value.size();
+		int index=mesh->random.Next()%value.size();
 		// printf("Selected %d out of %d : %s\n",index,value.size(),value[index].c_str());
 		replaceAll(t,key,value[index]);
 	}
@@ -32,24 +33,22 @@ string LSystem::reproduce(const string axiom,const AssociativeArray rules, const
 		return reproduce(produce(axiom,rules),rules,iterations-1);
 	return axiom;
 }
-string LSystem::generateFromFile(const char * filename,const int iterationsOverride )
+bool LSystem::readGrammar(const char * filename, LSystemGrammar& grammar)
 {
-	cout <<"Generating L-System data..."<<endl;
 	ifstream file(filename);
 	if (!file)
 	{
 		cout <<"Could not open L file "<<filename<<endl;
-		return "";
+		return false;
 	}
 	int numbersRead=0;
 	float numbers[3];
-	string axiom;
-	AssociativeArray rules;
 	while (!file.eof())
 	{
 		string temp;
 		char c;
-		file>>c;
+		if (!(file>>c))
+			break;
 		if (c=='#') 
 		{
 			getline(file,temp);
@@ -59,6 +58,11 @@ string LSystem::generateFromFile(const char * filename,const int iterationsOverr
 		if (numbersRead<3)
 		{
 			file >>numbers[numbersRead++];
+			if (file.fail())
+			{
+				cout <<"Could not read number "<<numbersRead<<" in L file "<<filename<<endl;
+				return false;
+			}
 			continue;
 		}
 		if (c=='@') break;
@@ -66,23 +70,129 @@ string LSystem::generateFromFile(const char * filename,const int iterationsOverr
 		int equalSignPos=temp.find("=");
 		if (equalSignPos==string::npos)
 		{
-			axiom=temp;
+			grammar.axiom=temp;
 		}
 		else
 		{
 
-			rules[temp.substr(0,equalSignPos)].push_back(temp.substr(equalSignPos+1));
+			grammar.rules[temp.substr(0,equalSignPos)].push_back(temp.substr(equalSignPos+1));
 			// cout <<temp.substr(0,equalSignPos)<<"  "<<temp.substr(equalSignPos+1)<<endl;
 		}
 	}
+	if (numbersRead<3)
+	{
+		cout <<"Missing numbers in L file "<<filename<<endl;
+		return false;
+	}
 
-	int iterations=(int)numbers[0];
+	grammar.iterations=(int)numbers[0];
+	grammar.angle=numbers[1];
+	grammar.thickness=numbers[2];
+	return true;
+}
+// Replaces the text in each '(...)' with "#k", k counting the texts in params
+// (ok is cleared if a '#' is outside them, as it could be taken for one)
+static string extractParams(const string& str, vector<string>& params, bool& ok)
+{
+	string result;
+	size_t i=0;
+	while (i<str.size())
+	{
+		size_t open=str.find('(',i);
+		size_t close=(open==string::npos)?string::npos:str.find(')',open);
+		if (close==string::npos)
+			open=close=str.size();
+		if (str.substr(i,open-i).find('#')!=string::npos)
+			ok=false;
+		result.append(str,i,open+1-i);
+		if (close==str.size())
+			break;
+		params.push_back(str.substr(open+1,close-open-1));
+		result+="#"+to_string((long long)params.size()-1)+")";
+		i=close+1;
+	}
+	return result;
+}
+// Puts the texts back in place of each "#k"
+static string insertParams(const string& str, const vector<string>& params)
+{
+	string result;
+	size_t i=0;
+	while (i<str.size())
+	{
+		size_t open=str.find("(#",i);
+		if (open==string::npos)
+			open=str.size();
+		result.append(str,i,open+1-i);
+		if (open==str.size())
+			break;
+		size_t close=str.find(')',open);
+		result+=params[atoi(str.c_str()+open+2)]+")";
+		i=close+1;
+	}
+	return result;
+}
+string LSystem::generate(const LSystemGrammar& grammar,const int iterationsOverride, LSystemCache *cache)
+{
+	int iterations=grammar.iterations;
 	if (iterationsOverride)
 		iterations=iterationsOverride;
-	defaultCoefficient=numbers[1];
-	float thickness=numbers[2];
-	turtle.thickness=thickness/100;
-	return reproduce(axiom,rules,iterations);
+	defaultCoefficient=grammar.angle;
+	turtle.thickness=grammar.thickness/100;
+	if (!cache)
+		return reproduce(grammar.axiom,grammar.rules,iterations);
+
+	// Take the numbers out of the axiom and rules (rule names must not
+	// contain any character the numbers or "(#k)" could, or they would
+	// match differently)
+	vector<string> params;
+	bool ok=true;
+	string axiom=extractParams(grammar.axiom,params,ok);
+	AssociativeArray rules;
+	AssociativeArray::const_iterator iter;
+	for (iter=grammar.rules.begin(); iter!=grammar.rules.end();++iter)
+		for (size_t i=0;i<iter->second.size();++i)
+			rules[iter->first].push_back(extractParams(iter->second[i],params,ok));
+	string numberCharacters="()#0123456789";
+	for (size_t i=0;i<params.size();++i)
+		numberCharacters+=params[i];
+	for (iter=rules.begin(); iter!=rules.end();++iter)
+		if (iter->first.find_first_of(numberCharacters)!=string::npos)
+			ok=false;
+	if (!ok)
+	{
+		cache->valid=false;
+		return reproduce(grammar.axiom,grammar.rules,iterations);
+	}
+
+	// Derive the string without numbers, unless it is the one derived last time
+	if (cache->valid && cache->axiom==axiom && cache->rules==rules && cache->iterations==iterations &&
+		!memcmp(&cache->randomBefore,&mesh->random,sizeof(R3MeshRandom)))
+	{
+		if (mesh->verbose)
+			cout <<"Reusing derived L-System data..."<<endl;
+	}
+	else
+	{
+		cache->axiom=axiom;
+		cache->rules=rules;
+		cache->iterations=iterations;
+		cache->randomBefore=mesh->random;
+		cache->derived=reproduce(axiom,rules,iterations);
+		cache->randomAfter=mesh->random;
+		cache->valid=true;
+	}
+	mesh->random=cache->randomAfter;
+	return insertParams(cache->derived,params);
+}
+string LSystem::generateFromFile(const char * filename,const int iterationsOverride, LSystemCache *cache )
+{
+	if (mesh->verbose)
+		cout <<"Generating L-System data..."<<endl;
+	LSystemGrammar grammar;
+	if (!readGrammar(filename,grammar))
+		return "";
+	return generate(grammar,iterationsOverride,cache);
 
 }
 void LSystem::run(const char command,const float param)
@@ -179,5 +289,6 @@ void LSystem::draw(const string tree)
 	if (checkParam)
 		run(command,1);
 
-	cout <<data<<endl;
+	if (mesh->verbose)
+		cout <<data<<endl;
 }
\ No newline at end of file
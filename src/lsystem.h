@@ -7,6 +7,31 @@
 #include <map>
 using namespace std;
 typedef map<string,vector<string> > AssociativeArray;
+
+// A grammar as written in an L file
+struct LSystemGrammar
+{
+	int iterations;
+	float angle;
+	float thickness;
+	string axiom;
+	AssociativeArray rules;
+};
+
+// The string last derived from a grammar, with the numbers in '(...)'
+// left out (as "(#0)", "(#1)", ...), so that a grammar that differs only
+// in its numbers is drawn again without deriving the string
+struct LSystemCache
+{
+	LSystemCache():valid(false) {}
+	string axiom;
+	AssociativeArray rules;
+	int iterations;
+	R3MeshRandom randomBefore;
+	R3MeshRandom randomAfter;
+	string derived;
+	bool valid;
+};
 class LSystem 
 {
 protected:
@@ -23,6 +48,8 @@ public:
 
 	}
 	string reproduce(const string axiom,const AssociativeArray rules, const int iterations=1);
-	virtual string generateFromFile(const char * filename, const int iterations=0 );
+	bool readGrammar(const char * filename, LSystemGrammar& grammar);
+	string generate(const LSystemGrammar& grammar, const int iterations=0, LSystemCache *cache=NULL);
+	virtual string generateFromFile(const char * filename, const int iterations=0, LSystemCache *cache=NULL );
 	void draw(const string data);
 };
\ No newline at end of file
@@ -11,16 +11,48 @@
 #include "R2/R2.h"
 #include "R3/R3.h"
 #include "R3Mesh.h"
+#include "R3ThreadPool.h"
+#include "R3MeshRender.h"
+#include "R3Scene.h"
+#include <atomic>
+#include <thread>
 
 
 
 // Program arguments
 
+static int triangulate = 0;
+static int optimize = 0;
+static int stream = 0;
+static int pack = 0;
+static int instance_leaves = 0;
+static int batch = 0;
+static int scene = 0;
+static int merged = 0;
+static int nthreads = 0;
+static char *output_image_name = NULL;
+
+
+
+// A tree to generate (iterations 0 means the number in the grammar file)
+
+struct MeshproTask {
+  string tree_file_name;
+  int iterations;
+  unsigned int seed;
+  string output_mesh_name;
+};
+
+
+
 static void 
 ShowUsage(void)
 {
   // Print usage message and exit
-  fprintf(stderr, "Usage: meshpro treedescription.l output_mesh\n");
+  fprintf(stderr, "Usage: meshpro treedescription.l [iterations] output_mesh [-seed n] [-triangulate] [-optimize] [-stream] [-pack] [-instance_leaves] [-output_image image.jpg]\n");
+  fprintf(stderr, "       meshpro -batch manifest [-threads n] [options]\n");
+  fprintf(stderr, "       meshpro -batch treedescription.l ... .extension [-threads n] [options]\n");
+  fprintf(stderr, "       meshpro -scene scenedescription output_mesh [-merge] [-threads n] [options]\n");
   exit(EXIT_FAILURE);
 }
 
@@ -39,6 +71,207 @@ CheckOption(char *option, int argc, int minargc)
 
 
 
+static int
+ReadManifest(const char *filename, vector<MeshproTask>& tasks)
+{
+  // Open file
+  FILE *fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(stderr, "Unable to open manifest %s\n", filename);
+    return 0;
+  }
+
+  // Read one tree per line: grammar file, iterations, seed and output mesh
+  char line[4096];
+  int line_number = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    line_number++;
+
+    // Skip blank lines and comments
+    char *p = line;
+    while (isspace(*p)) p++;
+    if ((*p == '\0') || (*p == '#')) continue;
+
+    // Parse entry
+    char tree_file_name[1024], output_mesh_name[1024];
+    MeshproTask task;
+    if (sscanf(p, "%1023s%d%u%1023s", tree_file_name, &task.iterations, &task.seed, output_mesh_name) != 4) {
+      fprintf(stderr, "Syntax error on line %d of manifest %s\n", line_number, filename);
+      fclose(fp);
+      return 0;
+    }
+    task.tree_file_name = tree_file_name;
+    task.output_mesh_name = output_mesh_name;
+    tasks.push_back(task);
+  }
+
+  // Close file
+  fclose(fp);
+
+  // Return success
+  return 1;
+}
+
+
+
+static int
+CheckTask(const MeshproTask& task)
+{
+  // Check options against the output format
+  const char *extension = strrchr(task.output_mesh_name.c_str(), '.');
+  if (instance_leaves && (stream || !extension || strcmp(extension, ".glb"))) {
+    fprintf(stderr, "-instance_leaves is only for .glb output, which cannot be streamed\n");
+    return 0;
+  }
+
+  // Check tree description
+  FILE *fp = fopen(task.tree_file_name.c_str(), "r");
+  if (!fp) {
+    fprintf(stderr, "Unable to open tree description %s\n", task.tree_file_name.c_str());
+    return 0;
+  }
+  fclose(fp);
+
+  // Return success
+  return 1;
+}
+
+
+
+static int
+ProcessTask(R3Mesh *mesh, const MeshproTask& task)
+{
+  // Start from an empty mesh (keeping the storage of the previous tree)
+  const char *output_mesh_name = task.output_mesh_name.c_str();
+  mesh->Clear();
+  mesh->triangulate = triangulate;
+  mesh->packing = pack;
+  mesh->random.Seed(task.seed);
+
+  // Start writing output mesh while it is generated
+  if (stream && !mesh->BeginStream(output_mesh_name)) {
+    fprintf(stderr, "Unable to write mesh to %s\n", output_mesh_name);
+    return 0;
+  }
+
+  if (!mesh->Tree(task.tree_file_name.c_str(), task.iterations)) {
+    fprintf(stderr, "Unable to generate tree from %s\n", task.tree_file_name.c_str());
+    if (stream) mesh->EndStream();
+    return 0;
+  }
+
+  // Optimize mesh for rendering
+  if (optimize) {
+    double acmr = mesh->ACMR();
+    mesh->Optimize();
+    if (mesh->verbose) printf("Optimized vertex cache: ACMR %g -> %g\n", acmr, mesh->ACMR());
+  }
+
+  // Write output mesh
+  int status;
+  if (stream) status = mesh->EndStream();
+  else if (instance_leaves) status = mesh->WriteGLB(output_mesh_name, true);
+  else status = mesh->Write(output_mesh_name);
+  if (!status) {
+    fprintf(stderr, "Unable to write mesh to %s\n", output_mesh_name);
+    return 0;
+  }
+
+  // Return success
+  return 1;
+}
+
+
+
+static int
+ProcessBatch(const vector<MeshproTask>& tasks)
+{
+  // Check all tasks before starting any
+  for (unsigned int i = 0; i < tasks.size(); i++) {
+    if (!CheckTask(tasks[i])) return 0;
+  }
+
+  // Allocate one mesh per thread, reused for every tree the thread generates
+  R3ThreadPool pool(nthreads);
+  vector<R3Mesh> meshes(pool.NThreads());
+  for (unsigned int i = 0; i < meshes.size(); i++) {
+    meshes[i].verbose = false;
+  }
+
+  // Generate trees
+  std::atomic<int> nfailed(0);
+  pool.Run(tasks.size(), [&](int task, int thread) {
+    if (ProcessTask(&meshes[thread], tasks[task])) printf("Wrote %s\n", tasks[task].output_mesh_name.c_str());
+    else nfailed++;
+  });
+
+  // Print summary
+  printf("Generated %d of %d trees on %d threads\n", (int) tasks.size() - nfailed, (int) tasks.size(), pool.NThreads());
+
+  // Return whether all trees were written
+  return (nfailed == 0);
+}
+
+
+
+static int
+ProcessScene(const char *scene_name, const char *output_mesh_name, unsigned int seed)
+{
+  // Check options against the output format
+  const char *extension = strrchr(output_mesh_name, '.');
+  if (!merged && (!extension || strcmp(extension, ".glb"))) {
+    fprintf(stderr, "Scenes are written to .glb files, or to any mesh file with -merge\n");
+    return 0;
+  }
+  if (merged && instance_leaves) {
+    fprintf(stderr, "-instance_leaves is only for .glb output, which cannot be merged\n");
+    return 0;
+  }
+
+  // Read scene
+  R3Scene s;
+  if (!s.Read(scene_name)) return 0;
+
+  // Generate every distinct tree once
+  s.Generate(nthreads, triangulate, pack, seed);
+  if (optimize) {
+    for (int i = 0; i < s.NTrees(); i++) s.Tree(i)->Optimize();
+  }
+  printf("Generated %d distinct trees for %d placed trees\n", s.NTrees(), s.NInstances());
+
+  // Write scene
+  int status = (merged) ? s.WriteMerged(output_mesh_name) : s.WriteGLB(output_mesh_name, instance_leaves);
+  if (!status) {
+    fprintf(stderr, "Unable to write scene to %s\n", output_mesh_name);
+    return 0;
+  }
+
+  // Return success
+  return 1;
+}
+
+
+
+static int
+RenderImage(R3Mesh *mesh, R3MeshRenderer& renderer, const char *image_name)
+{
+  // Draw the mesh as meshview first shows it, on all threads
+  R3ThreadPool pool(nthreads);
+  renderer.FitCamera(mesh);
+  renderer.Render(mesh, &pool);
+
+  // Write image
+  if (!renderer.WriteImage(image_name)) {
+    fprintf(stderr, "Unable to write image to %s\n", image_name);
+    return 0;
+  }
+
+  // Return success
+  return 1;
+}
+
+
+
 int 
 main(int argc, char **argv)
 {
@@ -49,14 +282,82 @@ main(int argc, char **argv)
     }
   }
 
-  // Read input and output mesh filenames
-  if (argc < 3)  ShowUsage();
+  // Read options, and tree descriptions, iterations and output mesh filenames
+  vector<char *> args;
+  unsigned int seed = 1;
   argv++, argc--; // First argument is program name
-  char *tree_file_name=*argv;argv++;argc--;
-  int iterations=0;
-  if (argc>1)
-    iterations=atoi(*argv++),argc--;
-  char *output_mesh_name = *argv; argv++, argc--; 
+  while (argc > 0) {
+    if ((*argv)[0] == '-') {
+      if (!strcmp(*argv, "-triangulate")) triangulate = 1;
+      else if (!strcmp(*argv, "-optimize")) triangulate = optimize = 1;
+      else if (!strcmp(*argv, "-stream")) stream = 1;
+      else if (!strcmp(*argv, "-pack")) triangulate = pack = 1;
+      else if (!strcmp(*argv, "-instance_leaves")) instance_leaves = 1;
+      else if (!strcmp(*argv, "-batch")) batch = 1;
+      else if (!strcmp(*argv, "-scene")) scene = 1;
+      else if (!strcmp(*argv, "-merge")) merged = 1;
+      else if (!strcmp(*argv, "-threads")) { CheckOption(*argv, argc, 2); nthreads = atoi(argv[1]); argv++; argc--; }
+      else if (!strcmp(*argv, "-output_image")) { CheckOption(*argv, argc, 2); output_image_name = argv[1]; argv++; argc--; }
+      else if (!strcmp(*argv, "-seed")) { CheckOption(*argv, argc, 2); seed = strtoul(argv[1], NULL, 10); argv++; argc--; }
+      else { fprintf(stderr, "Invalid program argument: %s\n", *argv); ShowUsage(); }
+    }
+    else args.push_back(*argv);
+    argv++, argc--;
+  }
+  if ((stream || pack) && optimize) {
+    fprintf(stderr, "-optimize needs the whole mesh, so it cannot be used with -stream or -pack\n");
+    ShowUsage();
+  }
+  if (stream && pack) {
+    fprintf(stderr, "-stream already keeps memory use constant, so it cannot be used with -pack\n");
+    ShowUsage();
+  }
+
+  if (scene && (batch || stream)) {
+    fprintf(stderr, "-scene cannot be used with -batch or -stream (merged text output is streamed anyway)\n");
+    ShowUsage();
+  }
+
+  if (output_image_name && (scene || batch || stream)) {
+    fprintf(stderr, "-output_image needs one whole tree, so it cannot be used with -scene, -batch or -stream\n");
+    ShowUsage();
+  }
+
+  // Generate a scene of many placed trees
+  if (scene) {
+    if (args.size() != 2) ShowUsage();
+    if (!ProcessScene(args[0], args[1], seed)) exit(-1);
+    printf("All done.\n");
+    return EXIT_SUCCESS;
+  }
+
+  // Generate many trees on a pool of threads
+  if (batch) {
+    vector<MeshproTask> tasks;
+    if (args.size() == 1) {
+      // Read trees from a manifest
+      if (!ReadManifest(args[0], tasks)) exit(-1);
+    }
+    else if ((args.size() >= 2) && (args.back()[0] == '.')) {
+      // Write each tree description to a mesh of the same name
+      for (unsigned int i = 0; i < args.size() - 1; i++) {
+        string name = args[i];
+        size_t dot = name.find_last_of('.');
+        if ((dot != string::npos) && (name.find_first_of("/\\", dot) == string::npos)) name.erase(dot);
+        MeshproTask task = { args[i], 0, seed, name + args.back() };
+        tasks.push_back(task);
+      }
+    }
+    else ShowUsage();
+    if (!ProcessBatch(tasks)) exit(-1);
+    printf("All done.\n");
+    return EXIT_SUCCESS;
+  }
+
+  // Generate one tree
+  if ((args.size() < 2) || (args.size() > 3)) ShowUsage();
+  MeshproTask task = { args[0], (args.size() == 3) ? atoi(args[1]) : 0, seed, args.back() };
+  if (!CheckTask(task)) ShowUsage();
 
   // Allocate mesh
   R3Mesh *mesh = new R3Mesh();
@@ -65,17 +366,20 @@ main(int argc, char **argv)
     exit(-1);
   }
 
-  // Read input mesh
-  // if (!mesh->Read(input_mesh_name)) {
-    // fprintf(stderr, "Unable to read mesh from %s\n", input_mesh_name);
-    // exit(-1);
-  // }
+  // Read textures for the image while the tree is generated
+  R3MeshRenderer renderer;
+  std::thread texture_thread;
+  if (output_image_name) texture_thread = std::thread([&renderer]() { renderer.ReadTextures(); });
 
-  mesh->Tree(tree_file_name,iterations);
-  // Write output mesh
-  if (!mesh->Write(output_mesh_name)) {
-    fprintf(stderr, "Unable to write mesh to %s\n", output_mesh_name);
-    exit(-1);
+  // Generate and write output mesh, and wait for the textures (also when
+  // generating failed, since exit would leave the thread running)
+  int status = ProcessTask(mesh, task);
+  if (texture_thread.joinable()) texture_thread.join();
+  if (!status) exit(-1);
+
+  // Draw image of output mesh
+  if (output_image_name) {
+    if (!RenderImage(mesh, renderer, output_image_name)) exit(-1);
   }
 
   // Delete mesh
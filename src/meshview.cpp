@@ -9,6 +9,17 @@
 #include "opengl_glut.h"
 #include "R3/R3.h"
 #include "R3Mesh.h"
+#include "R3MeshBVH.h"
+#include "R3MeshRender.h"
+#include "R3MeshTexture.h"
+#include "lsystem.h"
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <unordered_map>
 #include <math.h>
 
 
@@ -21,18 +32,26 @@
 static char *input_mesh_name = NULL;
 static char *output_mesh_name = NULL;
 static char *output_image_name = NULL;
+static const char *bark_texture_name = R3_MESH_BARK_TEXTURE;
+static const char *leaf_texture_name = R3_MESH_LEAF_TEXTURE;
 static int print_verbose = 0;
+static int exit_immediately = 0;
+static int triangulate = 0;
+static int pack = 0;
 
 
 
 // Display variables
 
 static R3Mesh *mesh = NULL;
+static R3MeshTexture textures[2];
 static R3Point camera_eye (0, 0, 4);
 static R3Vector camera_towards(0, 0, 1);
 static R3Vector camera_up(0, 1, 0);
 static double camera_yfov = 0.75;
 static R3MeshFace *pick_face = NULL;
+static int pick_triangle = -1;
+static int pick_packed_triangle = -1;
 static R3Point pick_position = R3zero_point;
 static bool pick_active = false;
 static int show_faces = 1;
@@ -48,6 +67,141 @@ static int quit = 0;
 
 
 
+// Vertex buffer variables (the mesh is uploaded once into one vertex
+// buffer and one index buffer holding bark triangles, leaf triangles,
+// edges and coarse copies of the triangles, with the clusters they are
+// sorted into, or into display lists if buffers are not available)
+
+enum {
+  MESH_BARK_RANGE,
+  MESH_LEAF_RANGE,
+  MESH_EDGE_RANGE,
+  MESH_COARSE_BARK_RANGE,
+  MESH_COARSE_LEAF_RANGE,
+  MESH_VERTEX_RANGE,
+  MESH_NUM_RANGES
+};
+
+struct GLUTMeshVertex {
+  GLfloat position[3];
+  GLfloat normal[3];
+  GLfloat texcoords[2];
+};
+
+struct GLUTMeshCluster {
+  R3Box bbox;
+  double size;
+  GLsizei range_starts[MESH_NUM_RANGES];
+  GLsizei range_counts[MESH_NUM_RANGES];
+};
+
+struct GLUTMeshBuffers {
+  GLuint buffers[2];
+  GLuint vertex_array;
+  GLuint display_lists;
+  GLsizei range_counts[MESH_NUM_RANGES];
+  size_t range_offsets[MESH_NUM_RANGES];
+  vector<GLUTMeshCluster> clusters;
+};
+
+static bool mesh_uploaded = false;
+static bool mesh_has_edges = false;
+static GLUTMeshBuffers mesh_buffers = { { 0, 0 }, 0, 0, { 0, 0, 0, 0, 0, 0 }, { 0, 0, 0, 0, 0, 0 } };
+static R3MeshBVH *mesh_bvh = NULL;
+
+
+
+// Loading variables (the mesh is read on a background thread, which
+// passes the faces read so far to the main thread in pieces; each frame
+// draws the pieces that have arrived, until the whole mesh replaces them)
+
+struct GLUTMeshPiece {
+  vector<GLUTMeshVertex> vertices;
+  vector<GLuint> indices[MESH_NUM_RANGES];
+};
+
+struct GLUTMeshLoad {
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable arrived;
+  vector<GLUTMeshPiece> pieces;
+  R3Box bbox;
+  int nfaces_read;
+  int nfaces;
+  R3Mesh *mesh;
+  bool done;
+};
+
+static GLUTMeshLoad *mesh_load = NULL;
+static vector<GLUTMeshBuffers> mesh_pieces;
+static bool mesh_loaded = false;
+static bool camera_fitted = false;
+
+
+
+// Grammar variables (a tree description given instead of a mesh is
+// generated in the background, and again whenever its text changes,
+// reusing the derived string when only numbers changed)
+
+#define GLUT_GRAMMAR_WATCH_INTERVAL 250
+
+static bool input_is_grammar = false;
+static string grammar_text;
+static LSystemCache grammar_cache;
+
+
+
+// Benchmark variables (with -benchmark n, the camera flies once around
+// the mesh while zooming in and out over n frames, drawn one after
+// another as fast as possible, and the times are printed as JSON)
+
+struct GLUTBenchmarkFrame {
+  double cpu_time;
+  GLuint query;
+  long long triangles;
+};
+
+static int benchmark_nframes = 0;
+static int benchmark_frame = 0;
+static bool benchmarking = false;
+static vector<GLUTBenchmarkFrame> benchmark_frames;
+static std::chrono::steady_clock::time_point benchmark_start_time;
+static std::chrono::steady_clock::time_point benchmark_frame_time;
+static long long frame_triangles = 0;
+
+
+
+// Cluster variables (the bark and leaf triangles of the mesh are sorted
+// into the cells of a grid, and each cell also gets a coarse copy made by
+// merging the vertices in a finer grid over it; each frame draws only the
+// cells in view, and the coarse copies of those that look small)
+
+#define GLUT_CLUSTER_TRIANGLES 4096
+#define GLUT_CLUSTER_GRID_SIZE 8
+#define GLUT_CLUSTER_COARSE_GRID_SIZE 16
+#define GLUT_CLUSTER_COARSE_PIXELS 32
+
+static int cull_clusters = 1;
+static int coarse_clusters = 1;
+
+
+
+// Image capture variables (screenshots are read as bytes into one of two
+// pixel buffers without waiting, and written out while the next one is
+// read, or on the next frame)
+
+struct GLUTImageCapture {
+  GLuint buffer;
+  int width;
+  int height;
+  string filename;
+};
+
+static GLUTImageCapture image_captures[2];
+static int image_capture_index = 0;
+
+
+
 // GLUT variables 
 
 static int GLUTwindow = 0;
@@ -76,6 +230,895 @@ enum {
 
 
 
+////////////////////////////////////////////////////////////
+// VERTEX BUFFER FUNCTIONS
+////////////////////////////////////////////////////////////
+
+static GLuint
+AddMeshVertex(vector<GLUTMeshVertex>& vertices, int *index, const R3Point& p, 
+  const R3Vector& n, const R3Vector& face_normal, const R2Point& t)
+{
+  // Share vertices that have normals, and give the others the normal of each face
+  if (!n.IsZero() && (*index >= 0)) return *index;
+  const R3Vector& normal = (n.IsZero()) ? face_normal : n;
+  GLUTMeshVertex vertex = { 
+    { (GLfloat) p[0], (GLfloat) p[1], (GLfloat) p[2] },
+    { (GLfloat) normal[0], (GLfloat) normal[1], (GLfloat) normal[2] },
+    { (GLfloat) t.X(), (GLfloat) t.Y() }
+  };
+  vertices.push_back(vertex);
+  if (!n.IsZero()) *index = vertices.size() - 1;
+  return vertices.size() - 1;
+}
+
+
+
+static void
+AddMeshPolygon(vector<GLuint> *indices, const vector<GLuint>& polygon, bool isLeaf, bool edges)
+{
+  // Add polygon as a fan of bark or leaf triangles, and its outline as edges
+  vector<GLuint>& triangles = indices[(isLeaf) ? MESH_LEAF_RANGE : MESH_BARK_RANGE];
+  for (unsigned int j = 2; j < polygon.size(); j++) {
+    triangles.push_back(polygon[0]);
+    triangles.push_back(polygon[j-1]);
+    triangles.push_back(polygon[j]);
+  }
+  if (!edges) return;
+  for (unsigned int j = 0; j < polygon.size(); j++) {
+    indices[MESH_EDGE_RANGE].push_back(polygon[j]);
+    indices[MESH_EDGE_RANGE].push_back(polygon[(j+1) % polygon.size()]);
+  }
+}
+
+
+
+static void
+GLUTBuildMeshArrays(vector<GLUTMeshVertex>& vertices, vector<GLuint> *indices, bool edges)
+{
+  // Gather faces
+  vector<int> vertex_index(mesh->NVertices(), -1);
+  vector<GLuint> polygon;
+  for (int i = 0; i < mesh->NVertices(); i++) mesh->Vertex(i)->id = i;
+  for (int i = 0; i < mesh->NFaces(); i++) {
+    R3MeshFace *face = mesh->Face(i);
+    const R3Vector& normal = face->plane.Normal();
+    polygon.clear();
+    for (unsigned int j = 0; j < face->vertices.size(); j++) {
+      R3MeshVertex *v = face->vertices[j];
+      polygon.push_back(AddMeshVertex(vertices, &vertex_index[v->id], v->position, v->normal, normal, v->texcoords));
+    }
+    AddMeshPolygon(indices, polygon, face->isLeaf, edges);
+  }
+
+  // Gather triangles
+  polygon.resize(3);
+  for (int i = 0; i < mesh->NTriangles(); i++) {
+    const unsigned int *t = mesh->Triangle(i);
+    R3MeshVertex *v[3] = { mesh->Vertex(t[0]), mesh->Vertex(t[1]), mesh->Vertex(t[2]) };
+    R3Vector normal = (v[1]->position - v[0]->position) % (v[2]->position - v[0]->position);
+    normal.Normalize();
+    for (int j = 0; j < 3; j++) {
+      polygon[j] = AddMeshVertex(vertices, &vertex_index[t[j]], v[j]->position, v[j]->normal, normal, v[j]->texcoords);
+    }
+    AddMeshPolygon(indices, polygon, mesh->IsLeafTriangle(i), edges);
+  }
+
+  // Gather packed triangles, decoding their vertices
+  vector<int> packed_index(mesh->NPackedVertices(), -1);
+  for (int i = 0; i < mesh->NPackedTriangles(); i++) {
+    const unsigned int *t = mesh->PackedTriangle(i);
+    R3Point p[3];
+    R3Vector n[3];
+    R2Point uv[3];
+    for (int j = 0; j < 3; j++) {
+      const R3MeshPackedBlock& block = mesh->PackedBlock(t[j]);
+      const R3MeshPackedVertex& vertex = mesh->PackedVertex(t[j]);
+      p[j] = block.Position(vertex);
+      n[j] = block.Normal(vertex);
+      uv[j] = block.TexCoords(vertex);
+    }
+    R3Vector normal = (p[1] - p[0]) % (p[2] - p[0]);
+    normal.Normalize();
+    for (int j = 0; j < 3; j++) {
+      polygon[j] = AddMeshVertex(vertices, &packed_index[t[j]], p[j], n[j], normal, uv[j]);
+    }
+    AddMeshPolygon(indices, polygon, mesh->IsLeafPackedTriangle(i), edges);
+  }
+}
+
+
+
+static bool
+GLUTHasVersion(double version)
+{
+  // Check version of the OpenGL context
+  const char *string = (const char *) glGetString(GL_VERSION);
+  return string && (atof(string) >= version);
+}
+
+
+
+static void
+GLUTSetMeshPointers(const GLUTMeshVertex *vertices)
+{
+  // Point the vertex arrays at interleaved vertices (or offsets into a buffer)
+  glVertexPointer(3, GL_FLOAT, sizeof(GLUTMeshVertex), vertices[0].position);
+  glNormalPointer(GL_FLOAT, sizeof(GLUTMeshVertex), vertices[0].normal);
+  glTexCoordPointer(2, GL_FLOAT, sizeof(GLUTMeshVertex), vertices[0].texcoords);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_NORMAL_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+}
+
+
+
+static void
+GLUTUnsetMeshPointers(void)
+{
+  // Turn the vertex arrays off again
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glDisableClientState(GL_NORMAL_ARRAY);
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+}
+
+
+
+static void
+GLUTCreateMeshBuffers(GLUTMeshBuffers& upload, vector<GLUTMeshVertex>& vertices, vector<GLuint> *indices)
+{
+  // Concatenate indices of bark triangles, leaf triangles, edges and coarse triangles
+  vector<GLuint> elements;
+  size_t nelements = 0;
+  for (int i = 0; i < MESH_VERTEX_RANGE; i++) nelements += indices[i].size();
+  elements.reserve(nelements);
+  for (int i = 0; i < MESH_VERTEX_RANGE; i++) {
+    upload.range_offsets[i] = elements.size() * sizeof(GLuint);
+    upload.range_counts[i] = indices[i].size();
+    elements.insert(elements.end(), indices[i].begin(), indices[i].end());
+    vector<GLuint>().swap(indices[i]);
+  }
+  upload.range_offsets[MESH_VERTEX_RANGE] = 0;
+  upload.range_counts[MESH_VERTEX_RANGE] = vertices.size();
+  upload.buffers[0] = upload.buffers[1] = 0;
+  upload.vertex_array = upload.display_lists = 0;
+  if (vertices.empty()) vertices.resize(1);
+  if (elements.empty()) elements.resize(1);
+
+#ifdef GL_VERSION_1_5
+  // Copy vertices and indices into buffers
+  if (GLUTHasVersion(1.5)) {
+#if defined(GL_VERSION_3_0) && !defined(__APPLE__)
+    // Keep the array setup in a vertex array object
+    if (GLUTHasVersion(3.0)) {
+      glGenVertexArrays(1, &upload.vertex_array);
+      glBindVertexArray(upload.vertex_array);
+    }
+#endif
+    glGenBuffers(2, upload.buffers);
+    glBindBuffer(GL_ARRAY_BUFFER, upload.buffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLUTMeshVertex), vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, upload.buffers[1]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, elements.size() * sizeof(GLuint), elements.data(), GL_STATIC_DRAW);
+    if (upload.vertex_array) {
+      GLUTSetMeshPointers(NULL);
+#ifdef GL_VERSION_3_0
+      glBindVertexArray(0);
+#endif
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    return;
+  }
+#endif
+
+  // Otherwise compile a display list for each range
+  upload.display_lists = glGenLists(MESH_NUM_RANGES);
+  GLUTSetMeshPointers(vertices.data());
+  for (int i = 0; i < MESH_NUM_RANGES; i++) {
+    glNewList(upload.display_lists + i, GL_COMPILE);
+    if (i == MESH_VERTEX_RANGE) glDrawArrays(GL_POINTS, 0, upload.range_counts[i]);
+    else glDrawElements((i == MESH_EDGE_RANGE) ? GL_LINES : GL_TRIANGLES, upload.range_counts[i], 
+      GL_UNSIGNED_INT, (const char *) elements.data() + upload.range_offsets[i]);
+    glEndList();
+  }
+  GLUTUnsetMeshPointers();
+}
+
+
+
+static void
+GLUTDeleteMeshBuffers(GLUTMeshBuffers& upload)
+{
+  // Delete vertex array, buffers and display lists
+#ifdef GL_VERSION_3_0
+  if (upload.vertex_array) glDeleteVertexArrays(1, &upload.vertex_array);
+#endif
+#ifdef GL_VERSION_1_5
+  if (upload.buffers[0]) glDeleteBuffers(2, upload.buffers);
+#endif
+  if (upload.display_lists) glDeleteLists(upload.display_lists, MESH_NUM_RANGES);
+  upload.vertex_array = upload.buffers[0] = upload.buffers[1] = upload.display_lists = 0;
+  for (int i = 0; i < MESH_NUM_RANGES; i++) upload.range_counts[i] = 0;
+  upload.clusters.clear();
+}
+
+
+
+static void
+GLUTBuildMeshClusters(const vector<GLUTMeshVertex>& vertices, vector<GLuint> *indices, vector<GLUTMeshCluster>& clusters)
+{
+  // Find bounding box of vertices
+  clusters.clear();
+  int ntriangles = (indices[MESH_BARK_RANGE].size() + indices[MESH_LEAF_RANGE].size()) / 3;
+  if (ntriangles == 0) return;
+  R3Box bbox = R3null_box;
+  for (unsigned int i = 0; i < vertices.size(); i++) {
+    const GLfloat *p = vertices[i].position;
+    bbox.Union(R3Point(p[0], p[1], p[2]));
+  }
+
+  // Choose cubic cells holding about GLUT_CLUSTER_TRIANGLES triangles,
+  // with at most GLUT_CLUSTER_GRID_SIZE cells along the longest side
+  double max_length = bbox.LongestAxisLength();
+  if (max_length <= 0) max_length = 1;
+  double volume = 1;
+  for (int k = 0; k < 3; k++) volume *= std::max(bbox.AxisLength(k), 1.0E-3 * max_length);
+  double cell_size = cbrt(volume / std::max(1.0, (double) ntriangles / GLUT_CLUSTER_TRIANGLES));
+  cell_size = std::max(cell_size, max_length / GLUT_CLUSTER_GRID_SIZE);
+  int grid_size[3];
+  for (int k = 0; k < 3; k++) {
+    grid_size[k] = (int) ceil(bbox.AxisLength(k) / cell_size);
+    grid_size[k] = std::max(1, std::min(GLUT_CLUSTER_GRID_SIZE, grid_size[k]));
+  }
+  int ncells = grid_size[0] * grid_size[1] * grid_size[2];
+
+  // Sort bark and leaf triangles by the cell holding their centroid,
+  // keeping their order within each cell
+  vector<GLsizei> range_starts[2];
+  for (int r = MESH_BARK_RANGE; r <= MESH_LEAF_RANGE; r++) {
+    const vector<GLuint>& triangles = indices[r];
+    int n = triangles.size() / 3;
+    vector<int> triangle_cells(n);
+    range_starts[r].assign(ncells + 1, 0);
+    for (int i = 0; i < n; i++) {
+      R3Point centroid = R3zero_point;
+      for (int j = 0; j < 3; j++) {
+        const GLfloat *p = vertices[triangles[3*i+j]].position;
+        centroid += R3Point(p[0], p[1], p[2]) / 3.0;
+      }
+      int cell = 0;
+      for (int k = 2; k >= 0; k--) {
+        int c = (int) ((centroid[k] - bbox.Min()[k]) / cell_size);
+        cell = cell * grid_size[k] + std::max(0, std::min(grid_size[k] - 1, c));
+      }
+      triangle_cells[i] = cell;
+      range_starts[r][cell + 1] += 3;
+    }
+    for (int c = 0; c < ncells; c++) range_starts[r][c + 1] += range_starts[r][c];
+    vector<GLuint> sorted(triangles.size());
+    vector<GLsizei> next(range_starts[r].begin(), range_starts[r].end() - 1);
+    for (int i = 0; i < n; i++) {
+      GLsizei& k = next[triangle_cells[i]];
+      for (int j = 0; j < 3; j++) sorted[k++] = triangles[3*i+j];
+    }
+    indices[r].swap(sorted);
+  }
+
+  // Make a cluster for every cell with triangles
+  std::unordered_map<long long, GLuint> representatives;
+  for (int c = 0; c < ncells; c++) {
+    GLUTMeshCluster cluster;
+    cluster.bbox = R3null_box;
+    cluster.size = sqrt(3.0) * cell_size;
+    for (int r = 0; r < MESH_NUM_RANGES; r++) cluster.range_starts[r] = cluster.range_counts[r] = 0;
+    for (int r = MESH_BARK_RANGE; r <= MESH_LEAF_RANGE; r++) {
+      cluster.range_starts[r] = range_starts[r][c];
+      cluster.range_counts[r] = range_starts[r][c + 1] - range_starts[r][c];
+      for (GLsizei i = range_starts[r][c]; i < range_starts[r][c + 1]; i++) {
+        const GLfloat *p = vertices[indices[r][i]].position;
+        cluster.bbox.Union(R3Point(p[0], p[1], p[2]));
+      }
+    }
+    if (cluster.bbox.IsEmpty()) continue;
+
+    // Make coarse copy, replacing the vertices in each cell of a finer grid
+    // with the first one, and leaving out triangles that become degenerate
+    double coarse_size = cell_size / GLUT_CLUSTER_COARSE_GRID_SIZE;
+    for (int r = MESH_BARK_RANGE; r <= MESH_LEAF_RANGE; r++) {
+      int coarse_range = (r == MESH_BARK_RANGE) ? MESH_COARSE_BARK_RANGE : MESH_COARSE_LEAF_RANGE;
+      vector<GLuint>& coarse_triangles = indices[coarse_range];
+      cluster.range_starts[coarse_range] = coarse_triangles.size();
+      representatives.clear();
+      for (GLsizei i = range_starts[r][c]; i < range_starts[r][c + 1]; i += 3) {
+        GLuint t[3];
+        for (int j = 0; j < 3; j++) {
+          GLuint v = indices[r][i + j];
+          const GLfloat *p = vertices[v].position;
+          long long key = 0;
+          for (int k = 2; k >= 0; k--) key = (key << 21) | (long long) ((p[k] - bbox.Min()[k]) / coarse_size);
+          t[j] = representatives.insert(std::make_pair(key, v)).first->second;
+        }
+        if ((t[0] == t[1]) || (t[1] == t[2]) || (t[2] == t[0])) continue;
+        coarse_triangles.insert(coarse_triangles.end(), t, t + 3);
+      }
+      cluster.range_counts[coarse_range] = coarse_triangles.size() - cluster.range_starts[coarse_range];
+    }
+    clusters.push_back(cluster);
+  }
+}
+
+
+
+static bool
+GLUTIsBoxInView(const R3Box& box, const R3Vector *planes, const double *offsets, int nplanes)
+{
+  // Check whether box is on the inner side of all planes (p.normal >= offset)
+  for (int i = 0; i < nplanes; i++) {
+    const R3Vector& normal = planes[i];
+    R3Point p((normal[0] > 0) ? box.XMax() : box.XMin(), (normal[1] > 0) ? box.YMax() : box.YMin(),
+      (normal[2] > 0) ? box.ZMax() : box.ZMin());
+    if (normal.Dot(p.Vector()) < offsets[i]) return false;
+  }
+  return true;
+}
+
+
+
+static void
+GLUTDrawMeshClusters(const GLUTMeshBuffers& upload, int range)
+{
+  // Make planes of view frustum (as set up in GLUTRedraw, the camera
+  // looks along -camera_towards)
+  // NOTE: THIS MUST MATCH THE PROJECTION IN GLUTRedraw
+  double mesh_radius = mesh->Radius();
+  double dy = tan(0.5 * camera_yfov);
+  double dx = dy * GLUTwindow_width / GLUTwindow_height;
+  R3Vector view = -camera_towards;
+  R3Vector right = camera_up % camera_towards;
+  R3Vector planes[6] = { dy * view - camera_up, dy * view + camera_up, dx * view - right, dx * view + right, view, -view };
+  double offsets[6];
+  for (int i = 0; i < 6; i++) offsets[i] = planes[i].Dot(camera_eye.Vector());
+  offsets[4] += 0.01 * mesh_radius;
+  offsets[5] -= 100 * mesh_radius;
+  double pixels_per_radian = 0.5 * GLUTwindow_height / dy;
+
+  // Gather the triangles of clusters in view, coarse ones for clusters
+  // that look small, joining runs of clusters next to each other
+  int coarse_range = (range == MESH_BARK_RANGE) ? MESH_COARSE_BARK_RANGE : MESH_COARSE_LEAF_RANGE;
+  vector<GLsizei> counts;
+  vector<const void *> offsets_in_buffer;
+  vector<int> count_ranges;
+  for (unsigned int i = 0; i < upload.clusters.size(); i++) {
+    const GLUTMeshCluster& cluster = upload.clusters[i];
+    if (cluster.range_counts[range] == 0) continue;
+    if (cull_clusters && !GLUTIsBoxInView(cluster.bbox, planes, offsets, 6)) continue;
+    int r = range;
+    if (coarse_clusters) {
+      double distance = R3Distance(camera_eye, cluster.bbox.ClosestPoint(camera_eye));
+      if (cluster.size * pixels_per_radian < GLUT_CLUSTER_COARSE_PIXELS * distance) r = coarse_range;
+    }
+    if (cluster.range_counts[r] == 0) continue;
+    const char *start = (const char *) NULL + upload.range_offsets[r] + cluster.range_starts[r] * sizeof(GLuint);
+    if (!counts.empty() && (count_ranges.back() == r) && 
+        ((const char *) offsets_in_buffer.back() + counts.back() * sizeof(GLuint) == start)) {
+      counts.back() += cluster.range_counts[r];
+    }
+    else {
+      counts.push_back(cluster.range_counts[r]);
+      offsets_in_buffer.push_back(start);
+      count_ranges.push_back(r);
+    }
+    frame_triangles += cluster.range_counts[r] / 3;
+  }
+  if (counts.empty()) return;
+
+#ifdef GL_VERSION_1_5
+  // Bind buffers
+  if (upload.vertex_array) {
+#ifdef GL_VERSION_3_0
+    glBindVertexArray(upload.vertex_array);
+#endif
+  }
+  else {
+    glBindBuffer(GL_ARRAY_BUFFER, upload.buffers[0]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, upload.buffers[1]);
+    GLUTSetMeshPointers(NULL);
+  }
+
+  // Draw all runs in one call
+  glMultiDrawElements(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT, offsets_in_buffer.data(), counts.size());
+
+  // Unbind buffers
+  if (upload.vertex_array) {
+#ifdef GL_VERSION_3_0
+    glBindVertexArray(0);
+#endif
+  }
+  else {
+    GLUTUnsetMeshPointers();
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  }
+#endif
+}
+
+
+
+static void
+GLUTDrawMeshBuffers(const GLUTMeshBuffers& upload, int range)
+{
+  // Check range
+  if (upload.range_counts[range] == 0) return;
+
+  // Draw bark and leaf triangles of the clusters in view
+  if (!upload.clusters.empty() && !upload.display_lists && (range <= MESH_LEAF_RANGE) && 
+      (cull_clusters || coarse_clusters)) {
+    GLUTDrawMeshClusters(upload, range);
+    return;
+  }
+
+  // Count triangles drawn
+  if ((range <= MESH_LEAF_RANGE) || (range == MESH_COARSE_BARK_RANGE) || (range == MESH_COARSE_LEAF_RANGE)) {
+    frame_triangles += upload.range_counts[range] / 3;
+  }
+
+  // Draw range from display list
+  if (upload.display_lists) {
+    glCallList(upload.display_lists + range);
+    return;
+  }
+
+#ifdef GL_VERSION_1_5
+  // Bind buffers
+  if (upload.vertex_array) {
+#ifdef GL_VERSION_3_0
+    glBindVertexArray(upload.vertex_array);
+#endif
+  }
+  else {
+    glBindBuffer(GL_ARRAY_BUFFER, upload.buffers[0]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, upload.buffers[1]);
+    GLUTSetMeshPointers(NULL);
+  }
+
+  // Draw range from buffers
+  if (range == MESH_VERTEX_RANGE) glDrawArrays(GL_POINTS, 0, upload.range_counts[range]);
+  else glDrawElements((range == MESH_EDGE_RANGE) ? GL_LINES : GL_TRIANGLES, upload.range_counts[range], 
+    GL_UNSIGNED_INT, (const char *) NULL + upload.range_offsets[range]);
+
+  // Unbind buffers
+  if (upload.vertex_array) {
+#ifdef GL_VERSION_3_0
+    glBindVertexArray(0);
+#endif
+  }
+  else {
+    GLUTUnsetMeshPointers();
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  }
+#endif
+}
+
+
+
+void GLUTInvalidateMesh(void)
+{
+  // Delete uploaded mesh, so that it is uploaded again before it is drawn
+  GLUTDeleteMeshBuffers(mesh_buffers);
+  mesh_uploaded = false;
+
+  // Fit hierarchy to the moved vertices (the elements are the same)
+  if (mesh_bvh) mesh_bvh->Refit();
+}
+
+
+
+void GLUTUploadMesh(void)
+{
+  // Delete previous upload
+  GLUTInvalidateMesh();
+
+  // Gather vertices, and indices of bark triangles, leaf triangles and edges
+  vector<GLUTMeshVertex> vertices;
+  vector<GLuint> indices[MESH_NUM_RANGES];
+  mesh_has_edges = show_edges;
+  GLUTBuildMeshArrays(vertices, indices, mesh_has_edges);
+
+  // Sort triangles into clusters, and make coarse copies of them
+  vector<GLUTMeshCluster> clusters;
+  GLUTBuildMeshClusters(vertices, indices, clusters);
+
+  // Copy them into buffers
+  GLUTCreateMeshBuffers(mesh_buffers, vertices, indices);
+  mesh_buffers.clusters.swap(clusters);
+  mesh_uploaded = true;
+}
+
+
+
+void GLUTDrawMesh(int range)
+{
+  // Draw the pieces that have arrived while the mesh is loading
+  if (!mesh_loaded) {
+    for (unsigned int i = 0; i < mesh_pieces.size(); i++) GLUTDrawMeshBuffers(mesh_pieces[i], range);
+    return;
+  }
+
+  // Upload mesh if it changed, or if edges are needed for the first time
+  if (!mesh_uploaded || ((range == MESH_EDGE_RANGE) && !mesh_has_edges)) GLUTUploadMesh();
+
+  // Draw range
+  GLUTDrawMeshBuffers(mesh_buffers, range);
+}
+
+
+
+////////////////////////////////////////////////////////////
+// BENCHMARK FUNCTIONS
+////////////////////////////////////////////////////////////
+
+static bool
+GLUTHasTimerQueries(void)
+{
+  // Check for GL_TIME_ELAPSED queries
+#ifdef GL_VERSION_3_3
+  return GLUTHasVersion(3.3);
+#else
+  return false;
+#endif
+}
+
+
+
+static void
+GLUTSetBenchmarkCamera(int frame)
+{
+  // Orbit once around the vertical axis through the mesh center, starting
+  // where the camera is first put, and zoom from 2.5 times the radius of
+  // the mesh to 1 time and back
+  double t = (double) frame / benchmark_nframes;
+  double angle = 2 * M_PI * t;
+  double zoom = sin(M_PI * t);
+  double distance = (2.5 - 1.5 * zoom * zoom) * mesh->Radius();
+  camera_towards = R3Vector(sin(angle), 0, cos(angle));
+  camera_up = R3Vector(0, 1, 0);
+  camera_eye = mesh->Center() + distance * camera_towards;
+}
+
+
+
+static void
+GLUTWriteBenchmark(FILE *fp, double total_time)
+{
+  // Gather times (GPU times wait for the queries to finish)
+  int nframes = benchmark_frames.size();
+  bool gpu = GLUTHasTimerQueries();
+  vector<double> gpu_times(nframes, 0);
+  double cpu_total = 0, gpu_total = 0;
+  long long triangles_total = 0;
+  for (int i = 0; i < nframes; i++) {
+    GLUTBenchmarkFrame& frame = benchmark_frames[i];
+#ifdef GL_VERSION_3_3
+    if (gpu) {
+      GLuint64 nanoseconds = 0;
+      glGetQueryObjectui64v(frame.query, GL_QUERY_RESULT, &nanoseconds);
+      glDeleteQueries(1, &frame.query);
+      gpu_times[i] = 1.0E-9 * nanoseconds;
+    }
+#endif
+    cpu_total += frame.cpu_time;
+    gpu_total += gpu_times[i];
+    triangles_total += frame.triangles;
+  }
+
+  // Write summary
+  fprintf(fp, "{\n  \"mesh\": \"");
+  for (const char *c = input_mesh_name; *c; c++) {
+    if ((*c == '"') || (*c == '\\')) fputc('\\', fp);
+    fputc(*c, fp);
+  }
+  fprintf(fp, "\",\n");
+  fprintf(fp, "  \"renderer\": \"%s\",\n", (const char *) glGetString(GL_RENDERER));
+  fprintf(fp, "  \"width\": %d,\n  \"height\": %d,\n", GLUTwindow_width, GLUTwindow_height);
+  fprintf(fp, "  \"frames\": %d,\n", nframes);
+  fprintf(fp, "  \"seconds\": %.6f,\n", total_time);
+  fprintf(fp, "  \"frames_per_second\": %.3f,\n", nframes / total_time);
+  fprintf(fp, "  \"triangles_per_second\": %.0f,\n", triangles_total / total_time);
+  fprintf(fp, "  \"mean_cpu_ms\": %.4f,\n", 1000 * cpu_total / nframes);
+  if (gpu) fprintf(fp, "  \"mean_gpu_ms\": %.4f,\n", 1000 * gpu_total / nframes);
+  else fprintf(fp, "  \"mean_gpu_ms\": null,\n");
+
+  // Write frames
+  fprintf(fp, "  \"frame_list\": [\n");
+  for (int i = 0; i < nframes; i++) {
+    fprintf(fp, "    { \"cpu_ms\": %.4f, ", 1000 * benchmark_frames[i].cpu_time);
+    if (gpu) fprintf(fp, "\"gpu_ms\": %.4f, ", 1000 * gpu_times[i]);
+    else fprintf(fp, "\"gpu_ms\": null, ");
+    fprintf(fp, "\"triangles\": %lld }%s\n", benchmark_frames[i].triangles, (i < nframes - 1) ? "," : "");
+  }
+  fprintf(fp, "  ]\n}\n");
+  fflush(fp);
+}
+
+
+
+void GLUTStartBenchmark(void)
+{
+  // Draw one frame first, so that uploads are not timed
+  benchmarking = true;
+  benchmark_frame = -1;
+  benchmark_frames.clear();
+  GLUTSetBenchmarkCamera(0);
+  glutPostRedisplay();
+}
+
+
+
+void GLUTBeginBenchmarkFrame(void)
+{
+  // Start timing frame
+  frame_triangles = 0;
+  if (benchmark_frame < 0) return;
+  GLUTBenchmarkFrame frame = { 0, 0, 0 };
+#ifdef GL_VERSION_3_3
+  if (GLUTHasTimerQueries()) {
+    glGenQueries(1, &frame.query);
+    glBeginQuery(GL_TIME_ELAPSED, frame.query);
+  }
+#endif
+  benchmark_frames.push_back(frame);
+  benchmark_frame_time = std::chrono::steady_clock::now();
+}
+
+
+
+void GLUTEndBenchmarkFrame(void)
+{
+  // Finish the frame drawn before timing starts
+  if (benchmark_frame < 0) {
+    glFinish();
+    benchmark_start_time = std::chrono::steady_clock::now();
+  }
+
+  // Record time of frame
+  else {
+    GLUTBenchmarkFrame& frame = benchmark_frames.back();
+    frame.cpu_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - benchmark_frame_time).count();
+    frame.triangles = frame_triangles;
+  }
+
+  // Go on to the next frame
+  if (++benchmark_frame < benchmark_nframes) {
+    GLUTSetBenchmarkCamera(benchmark_frame);
+    glutPostRedisplay();
+    return;
+  }
+
+  // Wait for the last frame, write times, and quit
+  glFinish();
+  double total_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - benchmark_start_time).count();
+  GLUTWriteBenchmark(stdout, total_time);
+  benchmarking = false;
+  quit = 1;
+  glutPostRedisplay();
+}
+
+
+
+////////////////////////////////////////////////////////////
+// MESH LOADING FUNCTIONS
+////////////////////////////////////////////////////////////
+
+static void
+GLUTBuildMeshPiece(GLUTMeshPiece& piece, R3Mesh *mesh, int start_face, int end_face)
+{
+  // Gather faces (vertex normals are not known until the whole mesh is
+  // read, so faces without them are drawn flat, and no vertices are shared)
+  vector<GLuint> polygon;
+  for (int i = start_face; i < end_face; i++) {
+    R3MeshFace *face = mesh->Face(i);
+    const R3Vector& normal = face->plane.Normal();
+    polygon.clear();
+    for (unsigned int j = 0; j < face->vertices.size(); j++) {
+      R3MeshVertex *v = face->vertices[j];
+      int index = -1;
+      polygon.push_back(AddMeshVertex(piece.vertices, &index, v->position, v->normal, normal, v->texcoords));
+    }
+    AddMeshPolygon(piece.indices, polygon, face->isLeaf, false);
+  }
+}
+
+
+
+static void
+GLUTReadMesh(GLUTMeshLoad *load)
+{
+  // Pass every chunk of faces read to the main thread
+  R3Mesh *read_mesh = new R3Mesh();
+  read_mesh->read_progress = [load, read_mesh](int start_face, int end_face, int nfaces) {
+    GLUTMeshPiece piece;
+    GLUTBuildMeshPiece(piece, read_mesh, start_face, end_face);
+    std::lock_guard<std::mutex> lock(load->mutex);
+    if (end_face > start_face) load->pieces.push_back(std::move(piece));
+    load->bbox = read_mesh->bbox;
+    load->nfaces_read = end_face;
+    load->nfaces = nfaces;
+    load->arrived.notify_one();
+  };
+
+  // Generate tree (triangulated or packed as it is drawn)
+  if (input_is_grammar) {
+    read_mesh->read_progress = nullptr;
+    read_mesh->verbose = print_verbose;
+    read_mesh->triangulate = triangulate;
+    read_mesh->packing = pack;
+    if (!read_mesh->Tree(input_mesh_name, 0, &grammar_cache)) {
+      delete read_mesh;
+      read_mesh = NULL;
+    }
+  }
+
+  // Read mesh
+  else if (!read_mesh->Read(input_mesh_name)) {
+    delete read_mesh;
+    read_mesh = NULL;
+  }
+
+  // Move faces into the triangle buffer, and vertices and faces into packed storage
+  if (read_mesh && !input_is_grammar) {
+    read_mesh->read_progress = nullptr;
+    if (triangulate) read_mesh->Triangulate();
+    if (pack) read_mesh->Pack();
+  }
+
+  // Pass mesh to the main thread
+  std::lock_guard<std::mutex> lock(load->mutex);
+  load->mesh = read_mesh;
+  load->done = true;
+  load->arrived.notify_one();
+}
+
+
+
+static void
+GLUTFitCamera(void)
+{
+  // Look at the mesh from the direction the camera is looking
+  double mesh_radius = mesh->Radius();
+  R3Point mesh_center = mesh->Center();
+  camera_eye = mesh_center + 2.5 * mesh_radius * camera_towards;
+}
+
+
+
+void GLUTLoadMesh(void)
+{
+  // Start reading mesh in the background
+  mesh_load = new GLUTMeshLoad();
+  mesh_load->bbox = R3null_box;
+  mesh_load->nfaces_read = 0;
+  mesh_load->nfaces = 0;
+  mesh_load->mesh = NULL;
+  mesh_load->done = false;
+  mesh_load->thread = std::thread(GLUTReadMesh, mesh_load);
+}
+
+
+
+void GLUTIdle(void)
+{
+  // Wait briefly for more of the mesh
+  vector<GLUTMeshPiece> pieces;
+  R3Box bbox;
+  bool done;
+  {
+    std::unique_lock<std::mutex> lock(mesh_load->mutex);
+    if (mesh_load->pieces.empty() && !mesh_load->done) {
+      mesh_load->arrived.wait_for(lock, std::chrono::milliseconds(10));
+    }
+    pieces.swap(mesh_load->pieces);
+    bbox = mesh_load->bbox;
+    done = mesh_load->done;
+  }
+
+  // Fit camera to the bounding box, once the vertices are read
+  if (!mesh_loaded && !(bbox == mesh->bbox)) {
+    mesh->bbox = bbox;
+    if (!camera_fitted && !bbox.IsEmpty()) {
+      GLUTFitCamera();
+      camera_fitted = true;
+    }
+    glutPostRedisplay();
+  }
+
+  // Upload pieces of faces
+  for (unsigned int i = 0; i < pieces.size(); i++) {
+    GLUTMeshBuffers piece_buffers;
+    GLUTCreateMeshBuffers(piece_buffers, pieces[i].vertices, pieces[i].indices);
+    mesh_pieces.push_back(piece_buffers);
+    glutPostRedisplay();
+  }
+
+  // Check whether the whole mesh is read
+  if (!done) return;
+  mesh_load->thread.join();
+  R3Mesh *read_mesh = mesh_load->mesh;
+  delete mesh_load;
+  mesh_load = NULL;
+  glutIdleFunc(NULL);
+  if (!read_mesh && mesh_loaded) {
+    // Keep showing the previous tree until the description is fixed
+    fprintf(stderr, "Unable to generate %s again\n", input_mesh_name);
+    return;
+  }
+  if (!read_mesh) {
+    fprintf(stderr, "Unable to read mesh from %s\n", input_mesh_name);
+    exit(-1);
+  }
+  if (input_is_grammar && mesh_loaded && print_verbose) {
+    printf("Generated %s again: %d vertices, %d faces, %d triangles\n", input_mesh_name,
+      read_mesh->NVertices() + read_mesh->NPackedVertices(), read_mesh->NFaces(),
+      read_mesh->NTriangles() + read_mesh->NPackedTriangles());
+  }
+
+  // Replace the pieces with the whole mesh
+  for (unsigned int i = 0; i < mesh_pieces.size(); i++) GLUTDeleteMeshBuffers(mesh_pieces[i]);
+  mesh_pieces.clear();
+  if (mesh_bvh) delete mesh_bvh;
+  mesh_bvh = NULL;
+  pick_active = false;
+  pick_face = NULL;
+  pick_triangle = pick_packed_triangle = -1;
+  R3Point fitted_eye = mesh->Center() + 2.5 * mesh->Radius() * camera_towards;
+  bool camera_moved = camera_fitted && !(camera_eye == fitted_eye);
+  delete mesh;
+  mesh = read_mesh;
+  GLUTInvalidateMesh();
+  mesh_loaded = true;
+
+  // Fit camera to the whole mesh (unless it was moved while loading)
+  if (!camera_moved) GLUTFitCamera();
+  camera_fitted = true;
+
+  // Run benchmark, or quit once the mesh is drawn, if asked to
+  if (benchmark_nframes > 0) GLUTStartBenchmark();
+  else if (exit_immediately) quit = 1;
+  glutPostRedisplay();
+}
+
+
+
+static bool
+GLUTReadGrammarText(string& text)
+{
+  // Read the whole tree description
+  std::ifstream file(input_mesh_name);
+  if (!file) return false;
+  std::ostringstream stream;
+  stream << file.rdbuf();
+  text = stream.str();
+  return true;
+}
+
+
+
+void GLUTWatchGrammar(int value)
+{
+  // Generate tree again if its description changed (and is not being generated)
+  string text;
+  if (!mesh_load && GLUTReadGrammarText(text) && !text.empty() && (text != grammar_text)) {
+    grammar_text = text;
+    GLUTLoadMesh();
+    glutIdleFunc(GLUTIdle);
+  }
+
+  // Check again later
+  glutTimerFunc(GLUT_GRAMMAR_WATCH_INTERVAL, GLUTWatchGrammar, 0);
+}
+
+
+
 ////////////////////////////////////////////////////////////
 // GLUT USER INTERFACE FUNCTIONS
 ////////////////////////////////////////////////////////////
@@ -94,32 +1137,68 @@ void GLUTDrawText(const R3Point& p, const char *s)
 
 
 
-void GLUTSaveImage(const char *filename)
-{ 
-  // Create image
-  R2Image image(GLUTwindow_width, GLUTwindow_height);
+static void
+GLUTWriteImageCapture(GLUTImageCapture& capture)
+{
+  // Write pending capture, handing rows (bottom first) to the image writer
+  if (capture.filename.empty()) return;
+#ifdef GL_VERSION_2_1
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.buffer);
+  const unsigned char *pixels = (const unsigned char *) glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+  if (!pixels || !R3MeshRenderer::WriteImage(capture.filename.c_str(), pixels, capture.width, capture.height, true)) {
+    fprintf(stderr, "Unable to save image %s\n", capture.filename.c_str());
+  }
+  if (pixels) glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+#endif
+  capture.filename.clear();
+}
 
-  // Read screen into buffer
-  GLfloat *pixels = new GLfloat [ 3 * GLUTwindow_width * GLUTwindow_height ];
-  glReadPixels(0, 0, GLUTwindow_width, GLUTwindow_height, GL_RGB, GL_FLOAT, pixels);
 
-  // Load pixels from frame buffer
-  GLfloat *pixelsp = pixels;
-  for (int j = 0; j < GLUTwindow_height; j++) {
-    for (int i = 0; i < GLUTwindow_width; i++) {
-      double r = (double) *(pixelsp++);
-      double g = (double) *(pixelsp++);
-      double b = (double) *(pixelsp++);
-      R2Pixel pixel(r, g, b, 1);
-      image.SetPixel(i, j, pixel);
-    }
+
+void GLUTFinishImages(void)
+{
+  // Write pending captures, oldest first
+  for (int i = 1; i <= 2; i++) {
+    GLUTWriteImageCapture(image_captures[(image_capture_index + i) % 2]);
   }
+}
 
-  // Write image to file
-  image.Write(filename);
 
-  // Delete buffer
-  delete [] pixels;
+
+void GLUTSaveImage(const char *filename, bool wait=true)
+{ 
+  // Read screen as bytes in tight rows
+  int width = GLUTwindow_width;
+  int height = GLUTwindow_height;
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+#ifdef GL_VERSION_2_1
+  // Start reading into a pixel buffer, and write the capture before
+  // while the pixels arrive
+  if (GLUTHasVersion(2.1)) {
+    GLUTImageCapture& capture = image_captures[image_capture_index];
+    if (!capture.buffer) glGenBuffers(1, &capture.buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, 3 * width * height, NULL, GL_STREAM_READ);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    capture.width = width;
+    capture.height = height;
+    capture.filename = filename;
+    image_capture_index = 1 - image_capture_index;
+    GLUTWriteImageCapture(image_captures[image_capture_index]);
+    if (wait) GLUTFinishImages();
+    return;
+  }
+#endif
+
+  // Otherwise read into memory and write right away
+  vector<unsigned char> pixels(3 * width * height);
+  glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+  if (!R3MeshRenderer::WriteImage(filename, pixels.data(), width, height, true)) {
+    fprintf(stderr, "Unable to save image %s\n", filename);
+  }
 }
 
 
@@ -127,8 +1206,19 @@ void GLUTSaveImage(const char *filename)
 
 void GLUTStop(void)
 {
-  // Save mesh
-  if (output_mesh_name) mesh->Write(output_mesh_name);
+  // Write pending images
+  GLUTFinishImages();
+
+  // Save mesh (unless it is still loading)
+  if (output_mesh_name && mesh_loaded) mesh->Write(output_mesh_name);
+
+  // Wait for the mesh being read, which uses static data destroyed on exit
+  if (mesh_load) {
+    mesh_load->thread.join();
+    if (mesh_load->mesh) delete mesh_load->mesh;
+    delete mesh_load;
+    mesh_load = NULL;
+  }
 
   // Destroy window 
   glutDestroyWindow(GLUTwindow);
@@ -156,70 +1246,53 @@ void GLUTResize(int w, int h)
 }
 
 //ABIUSX
-GLuint LoadTexture( const char * filename ,int width,int height)
+static GLuint
+GLUTLoadTexture(const R3MeshTexture& texture)
 {
+  // Leave faces untextured if the texture could not be read
+  if (texture.IsEmpty()) return 0;
+
+  // Upload every mipmap level
+  GLuint id;
+  glGenTextures(1, &id);
+  glBindTexture(GL_TEXTURE_2D, id);
+  glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (int level = 0; level < texture.NLevels(); level++) {
+    glTexImage2D(GL_TEXTURE_2D, level, GL_RGB, texture.Width(level), texture.Height(level), 0,
+      GL_RGB, GL_UNSIGNED_BYTE, texture.Texels(level));
+  }
 
-  GLuint texture;
-
-  // int width, height;
-
-  unsigned char * data;
-
-  FILE * file;
-
-  file = fopen( filename, "rb" );
-
-  if ( file == NULL ) return 0;
-  data = (unsigned char *)malloc( width * height * 3 );
-  //int size = fseek(file,);
-  fread( data, width * height * 3, 1, file );
-  fclose( file );
-
-  for(int i = 0; i < width * height ; ++i)
-  {
-   int index = i*3;
-   unsigned char B,R;
-   B = data[index];
-   R = data[index+2];
-
-   data[index] = R;
-   data[index+2] = B;
-
- }
-
-
- glGenTextures( 1, &texture );
- glBindTexture( GL_TEXTURE_2D, texture );
- glTexEnvf( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE,GL_MODULATE );
- glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_NEAREST );
+  // Return texture id
+  return id;
+}
 
- glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
- glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,GL_LINEAR );
- glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,GL_REPEAT );
- glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,GL_REPEAT );
- gluBuild2DMipmaps( GL_TEXTURE_2D, 3, width, height,GL_RGB, GL_UNSIGNED_BYTE, data );
-  // glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, 
-  //   height, 0, GL_RGB, GL_UNSIGNED_BYTE, 
-  //   data);
- free( data );
 
- return texture;
-}
 GLuint tree,leaf;
 void GLUTTexture()
 {
 
   glEnable(GL_TEXTURE_2D);
-  glShadeModel(GL_FLAT);
+  glShadeModel(GL_SMOOTH);
   glEnable(GL_DEPTH_TEST);
 
-  tree=LoadTexture("textures/lightwood.bmp",512,512);
-  leaf=LoadTexture("textures/leaf.bmp",512,512);
+  tree=GLUTLoadTexture(textures[0]);
+  leaf=GLUTLoadTexture(textures[1]);
 
 }
 void GLUTRedraw(void)
 {
+  // Write the screenshot read during the last frame
+  GLUTFinishImages();
+
+  // Start timing frame
+  if (benchmarking) GLUTBeginBenchmarkFrame();
+
   // Set projection transformation
   glMatrixMode(GL_PROJECTION);
   glLoadIdentity();
@@ -260,57 +1333,32 @@ void GLUTRedraw(void)
     glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, diffuse); 
     glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, specular); 
     glMaterialfv(GL_FRONT_AND_BACK, GL_SHININESS, shininess); 
-    for (int i = 0; i < mesh->NFaces(); i++) {
-      R3MeshFace *face = mesh->Face(i);
-      if (face->isLeaf) //ABIUSX
-        glBindTexture(GL_TEXTURE_2D, leaf); //ABIUSX
-      else //ABIUSX
-        glBindTexture(GL_TEXTURE_2D, tree); //ABIUSX
-      glBegin(GL_POLYGON);
 
-      const R3Vector& normal = face->plane.Normal();
-      glNormal3d(normal[0], normal[1], normal[2]);
-      for (unsigned int j = 0; j < face->vertices.size(); j++) {
-        R3MeshVertex *vertex = face->vertices[j];
-        const R3Point& p = vertex->position;
-        // printf("%f %f\n",vertex->texcoords.X(),vertex->texcoords.Y());
-        glTexCoord2f(vertex->texcoords.X(),vertex->texcoords.Y()); //ABIUSX
-        // glTexCoord2f(p[0],p[1]); //ABIUSX
-        glVertex3f(p[0], p[1], p[2]);
-      }
-      glEnd();
-    }
+    // Draw bark and leaf triangles from the uploaded mesh, one draw call each
+    glBindTexture(GL_TEXTURE_2D, tree);
+    GLUTDrawMesh(MESH_BARK_RANGE);
+    glBindTexture(GL_TEXTURE_2D, leaf);
+    GLUTDrawMesh(MESH_LEAF_RANGE);
   }
 
-  // Draw edges
+  // Draw edges (untextured)
   if (show_edges) {
     glDisable(GL_LIGHTING);
+    glDisable(GL_TEXTURE_2D);
     glColor3d(0.3, 0.3, 0.3);
     glLineWidth(3);
-    for (int i = 0; i < mesh->NFaces(); i++) {
-      glBegin(GL_LINE_LOOP);
-      R3MeshFace *face = mesh->Face(i);
-      for (unsigned int j = 0; j < face->vertices.size(); j++) {
-        R3MeshVertex *vertex = face->vertices[j];
-        const R3Point& p = vertex->position;
-        glVertex3f(p[0], p[1], p[2]);
-      }
-      glEnd();
-    }
+    GLUTDrawMesh(MESH_EDGE_RANGE);
+    glEnable(GL_TEXTURE_2D);
   }
 
-  // Draw vertices
+  // Draw vertices (untextured)
   if (show_vertices) {
     glDisable(GL_LIGHTING);
+    glDisable(GL_TEXTURE_2D);
     glColor3d(0, 0, 0);
     glPointSize(5);
-    glBegin(GL_POINTS);
-    for (int i = 0; i < mesh->NVertices(); i++) {
-      R3MeshVertex *vertex = mesh->Vertex(i);
-      const R3Point& p = vertex->position;
-      glVertex3f(p[0], p[1], p[2]);
-    }
-    glEnd();
+    GLUTDrawMesh(MESH_VERTEX_RANGE);
+    glEnable(GL_TEXTURE_2D);
   }
 
   // Draw vertex IDs
@@ -416,6 +1464,38 @@ void GLUTRedraw(void)
       glEnd();
       glDisable(GL_POLYGON_OFFSET_FILL);
     }
+
+    // Draw pick triangle
+    if (pick_triangle >= 0) {
+      glDisable(GL_LIGHTING);
+      glColor3f(1, 1, 0);
+      glEnable(GL_POLYGON_OFFSET_FILL);
+      glPolygonOffset(-2, -2);
+      glBegin(GL_TRIANGLES);
+      const unsigned int *t = mesh->Triangle(pick_triangle);
+      for (int j = 0; j < 3; j++) {
+        const R3Point& p = mesh->Vertex(t[j])->position;
+        glVertex3f(p[0], p[1], p[2]);
+      }
+      glEnd();
+      glDisable(GL_POLYGON_OFFSET_FILL);
+    }
+
+    // Draw pick packed triangle
+    if (pick_packed_triangle >= 0) {
+      glDisable(GL_LIGHTING);
+      glColor3f(1, 1, 0);
+      glEnable(GL_POLYGON_OFFSET_FILL);
+      glPolygonOffset(-2, -2);
+      glBegin(GL_TRIANGLES);
+      const unsigned int *t = mesh->PackedTriangle(pick_packed_triangle);
+      for (int j = 0; j < 3; j++) {
+        R3Point p = mesh->PackedBlock(t[j]).Position(mesh->PackedVertex(t[j]));
+        glVertex3f(p[0], p[1], p[2]);
+      }
+      glEnd();
+      glDisable(GL_POLYGON_OFFSET_FILL);
+    }
   }
 
   // Write image
@@ -428,26 +1508,54 @@ void GLUTRedraw(void)
       if (!fp) break; 
       else fclose(fp);
     }
-    GLUTSaveImage(image_name);
+    GLUTSaveImage(image_name, false);
     printf("Saved %s\n", image_name);
     save_image = 0;
+    glutPostRedisplay();
+  }
+
+  // Draw progress of loading
+  if (!mesh_loaded) {
+    char buffer[256];
+    int percent = (mesh_load && (mesh_load->nfaces > 0)) ? 100 * mesh_load->nfaces_read / mesh_load->nfaces : 0;
+    sprintf(buffer, "Loading %s: %d%%", input_mesh_name, percent);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_TEXTURE_2D);
+    glDisable(GL_DEPTH_TEST);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluOrtho2D(0, GLUTwindow_width, 0, GLUTwindow_height);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glColor3d(0, 0, 0);
+    GLUTDrawText(R3Point(10, 10, 0), buffer);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_TEXTURE_2D);
   }
 
   // Quit here so that can save image before exit
   if (quit) {
-    if (output_image_name) GLUTSaveImage(output_image_name);
-    if (output_mesh_name) mesh->Write(output_mesh_name);
+    if (output_image_name && mesh_loaded) GLUTSaveImage(output_image_name);
+    if (output_mesh_name && mesh_loaded) mesh->Write(output_mesh_name);
     GLUTStop();
   }
 
+#ifdef GL_VERSION_3_3
+  // Stop timing frame on the GPU
+  if (benchmarking && (benchmark_frame >= 0) && GLUTHasTimerQueries()) glEndQuery(GL_TIME_ELAPSED);
+#endif
+
   // Swap buffers 
   glutSwapBuffers();
+
+  // Stop timing frame, and go on to the next
+  if (benchmarking) GLUTEndBenchmarkFrame();
 }    
 
 
 
 bool 
-GLUTPick(int x, int y, R3Mesh *mesh, R3MeshFace **pick_face, R3Point *pick_position) 
+GLUTPick(int x, int y, R3Mesh *mesh, R3MeshFace **pick_face, int *pick_triangle, int *pick_packed_triangle, R3Point *pick_position) 
 {
   // Check position
   if ((x < 0) || (GLUTwindow_width <= x) || (y < 0) || (GLUTwindow_height <= y)) { 
@@ -455,106 +1563,32 @@ GLUTPick(int x, int y, R3Mesh *mesh, R3MeshFace **pick_face, R3Point *pick_posit
     return false;
   }
 
-  // Allocate select buffer
-  const int SELECT_BUFFER_SIZE = 1024;
-  GLuint select_buffer[SELECT_BUFFER_SIZE];
-  GLint select_buffer_hits;
-
-  // Initialize select buffer
-  glSelectBuffer(SELECT_BUFFER_SIZE, select_buffer);
-  glRenderMode(GL_SELECT);
-  glInitNames();
-  glPushName(0);
-
-  // Initialize view transformation
-  GLint viewport[4];
-  glViewport(0, 0, GLUTwindow_width, GLUTwindow_height);
-  glGetIntegerv(GL_VIEWPORT, viewport);
-  glMatrixMode(GL_PROJECTION);
-  glLoadIdentity();
-  gluPickMatrix((GLdouble) x, (GLdouble) y, 1, 1, viewport);
-
-  // Set projection transformation
-  // NOTE: THIS MUST MATCH CODE IN GLUTRedraw
+  // Build hierarchy over mesh faces the first time, or after the mesh changed
+  if (!mesh_bvh) mesh_bvh = new R3MeshBVH(mesh);
+
+  // Make ray from the camera through the center of the pixel
+  // NOTE: THIS MUST MATCH THE PROJECTION IN GLUTRedraw
+  double aspect = (double) GLUTwindow_width / (double) GLUTwindow_height;
+  double dy = tan(0.5 * camera_yfov);
+  double dx = dy * aspect;
+  double px = 2.0 * (x + 0.5) / GLUTwindow_width - 1;
+  double py = 2.0 * (y + 0.5) / GLUTwindow_height - 1;
+  R3Vector camera_right = camera_up % camera_towards;
+  R3Vector direction = -camera_towards + (px * dx) * camera_right + (py * dy) * camera_up;
+  R3Ray ray(camera_eye, direction);
+
+  // Find the closest element hit beyond the near clipping plane
   double mesh_radius = mesh->Radius(); 
-  gluPerspective(180.0*camera_yfov/M_PI, (GLdouble) GLUTwindow_width /(GLdouble) GLUTwindow_height, 
-    0.01 * mesh_radius, 100 * mesh_radius);
-
-  // Set camera transformation
-  // NOTE: THIS MUST MATCH CODE IN GLUTRedraw
-  R3Vector& t = camera_towards;
-  R3Vector& u = camera_up;
-  R3Vector r = camera_up % camera_towards;
-  GLdouble camera_matrix[16] = { r[0], u[0], t[0], 0, r[1], u[1], t[1], 0, r[2], u[2], t[2], 0, 0, 0, 0, 1 };
-  glMatrixMode(GL_MODELVIEW);
-  glLoadIdentity();
-  glMultMatrixd(camera_matrix);
-  glTranslated(-camera_eye[0], -camera_eye[1], -camera_eye[2]);
-
-  // Draw mesh with pick names into selection buffer
-  glLoadName(0); 
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  for (int i = 0; i < mesh->NFaces(); i++) { 
-    R3MeshFace *face = mesh->Face(i);
-    glLoadName(i + 1); 
-    glBegin(GL_POLYGON);
-    for (unsigned int j = 0; j < face->vertices.size(); j++) {
-      R3MeshVertex *vertex = face->vertices[j];
-      const R3Point& p = vertex->position;
-      glVertex3f(p[0], p[1], p[2]);
-    }
-    glEnd();
-  }
-  glFlush();
-  select_buffer_hits = glRenderMode(GL_RENDER);
-
-  // Process select buffer to find front-most hit
-  int hit = 0;
-  GLuint hit_z = 0xFFFFFFFF;
-  GLuint *bufp = select_buffer;
-  GLuint numnames, z1, z2;
-  for (int i = 0; i < select_buffer_hits; i++) {
-    numnames = *bufp++;
-    z1 = *bufp++;
-    z2 = *bufp++;
-    while (numnames--) {
-      if (z1 < hit_z) {
-        hit = (int) *bufp;
-        hit_z = z1/2 + z2/2;
-      }
-      bufp++;
-    }
-  }
-
-  // Return closest face
-  if ((hit > 0) && (hit <= mesh->NFaces())) {
-    // Find face
-    if (pick_face) {
-      // Subtract one because added one in glLoadName
-      *pick_face = mesh->Face(hit - 1);
-    }
-
-    // Find hit position
-    if (pick_position) {
-      GLdouble p[3];
-      GLdouble modelview_matrix[16];
-      GLdouble projection_matrix[16];
-      GLint viewport[16];
-      glGetDoublev(GL_MODELVIEW_MATRIX, modelview_matrix);
-      glGetDoublev(GL_PROJECTION_MATRIX, projection_matrix);
-      glGetIntegerv(GL_VIEWPORT, viewport);
-      GLdouble z = (GLdouble) hit_z / (GLdouble) 0xFFFFFFFF;
-      gluUnProject(x, y, z, modelview_matrix, projection_matrix, viewport, &(p[0]), &(p[1]), &(p[2]));
-      pick_position->Reset(p[0], p[1], p[2]);
-    }
-
-    // Return hit
-    return true;
-  }
-  else {
-    // Return no hit
-    return false;
-  }
+  R3MeshBVHHit hit;
+  R3Ray clipped_ray(ray.Point(0.01 * mesh_radius), ray.Vector(), true);
+  if (!mesh_bvh->Intersect(clipped_ray, &hit)) return false;
+
+  // Return hit element and position
+  if (pick_face) *pick_face = hit.face;
+  if (pick_triangle) *pick_triangle = hit.triangle;
+  if (pick_packed_triangle) *pick_packed_triangle = hit.packed_triangle;
+  if (pick_position) *pick_position = hit.position;
+  return true;
 }
 
 
@@ -683,10 +1717,16 @@ void GLUTKeyboard(unsigned char key, int x, int y)
   // Process keyboard button event 
   switch (key) {
     case ' ':
-    pick_active = GLUTPick(x, y, mesh, &pick_face, &pick_position);
-    if (pick_active) 
+    pick_active = GLUTPick(x, y, mesh, &pick_face, &pick_triangle, &pick_packed_triangle, &pick_position);
+    if (pick_active && pick_face) 
       printf("Picked face %d with area %g at position (%g %g %g )\n", pick_face->id, 
         pick_face->Area(), pick_position[0], pick_position[1], pick_position[2]);  
+    else if (pick_active && (pick_triangle >= 0)) 
+      printf("Picked triangle %d at position (%g %g %g )\n", pick_triangle, 
+        pick_position[0], pick_position[1], pick_position[2]);  
+    else if (pick_active) 
+      printf("Picked packed triangle %d at position (%g %g %g )\n", pick_packed_triangle, 
+        pick_position[0], pick_position[1], pick_position[2]);  
     break;
 
     case 'B':
@@ -729,6 +1769,16 @@ void GLUTKeyboard(unsigned char key, int x, int y)
     quit = 1;
     break;
 
+    case 'L':
+    case 'l':
+    coarse_clusters = !coarse_clusters;
+    break;
+
+    case 'U':
+    case 'u':
+    cull_clusters = !cull_clusters;
+    break;
+
     case 'V':
     case 'v':
     show_vertices = !show_vertices;
@@ -762,7 +1812,7 @@ void GLUTCommand(int cmd)
     case DISPLAY_NORMAL_TOGGLE_COMMAND: show_normals = !show_normals; break;
     case DISPLAY_CURVATURE_TOGGLE_COMMAND: show_curvatures = !show_curvatures; break;
     case DISPLAY_BBOX_TOGGLE_COMMAND: show_bbox = !show_bbox; break;
-    case TWIST_COMMAND: mesh->Twist(0.5); break;
+    case TWIST_COMMAND: mesh->Twist(0.5); GLUTInvalidateMesh(); break;
     case SAVE_IMAGE_COMMAND: if (output_image_name) GLUTSaveImage(output_image_name); break;
     case SAVE_MESH_COMMAND: if (output_mesh_name) mesh->Write(output_mesh_name); break;
     case QUIT_COMMAND: quit = 1; break;
@@ -840,8 +1890,6 @@ void GLUTInit(int *argc, char **argv)
   // Initialize graphics modes 
   glEnable(GL_DEPTH_TEST);
 
-  //ABIUSX
-  GLUTTexture();
   // Create menus
   GLUTCreateMenu();
 }
@@ -850,10 +1898,11 @@ void GLUTInit(int *argc, char **argv)
 
 void GLUTMainLoop(void)
 {
-  // Setup initial camera parameters
-  double mesh_radius = mesh->Radius();
-  R3Point mesh_center = mesh->Center();
-  camera_eye = mesh_center + 2.5 * mesh_radius * camera_towards;
+  // Take the mesh as it is read
+  glutIdleFunc(GLUTIdle);
+
+  // Watch the tree description for changes
+  if (input_is_grammar) glutTimerFunc(GLUT_GRAMMAR_WATCH_INTERVAL, GLUTWatchGrammar, 0);
 
   // Run main loop -- never returns 
   glutMainLoop();
@@ -876,9 +1925,14 @@ ParseArgs(int argc, char **argv)
     if ((*argv)[0] == '-') {
       if (!strcmp(*argv, "-help")) { print_usage = 1; }
       else if (!strcmp(*argv, "-v")) { print_verbose = 1; }
-      else if (!strcmp(*argv, "-exit_immediately")) { quit = 1; }
+      else if (!strcmp(*argv, "-exit_immediately")) { exit_immediately = 1; }
+      else if (!strcmp(*argv, "-benchmark")) { argc--; argv++; benchmark_nframes = atoi(*argv); }
+      else if (!strcmp(*argv, "-triangulate")) { triangulate = 1; }
+      else if (!strcmp(*argv, "-pack")) { pack = 1; }
       else if (!strcmp(*argv, "-output_image")) { argc--; argv++; output_image_name = *argv; }
       else if (!strcmp(*argv, "-output_mesh")) { argc--; argv++; output_mesh_name = *argv; }
+      else if (!strcmp(*argv, "-bark_texture")) { argc--; argv++; bark_texture_name = *argv; }
+      else if (!strcmp(*argv, "-leaf_texture")) { argc--; argv++; leaf_texture_name = *argv; }
       else { fprintf(stderr, "Invalid program argument: %s", *argv); exit(1); }
       argv++; argc--;
     }
@@ -891,7 +1945,7 @@ ParseArgs(int argc, char **argv)
 
   // Check input_mesh_name
   if (!input_mesh_name || print_usage) {
-    printf("Usage: meshview <input.off> [-output_image <output.jpg>] [-output_mesh <output.off>] [-exit_immediately] [-v]\n");
+    printf("Usage: meshview <input.off | tree.l++> [-output_image <output.jpg>] [-output_mesh <output.off>] [-bark_texture <image>] [-leaf_texture <image>] [-exit_immediately] [-benchmark <nframes>] [-triangulate] [-pack] [-v]\n");
     return 0;
   }
 
@@ -913,18 +1967,31 @@ int main(int argc, char **argv)
   // Parse program arguments
   if (!ParseArgs(argc, argv)) exit(1);
 
-  // Allocate mesh
+  // Read textures while the mesh starts loading
+  std::thread texture_thread([]() {
+    textures[0].Read(bark_texture_name);
+    textures[1].Read(leaf_texture_name);
+  });
+
+  // Allocate mesh, to be replaced by the one read
   mesh = new R3Mesh();
   if (!mesh) {
     fprintf(stderr, "Unable to allocate mesh\n");
     exit(-1);
   }
 
-  // Read mesh
-  if (!mesh->Read(input_mesh_name)) {
-    fprintf(stderr, "Unable to read mesh from %s\n", input_mesh_name);
+  // Read mesh, or generate tree from its description (and triangulate or pack it) in the background
+  const char *extension = strrchr(input_mesh_name, '.');
+  input_is_grammar = extension && (!strcmp(extension, ".l") || !strcmp(extension, ".l3d") || !strcmp(extension, ".l++"));
+  if (input_is_grammar && !GLUTReadGrammarText(grammar_text)) {
+    fprintf(stderr, "Unable to open tree description %s\n", input_mesh_name);
     exit(-1);
   }
+  GLUTLoadMesh();
+
+  // Upload textures
+  texture_thread.join();
+  GLUTTexture();
 
   // Run GLUT interface
   GLUTMainLoop();
@@ -12,6 +12,9 @@
 #elif defined(__APPLE__)
 # include <GLUT/glut.h>
 #else 
+# ifndef GL_GLEXT_PROTOTYPES
+#  define GL_GLEXT_PROTOTYPES
+# endif
 # include <GL/glut.h>
 #endif
 
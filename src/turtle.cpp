@@ -75,6 +75,12 @@ void Turtle::turn180(float temp)
 }
 TurtleSystem::TurtleSystem(R3Mesh * m)
 :mesh(m)
+,capStart(0)
+,capEnd(-1)
+,capVertexStart(0)
+,capVertexEnd(0)
+,capRadius(0)
+,drawCount(0)
 {
 }
 void TurtleSystem::save()
@@ -103,6 +109,14 @@ void TurtleSystem::restore()
 void TurtleSystem::drawLeaf(float param)
 {
 
+  // When streaming, write out what was drawn so far (the last top cap
+  // can no longer be dropped, and its triangle indices are gone)
+  if (mesh->stream)
+  {
+    mesh->FlushStream();
+    capEnd=-1;
+  }
+
   R3Shape s=mesh->Leaf(direction);
 
   mesh->ScaleShape(s,param,param,param);
@@ -119,8 +133,7 @@ void TurtleSystem::drawLeaf(float param)
 }
 void TurtleSystem::draw(float param)
 {
-  static int num=0;
-  if (num++ % 1000 ==0) cout <<num<<" drawing"<<endl;
+  if (drawCount++ % 1000 ==0 && mesh->verbose) cout <<drawCount<<" drawing"<<endl;
 
   int slices;
   if (thickness<.2)
@@ -133,6 +146,33 @@ void TurtleSystem::draw(float param)
     slices=80;
   else
     slices=100;
+
+  // A segment continuing straight on from the last one, at least as thick, 
+  // hides its top cap -- drop it and its vertices if nothing was drawn after it
+  // (positions and directions are compared with a tolerance for rounding)
+  float radius=param*thickness;
+  R3Vector u=direction;
+  u.Normalize();
+  unsigned int drawn=(mesh->triangulate)?mesh->triangles.size():mesh->NFaces();
+  if (capEnd==drawn && capVertexEnd==mesh->NVertices()
+    && (position-capPosition).Length()<=1e-4*param && (u-capDirection).Length()<=1e-4
+    && radius>=capRadius*(1-1e-4))
+  {
+    if (mesh->triangulate)
+    {
+      mesh->triangles.resize(capStart);
+      mesh->triangle_leaf.resize(capStart/3);
+    }
+    else mesh->DeleteFace(mesh->Face(capStart));
+    for (int i=capVertexStart;i<capVertexEnd;i++) mesh->FreeVertex(mesh->vertices[i]);
+    mesh->vertices.resize(capVertexStart);
+  }
+
+  // When streaming, write out what was drawn so far (or pack it, when packing,
+  // once there is a whole block of vertices)
+  mesh->FlushStream();
+  if (mesh->packing && mesh->NVertices()>=R3_MESH_PACKED_BLOCK_SIZE) mesh->Pack();
+
   R3Shape s=mesh->Cylinder(reduction,slices);
 
   mesh->ScaleShape(s,param*thickness,param,param*thickness);
@@ -156,4 +196,24 @@ void TurtleSystem::draw(float param)
 
   mesh->TranslateShape(s,position.X(),position.Y(),position.Z());
 
+  // Remember where the top cap is (the last triangles and vertices of the
+  // cylinder, or its last face, which shares the side vertices)
+  R3Vector t=direction;
+  t.Normalize();
+  if (mesh->triangulate)
+  {
+    capEnd=mesh->triangles.size();
+    capStart=capEnd-3*(slices-2);
+    capVertexEnd=mesh->NVertices();
+    capVertexStart=capVertexEnd-slices;
+  }
+  else
+  {
+    capEnd=mesh->NFaces();
+    capStart=capEnd-1;
+    capVertexEnd=capVertexStart=mesh->NVertices();
+  }
+  capPosition=position+param*t; //where move() will leave the turtle
+  capDirection=t;
+  capRadius=radius*reduction;
 }
@@ -32,6 +32,14 @@ class TurtleSystem: public Turtle
 {
   stack<Turtle> state;
   R3Mesh *mesh;
+  // Top cap of the last branch segment (triangles or face, and vertices),
+  // with its center, unit direction and radius
+  unsigned int capStart,capEnd;
+  int capVertexStart,capVertexEnd;
+  R3Vector capPosition,capDirection;
+  float capRadius;
+  // Number of branch segments drawn, for progress messages
+  int drawCount;
 public:
   TurtleSystem(R3Mesh * m);
   void save();